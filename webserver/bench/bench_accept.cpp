@@ -0,0 +1,231 @@
+// 连接风暴：每轮同时发起N个连接，每个连接发一个Connection: close的请求并读到服务器关闭，
+// 统计一轮的总耗时、从connect到收完应答的p50/p99/最大值，以及超过1秒(SYN被丢弃后重传)的连接数。
+// 用来比较不同backlog、accept方式(-b/-A)下突发连接的处理能力
+// 用法: bench_accept [-n connections] [-r rounds] [-u url] [-H host] port
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+//一轮最多等待的时间
+static const uint64_t ROUND_TIMEOUT_NS = 15000000000ull;
+
+struct storm_conn
+{
+    int fd;
+    uint64_t start;
+    size_t sent;
+    bool done;
+};
+
+//跑一轮，返回完成的连接数，latency中追加每个完成的连接的耗时
+static int run_round(const struct sockaddr_in &addr, const std::string &request, int n, std::vector<uint64_t> &latency,
+                     uint64_t &elapsed)
+{
+    int epfd = epoll_create1(0);
+    std::vector<storm_conn> conns(n);
+    uint64_t start = now_ns();
+    int live = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        storm_conn &c = conns[i];
+        c.sent = 0;
+        c.done = true;
+        c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (c.fd < 0)
+        {
+            perror("socket");
+            continue;
+        }
+        c.start = now_ns();
+        if (connect(c.fd, (const struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS)
+        {
+            close(c.fd);
+            continue;
+        }
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+        ev.data.u32 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, c.fd, &ev);
+        c.done = false;
+        ++live;
+    }
+
+    int completed = 0;
+    char buf[64 * 1024];
+    struct epoll_event events[1024];
+    while (live > 0 && now_ns() - start < ROUND_TIMEOUT_NS)
+    {
+        int m = epoll_wait(epfd, events, 1024, 100);
+        for (int k = 0; k < m; ++k)
+        {
+            storm_conn &c = conns[events[k].data.u32];
+            if (c.done)
+            {
+                continue;
+            }
+            bool finished = false;
+            bool failed = false;
+            if ((events[k].events & EPOLLOUT) && c.sent < request.size())
+            {
+                ssize_t w = send(c.fd, request.data() + c.sent, request.size() - c.sent, MSG_NOSIGNAL);
+                if (w > 0)
+                {
+                    c.sent += w;
+                    if (c.sent == request.size())
+                    {
+                        struct epoll_event ev;
+                        ev.events = EPOLLIN | EPOLLRDHUP;
+                        ev.data.u32 = events[k].data.u32;
+                        epoll_ctl(epfd, EPOLL_CTL_MOD, c.fd, &ev);
+                    }
+                }
+                else if (w < 0 && errno != EAGAIN)
+                {
+                    failed = true;
+                }
+            }
+            if (!failed && (events[k].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+            {
+                while (true)
+                {
+                    ssize_t r = recv(c.fd, buf, sizeof(buf), 0);
+                    if (r > 0)
+                    {
+                        continue;
+                    }
+                    if (r == 0)
+                    {
+                        finished = c.sent == request.size();
+                        failed = !finished;
+                    }
+                    else if (errno != EAGAIN)
+                    {
+                        failed = true;
+                    }
+                    break;
+                }
+            }
+            if (finished || failed)
+            {
+                if (finished)
+                {
+                    latency.push_back(now_ns() - c.start);
+                    ++completed;
+                }
+                c.done = true;
+                --live;
+                close(c.fd);
+            }
+        }
+    }
+    elapsed = now_ns() - start;
+    for (int i = 0; i < n; ++i)
+    {
+        if (!conns[i].done)
+        {
+            close(conns[i].fd);
+        }
+    }
+    close(epfd);
+    return completed;
+}
+
+int main(int argc, char *argv[])
+{
+    int n = 1000;
+    int rounds = 5;
+    const char *url = "/index.html";
+    const char *host = "127.0.0.1";
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:u:H:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            n = atoi(optarg);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        case 'u':
+            url = optarg;
+            break;
+        case 'H':
+            host = optarg;
+            break;
+        default:
+            break;
+        }
+    }
+    if (optind >= argc || n <= 0 || rounds <= 0)
+    {
+        printf("usage: %s [-n connections] [-r rounds] [-u url] [-H host] port\n", argv[0]);
+        return 1;
+    }
+
+    //每个连接一个描述符，把软限制提高到硬限制
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(argv[optind]));
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+    {
+        printf("bad host %s\n", host);
+        return 1;
+    }
+    std::string request = std::string("GET ") + url + " HTTP/1.1\r\nHost: " + host + "\r\nConnection: close\r\n\r\n";
+
+    std::vector<uint64_t> all;
+    int failed = 0;
+    for (int r = 0; r < rounds; ++r)
+    {
+        std::vector<uint64_t> latency;
+        uint64_t elapsed = 0;
+        int completed = run_round(addr, request, n, latency, elapsed);
+        failed += n - completed;
+        std::sort(latency.begin(), latency.end());
+        long retransmitted = latency.end() - std::lower_bound(latency.begin(), latency.end(), 1000000000ull);
+        size_t m = latency.size();
+        printf("round %d  %d/%d connections in %8.1f ms  p50 %8.1f us  p99 %8.1f us  max %8.1f us  >1s %ld\n", r,
+               completed, n, elapsed / 1e6, m ? latency[m / 2] / 1e3 : 0.0, m ? latency[m * 99 / 100] / 1e3 : 0.0,
+               m ? latency[m - 1] / 1e3 : 0.0, retransmitted);
+        all.insert(all.end(), latency.begin(), latency.end());
+        //等服务器处理完上一轮的TIME_WAIT和关闭
+        usleep(200000);
+    }
+    std::sort(all.begin(), all.end());
+    size_t m = all.size();
+    if (m)
+    {
+        long retransmitted = all.end() - std::lower_bound(all.begin(), all.end(), 1000000000ull);
+        printf("total  %zu connections  failed %d  p50 %.1f us  p99 %.1f us  p99.9 %.1f us  >1s %ld\n", m, failed,
+               all[m / 2] / 1e3, all[m * 99 / 100] / 1e3, all[m * 999 / 1000] / 1e3, retransmitted);
+    }
+    return failed ? 2 : 0;
+}
@@ -0,0 +1,163 @@
+// Buffer的几种典型用法的吞吐量：拼应答头(小块追加后整体取走)、流式追加/部分取走(触发搬移)、
+// 从空缓冲区增长到大块再归还buffer_pool，以及ReadFd从socket读取
+// 用法: bench_buffer [rounds]
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <string>
+#include "../buffer.h"
+
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+//防止编译器把结果优化掉
+static volatile size_t g_sink;
+
+static const char *HEADER_LINES[] = {
+    "HTTP/1.1 200 OK\r\n",
+    "Server: webserver\r\n",
+    "Date: Sun, 18 Oct 2026 06:00:00 GMT\r\n",
+    "Content-Type: text/html\r\n",
+    "Content-Length: 12345\r\n",
+    "Connection: keep-alive\r\n",
+    "\r\n",
+};
+
+static void print(const char *name, long ops, uint64_t ns, size_t bytes)
+{
+    printf("%-22s %12.0f ops/s   %8.1f ns/op   %8.1f MB/s\n", name, ops * 1e9 / ns, (double)ns / ops,
+           bytes * 1e3 / ns);
+}
+
+//一个应答头的7行逐行追加，然后整体取走
+static void bench_header(long rounds)
+{
+    size_t lens[7];
+    size_t total = 0;
+    for (int i = 0; i < 7; ++i)
+    {
+        lens[i] = strlen(HEADER_LINES[i]);
+        total += lens[i];
+    }
+    Buffer buf(1024);
+    uint64_t start = now_ns();
+    for (long r = 0; r < rounds; ++r)
+    {
+        for (int i = 0; i < 7; ++i)
+        {
+            buf.Append(HEADER_LINES[i], lens[i]);
+        }
+        g_sink += buf.ReadableBytes();
+        buf.RetrieveAll();
+    }
+    print("header append", rounds, now_ns() - start, rounds * total);
+
+    //对照：同样的拼接写到std::string
+    std::string str;
+    start = now_ns();
+    for (long r = 0; r < rounds; ++r)
+    {
+        for (int i = 0; i < 7; ++i)
+        {
+            str.append(HEADER_LINES[i], lens[i]);
+        }
+        g_sink += str.size();
+        str.clear();
+    }
+    print("header std::string", rounds, now_ns() - start, rounds * total);
+}
+
+//每次追加300字节、取走200字节，未读数据不断积累，写到末尾后搬移或者增长
+static void bench_stream(long rounds)
+{
+    char chunk[300];
+    memset(chunk, 'x', sizeof(chunk));
+    Buffer buf(4096);
+    uint64_t start = now_ns();
+    for (long r = 0; r < rounds; ++r)
+    {
+        buf.Append(chunk, sizeof(chunk));
+        buf.Retrieve(buf.ReadableBytes() > 2048 ? buf.ReadableBytes() : 200);
+    }
+    g_sink += buf.Capacity();
+    print("stream append/retrieve", rounds, now_ns() - start, rounds * sizeof(chunk));
+}
+
+//从未分配的缓冲区按1KB追加到64KB，再把存储归还给buffer_pool
+static void bench_grow(long rounds)
+{
+    char chunk[1024];
+    memset(chunk, 'y', sizeof(chunk));
+    Buffer buf(1024);
+    uint64_t start = now_ns();
+    for (long r = 0; r < rounds; ++r)
+    {
+        for (int i = 0; i < 64; ++i)
+        {
+            buf.Append(chunk, sizeof(chunk));
+        }
+        g_sink += buf.Capacity();
+        buf.Release();
+    }
+    print("grow to 64KB + release", rounds, now_ns() - start, rounds * 64 * sizeof(chunk));
+}
+
+//对端每次写入size字节，ReadFd读出后取走
+static void bench_readfd(long rounds, size_t size)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+    {
+        perror("socketpair");
+        return;
+    }
+    std::string data(size, 'z');
+    Buffer buf(2048);
+    uint64_t start = now_ns();
+    for (long r = 0; r < rounds; ++r)
+    {
+        if (write(fds[1], data.data(), size) != (ssize_t)size)
+        {
+            perror("write");
+            break;
+        }
+        size_t got = 0;
+        while (got < size)
+        {
+            int err = 0;
+            ssize_t n = buf.ReadFd(fds[0], &err);
+            if (n <= 0)
+            {
+                break;
+            }
+            got += n;
+        }
+        buf.RetrieveAll();
+    }
+    uint64_t ns = now_ns() - start;
+    close(fds[0]);
+    close(fds[1]);
+    char name[32];
+    snprintf(name, sizeof(name), "ReadFd %zu B", size);
+    print(name, rounds, ns, rounds * size);
+}
+
+int main(int argc, char *argv[])
+{
+    long rounds = argc > 1 ? atol(argv[1]) : 1000000;
+
+    bench_header(rounds);
+    bench_stream(rounds);
+    bench_grow(rounds / 100);
+    bench_readfd(rounds / 10, 512);
+    bench_readfd(rounds / 100, 16 * 1024);
+    return 0;
+}
@@ -0,0 +1,171 @@
+// 1到32个线程同时写日志时的吞吐量：异步模式(每线程队列+后台线程批量写)下分别测
+// 调用线程格式化(text)、后台线程格式化(deferred)和写二进制文件(binary)，再比较队列满时的各种策略，最后测同步模式
+// 用法: bench_log [每线程调用次数] [日志目录]
+// 编译: g++ -O2 -pthread bench/bench_log.cpp log.cpp log_record.cpp -lz，或者cmake构建的bench_log目标
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <vector>
+#include "../log.h"
+
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int g_calls;
+
+//与reactor在每个事件上写的日志相同
+static void *worker(void *arg)
+{
+    long id = (long)arg;
+    for (int i = 0; i < g_calls; ++i)
+    {
+        LOG_INFO("%s", "adjust timer once");
+        LOG_INFO("close fd %d", (int)(id * 1000 + i % 1000));
+    }
+    return NULL;
+}
+
+static void run_bench(const char *mode, int threads)
+{
+    std::vector<pthread_t> tids(threads);
+    uint64_t start = now_ns();
+    for (long i = 0; i < threads; ++i)
+    {
+        pthread_create(&tids[i], NULL, worker, (void *)i);
+    }
+    for (int i = 0; i < threads; ++i)
+    {
+        pthread_join(tids[i], NULL);
+    }
+    uint64_t produce_ns = now_ns() - start;
+    //等待后台线程把日志全部写入文件
+    Log::Instance()->flush();
+    uint64_t total_ns = now_ns() - start;
+    double calls = 2.0 * g_calls * threads;
+    printf("%-8s threads %2d   %12.0f calls/s   %12.0f calls/s (including flush)\n", mode, threads,
+           calls * 1e9 / produce_ns, calls * 1e9 / total_ns);
+}
+
+//调用线程上每条日志的开销：每轮写入不到半个队列的记录，不触发唤醒，也不等待后台线程
+static void run_latency(const char *mode)
+{
+    const int burst = 256;
+    const int rounds = 2000;
+    uint64_t ns = 0;
+    for (int r = 0; r < rounds; ++r)
+    {
+        uint64_t start = now_ns();
+        for (int i = 0; i < burst / 2; ++i)
+        {
+            LOG_INFO("%s", "adjust timer once");
+            LOG_INFO("close fd %d", i);
+        }
+        ns += now_ns() - start;
+        Log::Instance()->flush();
+    }
+    printf("%-8s %6.1f ns/call on the calling thread\n", mode, (double)ns / ((double)burst * rounds));
+}
+
+//各溢出策略下8个线程写日志：单次调用的最长耗时和各级别被丢弃的条数，单核机器上最长耗时主要是线程被抢占的时间
+static uint64_t g_max_ns[8];
+
+static void *policy_worker(void *arg)
+{
+    long id = (long)arg;
+    uint64_t max_ns = 0;
+    for (int i = 0; i < g_calls; ++i)
+    {
+        uint64_t start = now_ns();
+        if (i % 4 == 0)
+        {
+            LOG_WARN("close fd %d", i);
+        }
+        else
+        {
+            LOG_INFO("%s", "adjust timer once");
+        }
+        uint64_t ns = now_ns() - start;
+        if (ns > max_ns)
+        {
+            max_ns = ns;
+        }
+    }
+    g_max_ns[id] = max_ns;
+    return NULL;
+}
+
+static void run_policy(const char *name, Log::POLICY policy)
+{
+    Log *log = Log::Instance();
+    log->SetOverflowPolicy(policy);
+    uint64_t info = log->GetDropped(1), warn = log->GetDropped(2);
+    pthread_t tids[8];
+    uint64_t start = now_ns();
+    for (long i = 0; i < 8; ++i)
+    {
+        pthread_create(&tids[i], NULL, policy_worker, (void *)i);
+    }
+    uint64_t max_ns = 0;
+    for (int i = 0; i < 8; ++i)
+    {
+        pthread_join(tids[i], NULL);
+        max_ns = g_max_ns[i] > max_ns ? g_max_ns[i] : max_ns;
+    }
+    uint64_t ns = now_ns() - start;
+    log->flush();
+    printf("%-12s %12.0f calls/s   max %8.1f us/call   dropped info %9llu warn %9llu\n", name,
+           8.0 * g_calls * 1e9 / ns, max_ns / 1e3, (unsigned long long)(log->GetDropped(1) - info),
+           (unsigned long long)(log->GetDropped(2) - warn));
+}
+
+int main(int argc, char *argv[])
+{
+    g_calls = argc > 1 ? atoi(argv[1]) : 100000;
+    const char *path = argc > 2 ? argv[2] : "/tmp/bench_log";
+    const int threads[] = {1, 2, 4, 8, 16, 32};
+
+    Log::Instance()->init(1, path, ".log", 1024);
+    run_latency("text");
+    Log::Instance()->init(1, path, ".log", 1024, Log::MODE_DEFERRED);
+    run_latency("deferred");
+    Log::Instance()->init(1, path, ".blog", 1024, Log::MODE_BINARY);
+    run_latency("binary");
+
+    Log::Instance()->init(1, path, ".log", 1024, Log::MODE_TEXT);
+    for (int i = 0; i < 6; ++i)
+    {
+        run_bench("text", threads[i]);
+    }
+    Log::Instance()->init(1, path, ".log", 1024, Log::MODE_DEFERRED);
+    for (int i = 0; i < 6; ++i)
+    {
+        run_bench("deferred", threads[i]);
+    }
+    Log::Instance()->init(1, path, ".blog", 1024, Log::MODE_BINARY);
+    for (int i = 0; i < 6; ++i)
+    {
+        run_bench("binary", threads[i]);
+    }
+
+    Log::Instance()->init(1, path, ".log", 1024, Log::MODE_TEXT);
+    run_policy("block", Log::POLICY_BLOCK);
+    run_policy("drop-newest", Log::POLICY_DROP_NEWEST);
+    run_policy("drop-level", Log::POLICY_DROP_LEVEL);
+    run_policy("sample", Log::POLICY_SAMPLE);
+    Log::Instance()->SetOverflowPolicy(Log::POLICY_BLOCK);
+
+    //同步模式每条日志一次write(2)，只跑少量调用
+    g_calls /= 10;
+    Log::Instance()->init(1, path, ".log", 0, Log::MODE_TEXT);
+    for (int i = 0; i < 6; ++i)
+    {
+        run_bench("sync", threads[i]);
+    }
+    return 0;
+}
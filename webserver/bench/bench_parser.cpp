@@ -0,0 +1,186 @@
+// 请求解析吞吐量：原来的逐字节找行尾+strncasecmp链，与http_parser各指令集实现的比较
+// 语料是几种常见浏览器和工具发出的真实请求
+// 用法: bench_parser [rounds]
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "../http_parser.h"
+
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static const char *corpus[] = {
+    //Chrome
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\", \"Not=A?Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "sec-ch-ua-platform: \"Windows\"\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "Cookie: _ga=GA1.2.1234567890.1697000000; session=4f2a9c1e7b3d4e5f6a7b8c9d0e1f2a3b\r\n"
+    "If-None-Match: \"65300a1f-12f\"\r\n"
+    "If-Modified-Since: Wed, 18 Oct 2023 16:00:31 GMT\r\n"
+    "\r\n",
+    //Firefox
+    "GET /poetry/libai.html HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Ubuntu; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/118.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Referer: https://www.example.com/index.html\r\n"
+    "Connection: keep-alive\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "\r\n",
+    //Safari
+    "GET /images/logo.png HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Accept: image/webp,image/avif,image/jxl,image/heic,image/heic-sequence,video/*;q=0.8,image/png,image/svg+xml,image/*;q=0.8,*/*;q=0.5\r\n"
+    "Accept-Language: zh-CN,zh-Hans;q=0.9\r\n"
+    "Connection: keep-alive\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.0 Safari/605.1.15\r\n"
+    "Referer: https://www.example.com/index.html\r\n"
+    "\r\n",
+    //curl
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: 127.0.0.1:9006\r\n"
+    "User-Agent: curl/7.88.1\r\n"
+    "Accept: */*\r\n"
+    "\r\n",
+    //wrk/ab一类的压测工具
+    "GET / HTTP/1.1\r\n"
+    "Host: 127.0.0.1:9006\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+};
+
+static const int CORPUS_NUMBER = sizeof(corpus) / sizeof(corpus[0]);
+
+//原来的parse_line：逐字节查找\r\n
+static const char *scalar_line_end(const char *begin, const char *end)
+{
+    for (; begin < end; ++begin)
+    {
+        if (*begin == '\r' || *begin == '\n')
+        {
+            break;
+        }
+    }
+    return begin;
+}
+
+//原来的parse_headers：依次strncasecmp比较关心的头部
+static int classify_chain(const char *text)
+{
+    if (strncasecmp(text, "Connection:", 11) == 0)
+    {
+        return http_parser::HEADER_CONNECTION;
+    }
+    else if (strncasecmp(text, "Content-Length:", 15) == 0)
+    {
+        return http_parser::HEADER_CONTENT_LENGTH;
+    }
+    else if (strncasecmp(text, "Host:", 5) == 0)
+    {
+        return http_parser::HEADER_HOST;
+    }
+    return http_parser::HEADER_UNKNOWN;
+}
+
+static int classify_hash(const char *text, const char *end)
+{
+    const char *colon = http_parser::find_char(text, end, ':');
+    return http_parser::header_id(text, colon - text);
+}
+
+//把一个请求切成行并给每个头部分类，返回分类结果之和防止被优化掉
+template <bool NEW>
+static long parse(const char *req, size_t len)
+{
+    const char *p = req;
+    const char *end = req + len;
+    long sum = 0;
+    bool first = true;
+    while (p < end)
+    {
+        const char *eol = NEW ? http_parser::find_line_end(p, end) : scalar_line_end(p, end);
+        if (eol == p)
+        {
+            break;
+        }
+        if (!first)
+        {
+            sum += NEW ? classify_hash(p, eol) : classify_chain(p);
+        }
+        first = false;
+        p = eol + 2;
+    }
+    return sum;
+}
+
+template <bool NEW>
+static void run_bench(const char *name, const std::vector<std::string> &reqs, int rounds)
+{
+    size_t bytes = 0;
+    long sum = 0;
+    uint64_t start = now_ns();
+    for (int r = 0; r < rounds; ++r)
+    {
+        for (size_t i = 0; i < reqs.size(); ++i)
+        {
+            sum += parse<NEW>(reqs[i].data(), reqs[i].size());
+            bytes += reqs[i].size();
+        }
+    }
+    uint64_t ns = now_ns() - start;
+    size_t count = (size_t)rounds * reqs.size();
+    printf("%-22s %12.0f req/s %10.1f MB/s   (sum %ld)\n", name, count * 1e9 / ns,
+           bytes * 1e3 / ns, sum);
+}
+
+int main(int argc, char *argv[])
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 200000;
+    std::vector<std::string> reqs(corpus, corpus + CORPUS_NUMBER);
+
+    http_parser::init();
+    run_bench<false>("byte loop+strncasecmp", reqs, rounds);
+
+    const http_parser::ISA isas[] = {http_parser::ISA_SCALAR, http_parser::ISA_SSE42, http_parser::ISA_AVX2};
+    for (int i = 0; i < 3; ++i)
+    {
+        http_parser::init(isas[i]);
+        if (http_parser::isa() != isas[i])
+        {
+            printf("%-22s not supported\n", http_parser::isa_name(isas[i]));
+            continue;
+        }
+        std::string name = std::string("http_parser ") + http_parser::isa_name(isas[i]);
+        run_bench<true>(name.c_str(), reqs, rounds);
+    }
+    return 0;
+}
@@ -0,0 +1,167 @@
+// 逐个头部vsnprintf与预先渲染的应答块memcpy两种方式填充200和404应答的吞吐量
+// 用法: bench_response [ops]
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include "../http_response.h"
+
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static const int WRITE_BUFFER_SIZE = 1024;
+static const char *error_404_form = "The requested file was not found on this server.\n";
+
+//原来的写法：每个头部一次vsnprintf
+struct printf_writer
+{
+    char buf[WRITE_BUFFER_SIZE];
+    int idx;
+
+    bool add_response(const char *format, ...)
+    {
+        if (idx >= WRITE_BUFFER_SIZE)
+        {
+            return false;
+        }
+        va_list arg_list;
+        va_start(arg_list, format);
+        int len = vsnprintf(buf + idx, WRITE_BUFFER_SIZE - 1 - idx, format, arg_list);
+        va_end(arg_list);
+        if (len >= (WRITE_BUFFER_SIZE - 1 - idx))
+        {
+            return false;
+        }
+        idx += len;
+        return true;
+    }
+
+    bool fill_200(off_t size, bool linger)
+    {
+        idx = 0;
+        return add_response("%s %d %s\r\n", "HTTP/1.1", 200, "OK") &&
+               add_response("Content-Length:%ld\r\n", (long)size) &&
+               add_response("Content-Type:%s\r\n", "text/html") &&
+               add_response("Connection: %s\r\n", linger ? "Keep-alive" : "close") &&
+               add_response("%s", "\r\n");
+    }
+
+    bool fill_404(bool linger)
+    {
+        idx = 0;
+        return add_response("%s %d %s\r\n", "HTTP/1.1", 404, "Not Found") &&
+               add_response("Content-Length:%ld\r\n", (long)strlen(error_404_form)) &&
+               add_response("Content-Type:%s\r\n", "text/html") &&
+               add_response("Connection: %s\r\n", linger ? "Keep-alive" : "close") &&
+               add_response("%s", "\r\n") &&
+               add_response("%s", error_404_form);
+    }
+};
+
+//现在的写法：预先渲染的块 + 每秒缓存的Date，文件的头部由文件缓存在加载时生成一次
+struct block_writer
+{
+    char buf[WRITE_BUFFER_SIZE];
+    size_t idx;
+
+    bool add_bytes(const char *data, size_t len)
+    {
+        if (idx + len > WRITE_BUFFER_SIZE)
+        {
+            return false;
+        }
+        memcpy(buf + idx, data, len);
+        idx += len;
+        return true;
+    }
+
+    bool add_bytes(const std::string &block)
+    {
+        return add_bytes(block.data(), block.size());
+    }
+
+    bool add_date()
+    {
+        char date[http_response::DATE_LEN];
+        return add_bytes(date, http_response::write_date(date));
+    }
+
+    bool fill_200(const std::string &file_headers, bool linger)
+    {
+        idx = 0;
+        return add_bytes(http_response::status_line(200)) && add_date() &&
+               add_bytes(file_headers) && add_bytes(http_response::connection(linger));
+    }
+
+    bool fill_404(bool linger)
+    {
+        idx = 0;
+        return add_bytes(http_response::error_head(404)) && add_date() &&
+               add_bytes(http_response::error_tail(404, linger));
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    int ops = argc > 1 ? atoi(argv[1]) : 2000000;
+    http_response::init();
+
+    off_t size = 123456;
+    char num[http_response::UINT_LEN];
+    std::string file_headers = "Content-Length:";
+    file_headers.append(num, http_response::write_uint(num, size));
+    file_headers += "\r\nContent-Type:text/html\r\n";
+
+    printf_writer *pw = new printf_writer;
+    block_writer *bw = new block_writer;
+    //累加写入的字节数，防止循环被优化掉
+    size_t sink = 0;
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < ops; ++i)
+    {
+        pw->fill_200(size, i & 1);
+        sink += pw->idx;
+    }
+    uint64_t printf_200 = now_ns() - start;
+
+    start = now_ns();
+    for (int i = 0; i < ops; ++i)
+    {
+        bw->fill_200(file_headers, i & 1);
+        sink += bw->idx;
+    }
+    uint64_t block_200 = now_ns() - start;
+
+    start = now_ns();
+    for (int i = 0; i < ops; ++i)
+    {
+        pw->fill_404(i & 1);
+        sink += pw->idx;
+    }
+    uint64_t printf_404 = now_ns() - start;
+
+    start = now_ns();
+    for (int i = 0; i < ops; ++i)
+    {
+        bw->fill_404(i & 1);
+        sink += bw->idx;
+    }
+    uint64_t block_404 = now_ns() - start;
+
+    printf("%-10s 200 %12.0f ops/s   404 %12.0f ops/s\n", "vsnprintf",
+           ops * 1e9 / printf_200, ops * 1e9 / printf_404);
+    printf("%-10s 200 %12.0f ops/s   404 %12.0f ops/s\n", "block",
+           ops * 1e9 / block_200, ops * 1e9 / block_404);
+    printf("bytes %zu\n", sink);
+    delete pw;
+    delete bw;
+    return 0;
+}
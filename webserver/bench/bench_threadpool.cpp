@@ -0,0 +1,112 @@
+// threadpool与ws_threadpool的入队/出队吞吐量和交接延迟对比
+// 用法: bench_threadpool [producers] [workers] [tasks_per_producer]
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include "../threadpool.h"
+#include "../ws_threadpool.h"
+
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static std::atomic<long> g_done(0);
+
+//测试任务：记录从入队到被工作线程取出的时间
+struct bench_task
+{
+    uint64_t enqueue_ns;
+    uint64_t latency_ns;
+
+    void process()
+    {
+        latency_ns = now_ns() - enqueue_ns;
+        g_done.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+struct producer_arg
+{
+    task_pool<bench_task> *pool;
+    bench_task *tasks;
+    long count;
+};
+
+static void *producer(void *arg)
+{
+    producer_arg *p = (producer_arg *)arg;
+    for (long i = 0; i < p->count; ++i)
+    {
+        bench_task *t = p->tasks + i;
+        t->enqueue_ns = now_ns();
+        //队列满时让出CPU后重试
+        while (!p->pool->append(t))
+        {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void run_bench(const char *name, task_pool<bench_task> *pool, int producers, long per_producer)
+{
+    long total = producers * per_producer;
+    std::vector<bench_task> tasks(total);
+    std::vector<pthread_t> threads(producers);
+    std::vector<producer_arg> args(producers);
+
+    g_done = 0;
+    uint64_t start = now_ns();
+    for (int i = 0; i < producers; ++i)
+    {
+        args[i].pool = pool;
+        args[i].tasks = &tasks[i * per_producer];
+        args[i].count = per_producer;
+        pthread_create(&threads[i], NULL, producer, &args[i]);
+    }
+    for (int i = 0; i < producers; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    while (g_done.load() < total)
+    {
+        sched_yield();
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    std::vector<uint64_t> lat(total);
+    for (long i = 0; i < total; ++i)
+    {
+        lat[i] = tasks[i].latency_ns;
+    }
+    std::sort(lat.begin(), lat.end());
+    printf("%-14s %10.0f ops/s   p50 %8.1f us   p99 %8.1f us\n", name,
+           total * 1e9 / elapsed, lat[total / 2] / 1000.0, lat[total * 99 / 100] / 1000.0);
+}
+
+int main(int argc, char *argv[])
+{
+    int producers = argc > 1 ? atoi(argv[1]) : 2;
+    int workers = argc > 2 ? atoi(argv[2]) : 4;
+    long per_producer = argc > 3 ? atol(argv[3]) : 200000;
+
+    printf("producers %d, workers %d, tasks %ld\n", producers, workers, producers * per_producer);
+
+    //threadpool的工作线程是脱离线程，析构后仍会访问信号量，因此这里不释放它，随进程退出
+    threadpool<bench_task> *legacy = new threadpool<bench_task>(workers, 10000);
+    run_bench("threadpool", legacy, producers, per_producer);
+
+    ws_threadpool<bench_task> *ws = new ws_threadpool<bench_task>(workers, 10000);
+    run_bench("ws_threadpool", ws, producers, per_producer);
+    delete ws;
+    return 0;
+}
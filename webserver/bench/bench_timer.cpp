@@ -0,0 +1,93 @@
+// sort_timer_lst与time_wheel在不同存活定时器数量下的添加/调整/删除吞吐量
+// 用法: bench_timer [ops]
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+#include "../ls_time.h"
+#include "../time_wheel.h"
+
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void cb_noop(client_data *) {}
+
+//sort_timer_lst的结点逐个new/delete，time_wheel的结点来自它自己的对象池
+static util_timer *alloc_timer(sort_timer_lst *)
+{
+    return new util_timer;
+}
+
+static util_timer *alloc_timer(time_wheel *c)
+{
+    return c->alloc_timer();
+}
+
+template <typename Container>
+static util_timer *make_timer(Container *c, time_t expire)
+{
+    util_timer *timer = alloc_timer(c);
+    timer->expire = expire;
+    timer->cb_func = cb_noop;
+    timer->user_data = NULL;
+    return timer;
+}
+
+//live个定时器常驻容器，随后执行ops次“调整到最晚”(模拟每次请求刷新连接超时)，
+//以及ops次删除+添加(模拟连接关闭和新连接到来)
+template <typename Container>
+static void run_bench(const char *name, int live, int ops)
+{
+    Container *c = new Container;
+    time_t base = time(NULL) + 60;
+    std::vector<util_timer *> timers(live);
+
+    //sort_timer_lst从头部查找插入位置，按超时时间降序添加可避免建表本身成为O(n^2)
+    for (int i = live - 1; i >= 0; --i)
+    {
+        timers[i] = make_timer(c, base + i / 16);
+        c->add_timer(timers[i]);
+    }
+    time_t latest = base + live / 16 + 1;
+
+    srand(1);
+    uint64_t start = now_ns();
+    for (int i = 0; i < ops; ++i)
+    {
+        util_timer *timer = timers[rand() % live];
+        timer->expire = latest;
+        c->adjust_timer(timer);
+    }
+    uint64_t adjust_ns = now_ns() - start;
+
+    start = now_ns();
+    for (int i = 0; i < ops; ++i)
+    {
+        int k = rand() % live;
+        c->del_timer(timers[k]);
+        timers[k] = make_timer(c, latest);
+        c->add_timer(timers[k]);
+    }
+    uint64_t readd_ns = now_ns() - start;
+
+    printf("%-15s live %7d   adjust %12.0f ops/s   del+add %12.0f ops/s\n", name, live,
+           ops * 1e9 / adjust_ns, ops * 1e9 / readd_ns);
+    delete c;
+}
+
+int main(int argc, char *argv[])
+{
+    int ops = argc > 1 ? atoi(argv[1]) : 20000;
+    const int lives[] = {1000, 10000, 100000};
+    for (int i = 0; i < 3; ++i)
+    {
+        run_bench<sort_timer_lst>("sort_timer_lst", lives[i], ops);
+        run_bench<time_wheel>("time_wheel", lives[i], ops);
+    }
+    return 0;
+}
@@ -0,0 +1,685 @@
+// HTTP压测工具：多个线程各自用epoll驱动一组连接，在回环地址上对服务器施压，
+// 统计请求数/秒、延迟的p50/p99/p99.9，以及每个请求消耗的服务器和压测端CPU时间
+// 模式：keepalive 每个长连接同时只有一个请求
+//       pipeline  每个长连接保持depth个请求在途，收到一个应答补发一个
+//       churn     每个请求一个新连接(Connection: close)，延迟包括建立连接
+// 用法: loadgen [-t threads] [-c connections] [-d seconds] [-W warmup_seconds] [-m mode] [-p depth]
+//               [-u url]... [-g doc_root -s size]... [-H host] [-e accept_encoding] [-P server_pid] port
+//       -s在doc_root下生成指定大小的文件(可带k/m后缀)并请求它，多个-u/-s时轮流请求
+//       -e在请求中带上Accept-Encoding头部，用来测压缩版本的应答
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+enum MODE
+{
+    KEEPALIVE = 0,
+    PIPELINE,
+    CHURN
+};
+
+static const char *MODE_NAME[] = {"keepalive", "pipeline", "churn"};
+
+//一个连接最多在途的请求数
+static const int MAX_DEPTH = 64;
+//应答头的最大长度
+static const int HEADER_SIZE = 8192;
+
+static MODE g_mode = KEEPALIVE;
+static int g_depth = 8;
+static struct sockaddr_in g_addr;
+static std::vector<std::string> g_requests;
+
+//预热结束后开始统计，只统计在此之后发出的请求；g_stop后各线程退出
+static std::atomic<bool> g_recording(false);
+static std::atomic<uint64_t> g_start_ns(0);
+static std::atomic<bool> g_stop(false);
+
+struct conn
+{
+    int fd;
+    bool connecting;
+    //churn模式下应答已收完，等待服务器关闭连接，让TIME_WAIT留在服务器一侧
+    bool closing;
+    bool want_out;
+    //待发送的请求
+    std::string out;
+    size_t out_off;
+    //在途请求的发出时刻，环形队列
+    uint64_t sent[MAX_DEPTH];
+    int head;
+    int inflight;
+    //下一个请求的URL序号
+    size_t next_url;
+    //应答解析状态
+    char header[HEADER_SIZE];
+    size_t header_len;
+    bool in_body;
+    size_t body_left;
+    int status;
+};
+
+struct worker
+{
+    pthread_t tid;
+    int epfd;
+    int conn_number;
+    std::vector<conn> conns;
+    std::vector<uint64_t> latency;
+    long done;
+    long errors;
+    long non_2xx;
+    uint64_t bytes;
+};
+
+static void set_events(worker *w, conn *c, bool out)
+{
+    struct epoll_event ev;
+    ev.data.ptr = c;
+    ev.events = EPOLLIN | EPOLLRDHUP | (out ? EPOLLOUT : 0);
+    epoll_ctl(w->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->want_out = out;
+}
+
+//把n个请求加入待发送队列，记录发出时刻
+static void queue_requests(conn *c, int n, uint64_t now)
+{
+    for (int i = 0; i < n; ++i)
+    {
+        c->out += g_requests[c->next_url];
+        c->next_url = (c->next_url + 1) % g_requests.size();
+        c->sent[(c->head + c->inflight) % MAX_DEPTH] = now;
+        ++c->inflight;
+    }
+}
+
+//发送待发送的数据，socket缓冲区满时注册EPOLLOUT，返回false表示连接出错
+static bool flush_out(worker *w, conn *c)
+{
+    while (c->out_off < c->out.size())
+    {
+        ssize_t n = send(c->fd, c->out.data() + c->out_off, c->out.size() - c->out_off, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                if (!c->want_out)
+                {
+                    set_events(w, c, true);
+                }
+                return true;
+            }
+            return false;
+        }
+        c->out_off += n;
+    }
+    c->out.clear();
+    c->out_off = 0;
+    if (c->want_out)
+    {
+        set_events(w, c, false);
+    }
+    return true;
+}
+
+//建立连接，churn模式下第一个请求的发出时刻就是开始连接的时刻
+static bool open_conn(worker *w, conn *c)
+{
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (c->fd < 0)
+    {
+        perror("socket");
+        return false;
+    }
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    c->connecting = true;
+    c->closing = false;
+    c->out.clear();
+    c->out_off = 0;
+    c->head = 0;
+    c->inflight = 0;
+    c->header_len = 0;
+    c->in_body = false;
+    c->body_left = 0;
+    queue_requests(c, g_mode == PIPELINE ? g_depth : 1, now_ns());
+
+    struct epoll_event ev;
+    ev.data.ptr = c;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+    c->want_out = true;
+    epoll_ctl(w->epfd, EPOLL_CTL_ADD, c->fd, &ev);
+    if (connect(c->fd, (struct sockaddr *)&g_addr, sizeof(g_addr)) < 0 && errno != EINPROGRESS)
+    {
+        return false;
+    }
+    return true;
+}
+
+static void close_conn(worker *w, conn *c)
+{
+    epoll_ctl(w->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->fd = -1;
+}
+
+//连接出错或者被意外关闭：在途的请求计为错误，重新连接
+static void reset_conn(worker *w, conn *c)
+{
+    if (c->inflight > 0 && g_recording.load(std::memory_order_relaxed))
+    {
+        w->errors += c->inflight;
+    }
+    close_conn(w, c);
+    if (!g_stop.load(std::memory_order_relaxed))
+    {
+        open_conn(w, c);
+    }
+}
+
+//一个应答收完
+static void complete(worker *w, conn *c, uint64_t now)
+{
+    uint64_t sent = c->sent[c->head];
+    c->head = (c->head + 1) % MAX_DEPTH;
+    --c->inflight;
+    if (g_recording.load(std::memory_order_acquire) && sent >= g_start_ns.load(std::memory_order_relaxed) &&
+        !g_stop.load(std::memory_order_relaxed))
+    {
+        w->latency.push_back(now - sent);
+        ++w->done;
+        if (c->status < 200 || c->status >= 300)
+        {
+            ++w->non_2xx;
+        }
+    }
+    if (g_mode == CHURN)
+    {
+        c->closing = true;
+    }
+    else if (!g_stop.load(std::memory_order_relaxed))
+    {
+        queue_requests(c, 1, now);
+    }
+}
+
+//解析读到的数据，返回false表示应答格式错误
+static bool consume(worker *w, conn *c, const char *data, size_t len, uint64_t now)
+{
+    if (g_recording.load(std::memory_order_relaxed))
+    {
+        w->bytes += len;
+    }
+    while (len > 0)
+    {
+        if (c->in_body)
+        {
+            size_t n = len < c->body_left ? len : c->body_left;
+            c->body_left -= n;
+            data += n;
+            len -= n;
+            if (c->body_left == 0)
+            {
+                c->in_body = false;
+                complete(w, c, now);
+            }
+            continue;
+        }
+        if (c->inflight == 0)
+        {
+            return false;
+        }
+        //应答头可能分几次读到，先拼到header里再找空行
+        size_t old = c->header_len;
+        size_t n = len < HEADER_SIZE - 1 - old ? len : HEADER_SIZE - 1 - old;
+        memcpy(c->header + old, data, n);
+        c->header_len += n;
+        c->header[c->header_len] = '\0';
+        char *end = strstr(c->header + (old > 3 ? old - 3 : 0), "\r\n\r\n");
+        if (!end)
+        {
+            if (c->header_len == HEADER_SIZE - 1)
+            {
+                return false;
+            }
+            data += n;
+            len -= n;
+            continue;
+        }
+        size_t header_end = end + 4 - c->header;
+        size_t used = header_end - old;
+        data += used;
+        len -= used;
+        *end = '\0';
+
+        if (strncmp(c->header, "HTTP/1.", 7) != 0 || c->header_len < 12)
+        {
+            return false;
+        }
+        c->status = atoi(c->header + 9);
+        c->body_left = 0;
+        for (char *line = strstr(c->header, "\r\n"); line; line = strstr(line + 2, "\r\n"))
+        {
+            if (strncasecmp(line + 2, "Content-Length:", 15) == 0)
+            {
+                c->body_left = strtoull(line + 17, NULL, 10);
+                break;
+            }
+        }
+        c->header_len = 0;
+        if (c->body_left > 0)
+        {
+            c->in_body = true;
+        }
+        else
+        {
+            complete(w, c, now);
+        }
+    }
+    return true;
+}
+
+static void handle_read(worker *w, conn *c, char *buf, size_t size)
+{
+    while (true)
+    {
+        ssize_t n = recv(c->fd, buf, size, 0);
+        if (n > 0)
+        {
+            if (!consume(w, c, buf, n, now_ns()))
+            {
+                reset_conn(w, c);
+                return;
+            }
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            break;
+        }
+        //服务器关闭了连接：churn模式下这是正常结束，否则在途请求计为错误
+        if (c->closing && c->inflight == 0)
+        {
+            close_conn(w, c);
+            if (!g_stop.load(std::memory_order_relaxed))
+            {
+                open_conn(w, c);
+            }
+        }
+        else
+        {
+            reset_conn(w, c);
+        }
+        return;
+    }
+    if (!c->closing && !flush_out(w, c))
+    {
+        reset_conn(w, c);
+    }
+}
+
+static void *worker_loop(void *arg)
+{
+    worker *w = (worker *)arg;
+    w->epfd = epoll_create1(0);
+    w->conns.resize(w->conn_number);
+    for (int i = 0; i < w->conn_number; ++i)
+    {
+        w->conns[i].next_url = i % g_requests.size();
+        if (!open_conn(w, &w->conns[i]))
+        {
+            w->conns[i].fd = -1;
+            ++w->errors;
+        }
+    }
+
+    std::vector<char> buf(256 * 1024);
+    struct epoll_event events[256];
+    while (!g_stop.load(std::memory_order_relaxed))
+    {
+        int n = epoll_wait(w->epfd, events, 256, 100);
+        for (int i = 0; i < n; ++i)
+        {
+            conn *c = (conn *)events[i].data.ptr;
+            if (c->fd < 0)
+            {
+                continue;
+            }
+            if (c->connecting && (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+            {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err != 0)
+                {
+                    reset_conn(w, c);
+                    continue;
+                }
+                c->connecting = false;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                handle_read(w, c, buf.data(), buf.size());
+            }
+            else if (events[i].events & EPOLLOUT)
+            {
+                if (!flush_out(w, c))
+                {
+                    reset_conn(w, c);
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < w->conns.size(); ++i)
+    {
+        if (w->conns[i].fd >= 0)
+        {
+            close(w->conns[i].fd);
+        }
+    }
+    close(w->epfd);
+    return NULL;
+}
+
+//进程累计的CPU时间(纳秒)，读取失败时返回0
+static uint64_t process_cpu_ns(int pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+    {
+        return 0;
+    }
+    char line[1024];
+    size_t n = fread(line, 1, sizeof(line) - 1, fp);
+    fclose(fp);
+    line[n] = '\0';
+    //进程名可能包含空格，从最后一个')'之后开始数：utime和stime是第14、15个字段
+    char *p = strrchr(line, ')');
+    if (!p)
+    {
+        return 0;
+    }
+    unsigned long long utime = 0, stime = 0;
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2)
+    {
+        return 0;
+    }
+    return (utime + stime) * (1000000000ull / sysconf(_SC_CLK_TCK));
+}
+
+static uint64_t self_cpu_ns()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ull +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ull;
+}
+
+//解析带k/m后缀的大小
+static size_t parse_size(const char *s)
+{
+    char *end;
+    size_t n = strtoull(s, &end, 10);
+    if (*end == 'k' || *end == 'K')
+    {
+        n *= 1024;
+    }
+    else if (*end == 'm' || *end == 'M')
+    {
+        n *= 1024 * 1024;
+    }
+    return n;
+}
+
+//在doc_root下生成指定大小的文件，返回它的URL，失败时返回空串
+static std::string make_file(const std::string &doc_root, size_t size)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/loadgen_%zu.bin", size);
+    std::string path = doc_root + name;
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        perror(path.c_str());
+        return "";
+    }
+    std::string block(64 * 1024, 'a');
+    size_t left = size;
+    while (left > 0)
+    {
+        size_t n = left < block.size() ? left : block.size();
+        if (write(fd, block.data(), n) != (ssize_t)n)
+        {
+            perror(path.c_str());
+            close(fd);
+            return "";
+        }
+        left -= n;
+    }
+    close(fd);
+    return name;
+}
+
+static void usage(const char *prog)
+{
+    printf("usage: %s [-t threads] [-c connections] [-d seconds] [-W warmup_seconds] "
+           "[-m keepalive|pipeline|churn] [-p depth] [-u url]... [-g doc_root -s size]... "
+           "[-H host] [-e accept_encoding] [-P server_pid] port\n",
+           prog);
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = 2;
+    int connections = 64;
+    double duration = 10;
+    double warmup = 1;
+    const char *host = "127.0.0.1";
+    const char *accept_encoding = NULL;
+    int server_pid = 0;
+    std::string doc_root;
+    std::vector<std::string> urls;
+    std::vector<size_t> sizes;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:c:d:W:m:p:u:g:s:H:e:P:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'c':
+            connections = atoi(optarg);
+            break;
+        case 'd':
+            duration = atof(optarg);
+            break;
+        case 'W':
+            warmup = atof(optarg);
+            break;
+        case 'm':
+            if (strcmp(optarg, "pipeline") == 0)
+            {
+                g_mode = PIPELINE;
+            }
+            else if (strcmp(optarg, "churn") == 0)
+            {
+                g_mode = CHURN;
+            }
+            else
+            {
+                g_mode = KEEPALIVE;
+            }
+            break;
+        case 'p':
+            g_depth = atoi(optarg);
+            break;
+        case 'u':
+            urls.push_back(optarg);
+            break;
+        case 'g':
+            doc_root = optarg;
+            break;
+        case 's':
+            sizes.push_back(parse_size(optarg));
+            break;
+        case 'H':
+            host = optarg;
+            break;
+        case 'e':
+            accept_encoding = optarg;
+            break;
+        case 'P':
+            server_pid = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc || threads <= 0 || connections <= 0 || duration <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!sizes.empty() && doc_root.empty())
+    {
+        printf("-s requires -g doc_root\n");
+        return 1;
+    }
+    if (g_depth < 1 || g_depth > MAX_DEPTH)
+    {
+        g_depth = g_depth < 1 ? 1 : MAX_DEPTH;
+    }
+    if (threads > connections)
+    {
+        threads = connections;
+    }
+
+    memset(&g_addr, 0, sizeof(g_addr));
+    g_addr.sin_family = AF_INET;
+    g_addr.sin_port = htons(atoi(argv[optind]));
+    if (inet_pton(AF_INET, host, &g_addr.sin_addr) != 1)
+    {
+        printf("bad host %s\n", host);
+        return 1;
+    }
+
+    for (size_t i = 0; i < sizes.size(); ++i)
+    {
+        std::string url = make_file(doc_root, sizes[i]);
+        if (url.empty())
+        {
+            return 1;
+        }
+        urls.push_back(url);
+    }
+    if (urls.empty())
+    {
+        urls.push_back("/index.html");
+    }
+    for (size_t i = 0; i < urls.size(); ++i)
+    {
+        std::string req = "GET " + urls[i] + " HTTP/1.1\r\nHost: " + host + "\r\nConnection: " +
+                          (g_mode == CHURN ? "close" : "keep-alive") + "\r\n";
+        if (accept_encoding)
+        {
+            req += std::string("Accept-Encoding: ") + accept_encoding + "\r\n";
+        }
+        g_requests.push_back(req + "\r\n");
+    }
+
+    std::vector<worker> workers(threads);
+    for (int i = 0; i < threads; ++i)
+    {
+        workers[i].conn_number = connections / threads + (i < connections % threads ? 1 : 0);
+        workers[i].done = 0;
+        workers[i].errors = 0;
+        workers[i].non_2xx = 0;
+        workers[i].bytes = 0;
+        workers[i].latency.reserve(1 << 20);
+        pthread_create(&workers[i].tid, NULL, worker_loop, &workers[i]);
+    }
+
+    usleep((useconds_t)(warmup * 1e6));
+    uint64_t start = now_ns();
+    uint64_t server_cpu = server_pid ? process_cpu_ns(server_pid) : 0;
+    uint64_t self_cpu = self_cpu_ns();
+    g_start_ns.store(start, std::memory_order_relaxed);
+    g_recording.store(true, std::memory_order_release);
+
+    usleep((useconds_t)(duration * 1e6));
+    g_stop = true;
+    uint64_t elapsed = now_ns() - start;
+    server_cpu = server_pid ? process_cpu_ns(server_pid) - server_cpu : 0;
+    self_cpu = self_cpu_ns() - self_cpu;
+
+    long done = 0, errors = 0, non_2xx = 0;
+    uint64_t bytes = 0;
+    std::vector<uint64_t> latency;
+    for (int i = 0; i < threads; ++i)
+    {
+        pthread_join(workers[i].tid, NULL);
+        done += workers[i].done;
+        errors += workers[i].errors;
+        non_2xx += workers[i].non_2xx;
+        bytes += workers[i].bytes;
+        latency.insert(latency.end(), workers[i].latency.begin(), workers[i].latency.end());
+    }
+    //字节数包括在统计区间内收到的不完整应答，只作参考
+
+    printf("mode %s  threads %d  connections %d", MODE_NAME[g_mode], threads, connections);
+    if (g_mode == PIPELINE)
+    {
+        printf("  depth %d", g_depth);
+    }
+    printf("  urls");
+    for (size_t i = 0; i < urls.size(); ++i)
+    {
+        printf(" %s", urls[i].c_str());
+    }
+    printf("\n");
+    printf("  requests %ld in %.2fs  errors %ld  non-2xx %ld\n", done, elapsed / 1e9, errors, non_2xx);
+    if (done == 0)
+    {
+        return 1;
+    }
+    std::sort(latency.begin(), latency.end());
+    size_t n = latency.size();
+    printf("  %.0f req/s  %.1f MB/s\n", done * 1e9 / elapsed, bytes * 1e3 / elapsed);
+    printf("  latency  p50 %.1f us  p99 %.1f us  p99.9 %.1f us  max %.1f us\n", latency[n / 2] / 1e3,
+           latency[n * 99 / 100] / 1e3, latency[n * 999 / 1000] / 1e3, latency[n - 1] / 1e3);
+    printf("  cpu/request  loadgen %.2f us", self_cpu / 1e3 / done);
+    if (server_pid)
+    {
+        printf("  server %.2f us", server_cpu / 1e3 / done);
+    }
+    printf("\n");
+    return errors > 0 ? 2 : 0;
+}
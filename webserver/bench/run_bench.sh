@@ -0,0 +1,80 @@
+#!/bin/sh
+# 由make bench调用：先跑微基准测试，再对每种I/O后端在回环地址上启动server，用loadgen按
+# keepalive、pipeline和churn三种模式对每种文件大小各压测一轮，最后用bench_accept测连接风暴
+# 用法: run_bench.sh build_dir source_dir
+# 环境变量: PORT DURATION THREADS CONNECTIONS SIZES(空格分隔，可带k/m后缀) BACKENDS(epoll和/或io_uring)
+set -e
+
+BIN=${1:?build dir}
+SRC=${2:?source dir}
+PORT=${PORT:-9006}
+DURATION=${DURATION:-5}
+THREADS=${THREADS:-2}
+CONNECTIONS=${CONNECTIONS:-64}
+SIZES=${SIZES:-"1k 64k 1m"}
+BACKENDS=${BACKENDS:-"epoll io_uring"}
+
+WORK=$(mktemp -d /tmp/webserver_bench.XXXXXX)
+SERVER_PID=
+cleanup() {
+    if [ -n "$SERVER_PID" ]; then
+        kill -TERM "$SERVER_PID" 2>/dev/null || true
+        wait "$SERVER_PID" 2>/dev/null || true
+    fi
+    rm -rf "$WORK"
+}
+trap cleanup EXIT INT TERM
+
+echo "== Buffer"
+"$BIN/bench_buffer"
+echo "== timer"
+"$BIN/bench_timer"
+echo "== threadpool"
+"$BIN/bench_threadpool"
+echo "== request parser"
+"$BIN/bench_parser"
+echo "== response headers"
+"$BIN/bench_response"
+echo "== log"
+"$BIN/bench_log" 20000 "$WORK/log"
+
+mkdir -p "$WORK/root"
+cp "$SRC/resources/index.html" "$WORK/root/"
+
+for backend in $BACKENDS; do
+    case $backend in
+        epoll) OPTS= ;;
+        io_uring) OPTS=-U ;;
+        *) echo "unknown backend $backend"; exit 1 ;;
+    esac
+    # server把日志写到工作目录下的./log
+    (cd "$WORK" && exec "$BIN/server" -d "$WORK/root" $OPTS "$PORT" > "$WORK/server.out" 2>&1) &
+    SERVER_PID=$!
+    i=0
+    while ! "$BIN/loadgen" -c 1 -t 1 -d 0.05 -W 0 "$PORT" > /dev/null 2>&1; do
+        i=$((i + 1))
+        if [ $i -ge 50 ]; then
+            echo "server did not start:"
+            cat "$WORK/server.out"
+            exit 1
+        fi
+        sleep 0.1
+    done
+    # 内核不支持io_uring时server退回epoll并打印提示
+    cat "$WORK/server.out"
+
+    for size in $SIZES; do
+        for mode in keepalive pipeline churn; do
+            echo "== $backend loadgen $mode $size"
+            "$BIN/loadgen" -m "$mode" -t "$THREADS" -c "$CONNECTIONS" -d "$DURATION" \
+                -g "$WORK/root" -s "$size" -P "$SERVER_PID" "$PORT" || true
+        done
+    done
+
+    echo "== $backend connection storm"
+    "$BIN/bench_accept" -n 1000 -r 3 "$PORT" || true
+
+    kill -TERM "$SERVER_PID"
+    wait "$SERVER_PID" || true
+    SERVER_PID=
+done
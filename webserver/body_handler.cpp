@@ -0,0 +1,221 @@
+#include "body_handler.h"
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "http_conn.h"
+
+int spool_handler::m_dirfd = -1;
+
+//文件系统错误对应的应答状态码
+static int error_status(int err)
+{
+    switch (err)
+    {
+    case ENOENT:
+    case ENOTDIR:
+        return 404;
+    case EACCES:
+    case EPERM:
+    case EROFS:
+    case ELOOP:
+        return 403;
+    case EEXIST:
+    case EISDIR:
+    case ENOTEMPTY:
+        return 409;
+    default:
+        return 500;
+    }
+}
+
+//把URL转换成相对于上传目录的路径：去掉查询串，拒绝空的、"."和".."路径段以及以'/'结尾的URL
+static bool upload_path(const char *url, std::string &path)
+{
+    path.clear();
+    if (url[0] != '/')
+    {
+        return false;
+    }
+    const char *p = url + 1;
+    while (true)
+    {
+        const char *end = p;
+        while (*end && *end != '/' && *end != '?')
+        {
+            ++end;
+        }
+        size_t len = end - p;
+        if (len == 0 || (len == 1 && p[0] == '.') || (len == 2 && p[0] == '.' && p[1] == '.'))
+        {
+            return false;
+        }
+        path.append(p, len);
+        if (*end != '/')
+        {
+            break;
+        }
+        path += '/';
+        p = end + 1;
+    }
+    return path.size() < (size_t)http_conn::FILENAME_LEN;
+}
+
+//从上传目录逐级打开path所在的目录，每一级都不跟随符号链接，目录中的符号链接不能把文件引到上传目录之外；
+//返回目录的描述符，name是path的最后一段
+static int open_parent(int dirfd, const std::string &path, std::string &name)
+{
+    int fd = openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    size_t start = 0;
+    size_t slash;
+    while (fd >= 0 && (slash = path.find('/', start)) != std::string::npos)
+    {
+        std::string dir = path.substr(start, slash - start);
+        int next = openat(fd, dir.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        struct stat st;
+        if (next < 0 && errno == ENOTDIR && fstatat(fd, dir.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISLNK(st.st_mode))
+        {
+            //O_DIRECTORY先于O_NOFOLLOW检查，符号链接也报ENOTDIR，按拒绝访问处理
+            errno = ELOOP;
+        }
+        int err = errno;
+        close(fd);
+        errno = err;
+        fd = next;
+        start = slash + 1;
+    }
+    name = path.substr(start);
+    return fd;
+}
+
+spool_handler::spool_handler() : m_fd(-1), m_parentfd(-1), m_method(0)
+{
+}
+
+spool_handler::~spool_handler()
+{
+    abort();
+}
+
+bool spool_handler::init(const char *dir)
+{
+    m_dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    return m_dirfd >= 0;
+}
+
+body_handler *spool_handler::create()
+{
+    return new spool_handler;
+}
+
+int spool_handler::begin(int method, const char *url, int64_t length)
+{
+    abort();
+    if (method != http_conn::POST && method != http_conn::PUT)
+    {
+        return 405;
+    }
+    std::string path;
+    if (!upload_path(url, path))
+    {
+        return 403;
+    }
+    m_parentfd = open_parent(m_dirfd, path, m_name);
+    if (m_parentfd < 0)
+    {
+        return error_status(errno);
+    }
+    //临时文件建在目标文件所在的目录中，收完后才能在同一个文件系统中链接过去
+    m_fd = openat(m_parentfd, ".", O_TMPFILE | O_WRONLY | O_CLOEXEC, 0644);
+    if (m_fd < 0)
+    {
+        int err = errno;
+        abort();
+        return error_status(err);
+    }
+    m_method = method;
+    if (length > 0)
+    {
+        //预先分配空间，边收边写时文件不会碎成很多段
+        fallocate(m_fd, FALLOC_FL_KEEP_SIZE, 0, length);
+    }
+    return 0;
+}
+
+bool spool_handler::write(const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = ::write(m_fd, data, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+int spool_handler::finish()
+{
+    char proc[32];
+    snprintf(proc, sizeof(proc), "/proc/self/fd/%d", m_fd);
+    int status;
+    if (m_method == http_conn::PUT)
+    {
+        //先链接到同目录下的临时名字，再用rename原子地替换目标文件；
+        //临时名字的长度固定，不随目标文件名变长，目标名字合法时临时名字也不会超过NAME_MAX
+        static std::atomic<unsigned> seq(0);
+        char tmp[48];
+        snprintf(tmp, sizeof(tmp), ".upload-%d-%u", m_fd, seq.fetch_add(1, std::memory_order_relaxed));
+        bool exists = faccessat(m_parentfd, m_name.c_str(), F_OK, AT_SYMLINK_NOFOLLOW) == 0;
+        int ret = linkat(AT_FDCWD, proc, m_parentfd, tmp, AT_SYMLINK_FOLLOW);
+        if (ret < 0 && errno == EEXIST)
+        {
+            //本进程不会重复使用临时名字，已经存在的是之前的进程异常退出时留下的，删掉后重试
+            unlinkat(m_parentfd, tmp, 0);
+            ret = linkat(AT_FDCWD, proc, m_parentfd, tmp, AT_SYMLINK_FOLLOW);
+        }
+        if (ret < 0)
+        {
+            status = error_status(errno);
+        }
+        else if (renameat(m_parentfd, tmp, m_parentfd, m_name.c_str()) < 0)
+        {
+            status = error_status(errno);
+            unlinkat(m_parentfd, tmp, 0);
+        }
+        else
+        {
+            status = exists ? 204 : 201;
+        }
+    }
+    else
+    {
+        //linkat不会覆盖已经存在的文件
+        status = linkat(AT_FDCWD, proc, m_parentfd, m_name.c_str(), AT_SYMLINK_FOLLOW) < 0 ? error_status(errno) : 201;
+    }
+    abort();
+    return status;
+}
+
+void spool_handler::abort()
+{
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+    if (m_parentfd >= 0)
+    {
+        close(m_parentfd);
+        m_parentfd = -1;
+    }
+}
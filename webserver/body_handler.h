@@ -0,0 +1,62 @@
+#ifndef BODY_HANDLER_H
+#define BODY_HANDLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+//请求体的接收者：http_conn边收边把请求体分段交给它，不在内存中保留整个请求体
+//每个连接有自己的实例，同一时刻只处理一个请求，begin之后以finish或abort结束
+class body_handler
+{
+public:
+    virtual ~body_handler() {}
+
+    //请求头收完时调用，method是http_conn::METHOD，length是Content-Length，分块传输时为-1；
+    //返回0表示接收请求体，否则是拒绝请求的应答状态码
+    virtual int begin(int method, const char *url, int64_t length) = 0;
+
+    //收到一段请求体，返回false表示处理失败，请求以500结束
+    virtual bool write(const char *data, size_t len) = 0;
+
+    //请求体收完，返回应答的状态码
+    virtual int finish() = 0;
+
+    //请求没有收完就结束(连接关闭或者请求体格式错误)，丢弃已经收到的部分；没有进行中的请求时什么也不做
+    virtual void abort() = 0;
+};
+
+//把请求体写到上传目录中的匿名临时文件(O_TMPFILE)，收完后才链接到目标路径，
+//所以客户端和其它请求都看不到写了一半的文件；中途断开时临时文件随描述符关闭而消失
+//PUT创建或替换上传目录中URL对应的文件，应答201或204；POST只创建新文件，文件已经存在时应答409
+class spool_handler : public body_handler
+{
+public:
+    spool_handler();
+    ~spool_handler();
+
+    //设置上传目录，必须在处理请求之前调用，目录无法打开时返回false
+    static bool init(const char *dir);
+
+    //http_conn::m_new_body_handler使用的工厂函数
+    static body_handler *create();
+
+    int begin(int method, const char *url, int64_t length);
+    bool write(const char *data, size_t len);
+    int finish();
+    void abort();
+
+private:
+    //上传目录的描述符，URL按相对于它的路径解析
+    static int m_dirfd;
+
+    //正在写入的临时文件，没有进行中的请求时为-1
+    int m_fd;
+    //目标文件所在的目录，临时文件的链接和改名都相对于它进行
+    int m_parentfd;
+    int m_method;
+    //目标文件在所在目录中的名字
+    std::string m_name;
+};
+
+#endif
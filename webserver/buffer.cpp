@@ -1,12 +1,17 @@
 #include "buffer.h"
 
-Buffer::Buffer(int initBuffSize) : buffer_(initBuffSize), readPos_(0), writePos_(0) {}
+Buffer::Buffer(size_t initBuffSize, size_t maxSize)
+    : buffer_(NULL), capacity_(0), initSize_(initBuffSize), maxSize_(maxSize), readPos_(0), writePos_(0) {}
+
+Buffer::~Buffer() {
+    Release();
+}
 
 size_t Buffer::ReadableBytes() const {
     return writePos_ - readPos_;
 }
 size_t Buffer::WritableBytes() const {
-    return buffer_.size() - writePos_;
+    return capacity_ - writePos_;
 }
 
 size_t Buffer::PrependableBytes() const {
@@ -17,9 +22,18 @@ const char* Buffer::Peek() const {
     return BeginPtr_() + readPos_;
 }
 
+char* Buffer::Peek() {
+    return BeginPtr_() + readPos_;
+}
+
 void Buffer::Retrieve(size_t len) {
     assert(len <= ReadableBytes());
     readPos_ += len;
+    if(readPos_ == writePos_) {
+        //数据取完后从头开始写，避免无谓的搬移
+        readPos_ = 0;
+        writePos_ = 0;
+    }
 }
 
 void Buffer::RetrieveUntil(const char* end) {
@@ -28,11 +42,17 @@ void Buffer::RetrieveUntil(const char* end) {
 }
 
 void Buffer::RetrieveAll() {
-    bzero(&buffer_[0], buffer_.size());
     readPos_ = 0;
     writePos_ = 0;
 }
 
+void Buffer::Erase(size_t pos, size_t len) {
+    assert(pos + len <= ReadableBytes());
+    char* p = Peek() + pos;
+    memmove(p, p + len, ReadableBytes() - pos - len);
+    writePos_ -= len;
+}
+
 std::string Buffer::RetrieveAllToStr() {
     std::string str(Peek(), ReadableBytes());
     RetrieveAll();
@@ -48,47 +68,60 @@ char* Buffer::BeginWrite() {
 }
 
 void Buffer::HasWritten(size_t len) {
+    assert(len <= WritableBytes());
     writePos_ += len;
-} 
+}
 
-void Buffer::Append(const std::string& str) {
-    Append(str.data(), str.length());
+bool Buffer::Append(const std::string& str) {
+    return Append(str.data(), str.length());
 }
 
-void Buffer::Append(const void* data, size_t len) {
+bool Buffer::Append(const void* data, size_t len) {
     assert(data);
-    Append(static_cast<const char*>(data), len);
+    return Append(static_cast<const char*>(data), len);
 }
 
-void Buffer::Append(const char* str, size_t len) {
+bool Buffer::Append(const char* str, size_t len) {
     assert(str);
-    EnsureWriteable(len);
-    std::copy(str, str + len, BeginWrite());
+    if(!EnsureWriteable(len)) {
+        return false;
+    }
+    memcpy(BeginWrite(), str, len);
     HasWritten(len);
+    return true;
 }
 
-void Buffer::Append(const Buffer& buff) {
-    Append(buff.Peek(), buff.ReadableBytes());
+bool Buffer::Append(const Buffer& buff) {
+    return Append(buff.Peek(), buff.ReadableBytes());
 }
 
-void Buffer::EnsureWriteable(size_t len) {
+bool Buffer::EnsureWriteable(size_t len) {
     if(WritableBytes() < len) {
-        MakeSpace_(len);
+        return MakeSpace_(len);
     }
-    assert(WritableBytes() >= len);
+    return true;
 }
 
 ssize_t Buffer::ReadFd(int fd, int* saveErrno) {
     char buff[65535];
     struct iovec iov[2];
+    EnsureWriteable(1);
     const size_t writable = WritableBytes();
-    /* 分散读， 保证数据全部读完 */
-    iov[0].iov_base = BeginPtr_() + writePos_;
+    /* 分散读， 保证数据全部读完；有上限时多读的部分不超过上限 */
+    size_t extra = sizeof(buff);
+    if(maxSize_) {
+        size_t used = ReadableBytes() + writable;
+        size_t room = maxSize_ > used ? maxSize_ - used : 0;
+        if(room < extra) {
+            extra = room;
+        }
+    }
+    iov[0].iov_base = BeginWrite();
     iov[0].iov_len = writable;
     iov[1].iov_base = buff;
-    iov[1].iov_len = sizeof(buff);
+    iov[1].iov_len = extra;
 
-    const ssize_t len = readv(fd, iov, 2);
+    const ssize_t len = readv(fd, iov, extra ? 2 : 1);
     if(len < 0) {
         *saveErrno = errno;
     }
@@ -96,7 +129,7 @@ ssize_t Buffer::ReadFd(int fd, int* saveErrno) {
         writePos_ += len;
     }
     else {
-        writePos_ = buffer_.size();
+        writePos_ = capacity_;
         Append(buff, len - writable);
     }
     return len;
@@ -108,28 +141,76 @@ ssize_t Buffer::WriteFd(int fd, int* saveErrno) {
     if(len < 0) {
         *saveErrno = errno;
         return len;
-    } 
-    readPos_ += len;
+    }
+    Retrieve(len);
     return len;
 }
 
+void Buffer::Release() {
+    buffer_pool::get_instance()->deallocate(buffer_, capacity_);
+    buffer_ = NULL;
+    capacity_ = 0;
+    readPos_ = 0;
+    writePos_ = 0;
+}
+
+size_t Buffer::Capacity() const {
+    return capacity_;
+}
+
+size_t Buffer::MaxSize() const {
+    return maxSize_;
+}
+
+void Buffer::SetInitSize(size_t initSize) {
+    initSize_ = initSize;
+}
+
+void Buffer::SetMaxSize(size_t maxSize) {
+    maxSize_ = maxSize;
+}
+
 char* Buffer::BeginPtr_() {
-    return &*buffer_.begin();
+    return buffer_;
 }
 
 const char* Buffer::BeginPtr_() const {
-    return &*buffer_.begin();
+    return buffer_;
 }
 
-void Buffer::MakeSpace_(size_t len) {
-    if(WritableBytes() + PrependableBytes() < len) {
-        buffer_.resize(writePos_ + len + 1);
-    } 
-    else {
-        size_t readable = ReadableBytes();
-        std::copy(BeginPtr_() + readPos_, BeginPtr_() + writePos_, BeginPtr_());
+bool Buffer::MakeSpace_(size_t len) {
+    size_t readable = ReadableBytes();
+    if(WritableBytes() + PrependableBytes() >= len) {
+        //把未读的数据搬到开头就足够
+        memmove(BeginPtr_(), Peek(), readable);
         readPos_ = 0;
-        writePos_ = readPos_ + readable;
-        assert(readable == ReadableBytes());
+        writePos_ = readable;
+        return true;
+    }
+    //按倍数增长，存储大小取缓冲区池中对应级别的大小
+    size_t need = readable + len;
+    if(maxSize_ && need > maxSize_) {
+        return false;
+    }
+    size_t size = capacity_ ? capacity_ * 2 : initSize_;
+    if(size < need) {
+        size = need;
     }
+    if(maxSize_ && size > maxSize_) {
+        size = maxSize_;
+    }
+    size = buffer_pool::class_size(size);
+    char* buf = buffer_pool::get_instance()->allocate(size);
+    if(!buf) {
+        return false;
+    }
+    if(buffer_) {
+        memcpy(buf, Peek(), readable);
+        buffer_pool::get_instance()->deallocate(buffer_, capacity_);
+    }
+    buffer_ = buf;
+    capacity_ = size;
+    readPos_ = 0;
+    writePos_ = readable;
+    return true;
 }
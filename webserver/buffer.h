@@ -4,20 +4,27 @@
 #include <iostream>
 #include <unistd.h>  // write
 #include <sys/uio.h> //readv
-#include <vector> //readv
-#include <atomic>
 #include <assert.h>
+#include "mem_pool.h"
+
+/* 单线程使用的可增长缓冲区，存储从buffer_pool取得，第一次写入时才分配，Release后归还。
+   RetrieveAll只重置读写位置，不清零内存；maxSize不为0时缓冲区不会超过这个大小，
+   超过时EnsureWriteable/Append返回false，由调用者决定如何处理。
+   成员全为0就是没有存储的空缓冲区：默认构造函数是平凡的，不初始化成员，只用于已经清零的内存
+   (calloc/mmap得到的或者静态存储)，这样大的连接数组不必在启动时逐个写入 */
 class Buffer {
 public:
-    Buffer(int initBuffSize = 1024);
-    ~Buffer() = default;
+    Buffer() = default;
+    Buffer(size_t initBuffSize, size_t maxSize = 0);
+    ~Buffer();
 
-    size_t WritableBytes() const;       
+    size_t WritableBytes() const;
     size_t ReadableBytes() const ;
     size_t PrependableBytes() const;
 
     const char* Peek() const;
-    void EnsureWriteable(size_t len);
+    char* Peek();
+    bool EnsureWriteable(size_t len);
     void HasWritten(size_t len);
 
     void Retrieve(size_t len);
@@ -26,25 +33,47 @@ public:
     void RetrieveAll() ;
     std::string RetrieveAllToStr();
 
+    //删除可读数据中从第pos字节开始的len字节，后面的数据前移
+    void Erase(size_t pos, size_t len);
+
     const char* BeginWriteConst() const;
     char* BeginWrite();
 
-    void Append(const std::string& str);
-    void Append(const char* str, size_t len);
-    void Append(const void* data, size_t len);
-    void Append(const Buffer& buff);
+    bool Append(const std::string& str);
+    bool Append(const char* str, size_t len);
+    bool Append(const void* data, size_t len);
+    bool Append(const Buffer& buff);
 
     ssize_t ReadFd(int fd, int* Errno);
     ssize_t WriteFd(int fd, int* Errno);
 
+    //清空并把存储归还给缓冲区池，之后再写入时重新分配
+    void Release();
+
+    //当前存储的大小，未分配时为0
+    size_t Capacity() const;
+
+    //第一次分配存储的大小，0表示按第一次写入的长度分配
+    void SetInitSize(size_t initSize);
+
+    //缓冲区大小的上限，0表示不限
+    size_t MaxSize() const;
+    void SetMaxSize(size_t maxSize);
+
 private:
+    Buffer(const Buffer&);
+    Buffer& operator=(const Buffer&);
+
     char* BeginPtr_();
     const char* BeginPtr_() const;
-    void MakeSpace_(size_t len);
+    bool MakeSpace_(size_t len);
 
-    std::vector<char> buffer_;
-    std::atomic<std::size_t> readPos_;
-    std::atomic<std::size_t> writePos_;
+    char* buffer_;
+    size_t capacity_;
+    size_t initSize_;
+    size_t maxSize_;
+    size_t readPos_;
+    size_t writePos_;
 };
 
 #endif
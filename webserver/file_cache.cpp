@@ -0,0 +1,486 @@
+#include "file_cache.h"
+#include "http_response.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <zlib.h>
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+cached_file::~cached_file()
+{
+    if (data)
+    {
+        munmap(data, st.st_size);
+    }
+    if (fd != -1)
+    {
+        close(fd);
+    }
+}
+
+file_cache::file_cache()
+    : m_shard_capacity(0), m_check_interval(1), m_sendfile_threshold(256 * 1024), m_variant_shard_capacity(0),
+      m_compress_level(6)
+{
+    for (int i = 0; i < SHARD_NUMBER; ++i)
+    {
+        m_shards[i].bytes = 0;
+        m_variant_shards[i].bytes = 0;
+    }
+}
+
+file_cache::~file_cache()
+{
+    for (int i = 0; i < SHARD_NUMBER; ++i)
+    {
+        shard &s = m_shards[i];
+        while (!s.map.empty())
+        {
+            erase(s, s.map.begin());
+        }
+        shard &v = m_variant_shards[i];
+        while (!v.map.empty())
+        {
+            erase(v, v.map.begin());
+        }
+    }
+}
+
+void file_cache::init(size_t capacity, int check_interval, off_t sendfile_threshold)
+{
+    m_shard_capacity = capacity / SHARD_NUMBER;
+    m_check_interval = check_interval;
+    m_sendfile_threshold = sendfile_threshold;
+}
+
+void file_cache::init_compression(size_t capacity, int level)
+{
+    m_variant_shard_capacity = capacity / SHARD_NUMBER;
+    m_compress_level = level < 1 ? 1 : (level > 9 ? 9 : level);
+}
+
+size_t file_cache::file_bytes(const cached_file *file)
+{
+    return file && file->data ? file->st.st_size : 0;
+}
+
+void file_cache::release(const cached_file *file)
+{
+    if (file && file->refs.fetch_sub(1) == 1)
+    {
+        delete file;
+    }
+}
+
+cached_file *file_cache::load(const char *path, http_parser::ENCODING encoding, int &err)
+{
+    struct stat st;
+    if (stat(path, &st) < 0)
+    {
+        err = errno;
+        return NULL;
+    }
+    if (!(st.st_mode & S_IROTH))
+    {
+        err = EACCES;
+        return NULL;
+    }
+    if (S_ISDIR(st.st_mode))
+    {
+        err = EISDIR;
+        return NULL;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        err = errno;
+        return NULL;
+    }
+
+    cached_file *file = new cached_file;
+    file->st = st;
+    file->checked = time(NULL);
+    if (m_sendfile_threshold > 0 && st.st_size >= m_sendfile_threshold)
+    {
+        //大文件保持打开，由sendfile从页缓存发送
+        file->fd = fd;
+    }
+    else
+    {
+        //小文件整体映射并预先读入，之后的请求不再缺页
+        if (st.st_size > 0)
+        {
+            void *addr = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+            if (addr == MAP_FAILED)
+            {
+                err = errno;
+                close(fd);
+                delete file;
+                return NULL;
+            }
+            file->data = (char *)addr;
+        }
+        close(fd);
+    }
+
+    file->encoding = encoding;
+    file->mime = &mime_types::lookup(path);
+    file->compressible = encoding == http_parser::ENCODING_IDENTITY && m_variant_shard_capacity > 0 &&
+                         file->mime->compressible && st.st_size >= COMPRESS_MIN_SIZE;
+    make_headers(file);
+    return file;
+}
+
+void file_cache::make_headers(cached_file *file)
+{
+    char num[http_response::UINT_LEN];
+    file->headers = "Content-Length:";
+    file->headers.append(num, http_response::write_uint(num, file->st.st_size));
+    file->headers += "\r\n";
+    file->meta_pos = file->headers.size();
+    file->headers += file->mime->header;
+    if (file->encoding != http_parser::ENCODING_IDENTITY)
+    {
+        file->headers += "Content-Encoding:";
+        file->headers += http_parser::encoding_name(file->encoding);
+        file->headers += "\r\n";
+    }
+    else
+    {
+        //压缩版本不支持Range，带Range的请求总是使用原文件
+        file->headers += "Accept-Ranges:bytes\r\n";
+    }
+
+    //ETag："mtime秒-纳秒-大小"，压缩版本再加上编码名，各个版本的标签互不相同
+    char tag[96];
+    int n = snprintf(tag, sizeof(tag), "\"%lx-%lx-%lx%s%s\"", (unsigned long)file->st.st_mtim.tv_sec,
+                     (unsigned long)file->st.st_mtim.tv_nsec, (unsigned long)file->st.st_size,
+                     file->encoding != http_parser::ENCODING_IDENTITY ? "-" : "",
+                     file->encoding != http_parser::ENCODING_IDENTITY ? http_parser::encoding_name(file->encoding) : "");
+    file->etag.assign(tag, n);
+    file->validators_pos = file->headers.size();
+    file->headers += "ETag:";
+    file->headers += file->etag;
+    file->headers += "\r\nLast-Modified:";
+    char date[http_response::HTTP_DATE_LEN];
+    file->headers.append(date, http_response::write_http_date(date, file->st.st_mtim.tv_sec));
+    file->headers += "\r\n";
+    if (file->compressible || file->encoding != http_parser::ENCODING_IDENTITY)
+    {
+        //原文件和压缩版本的应答都要告诉中间缓存按Accept-Encoding区分
+        file->headers += "Vary:Accept-Encoding\r\n";
+    }
+}
+
+//zlib压缩，window_bits加16输出gzip格式，否则是HTTP的deflate使用的zlib格式；失败时返回0
+static size_t zlib_compress(const char *in, size_t len, char *out, size_t cap, int window_bits, int level)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        return 0;
+    }
+    zs.next_in = (Bytef *)in;
+    zs.avail_in = len;
+    zs.next_out = (Bytef *)out;
+    zs.avail_out = cap;
+    size_t n = deflate(&zs, Z_FINISH) == Z_STREAM_END ? zs.total_out : 0;
+    deflateEnd(&zs);
+    return n;
+}
+
+cached_file *file_cache::compress(const cached_file *file, http_parser::ENCODING encoding)
+{
+    const char *in = file->data;
+    size_t len = file->st.st_size;
+    //gzip的头尾比zlib格式多12字节
+    size_t cap = compressBound(len) + 18;
+    char *out = (char *)malloc(cap);
+    if (!out)
+    {
+        return NULL;
+    }
+    size_t n = 0;
+    switch (encoding)
+    {
+    case http_parser::ENCODING_GZIP:
+        n = zlib_compress(in, len, out, cap, 15 + 16, m_compress_level);
+        break;
+    case http_parser::ENCODING_DEFLATE:
+        n = zlib_compress(in, len, out, cap, 15, m_compress_level);
+        break;
+#ifdef HAVE_BROTLI
+    case http_parser::ENCODING_BR:
+    {
+        //brotli的质量0-11，和zlib的级别大致对应
+        size_t max = BrotliEncoderMaxCompressedSize(len);
+        if (max > cap)
+        {
+            free(out);
+            cap = max;
+            out = (char *)malloc(cap);
+            if (!out)
+            {
+                return NULL;
+            }
+        }
+        n = cap;
+        if (!BrotliEncoderCompress(m_compress_level, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, len,
+                                   (const uint8_t *)in, &n, (uint8_t *)out))
+        {
+            n = 0;
+        }
+        break;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    case http_parser::ENCODING_ZSTD:
+    {
+        size_t max = ZSTD_compressBound(len);
+        if (max > cap)
+        {
+            free(out);
+            cap = max;
+            out = (char *)malloc(cap);
+            if (!out)
+            {
+                return NULL;
+            }
+        }
+        n = ZSTD_compress(out, cap, in, len, m_compress_level);
+        if (ZSTD_isError(n))
+        {
+            n = 0;
+        }
+        break;
+    }
+#endif
+    default:
+        break;
+    }
+
+    //压缩后至少小1/8才值得让客户端解压
+    cached_file *variant = NULL;
+    if (n > 0 && n <= len - len / 8)
+    {
+        //结果放在匿名映射中，和原文件一样在析构时munmap
+        void *addr = mmap(NULL, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr != MAP_FAILED)
+        {
+            memcpy(addr, out, n);
+            variant = new cached_file;
+            variant->st = file->st;
+            variant->st.st_size = n;
+            variant->data = (char *)addr;
+            variant->encoding = encoding;
+            variant->mime = file->mime;
+            variant->checked = file->checked;
+            make_headers(variant);
+        }
+    }
+    free(out);
+    return variant;
+}
+
+void file_cache::erase(shard &s, std::unordered_map<std::string, entry>::iterator it)
+{
+    //压缩版本缓存中file可能为NULL，file_bytes和release都接受NULL
+    s.bytes -= file_bytes(it->second.file);
+    s.lru.erase(it->second.lru);
+    release(it->second.file);
+    s.map.erase(it);
+}
+
+const cached_file *file_cache::acquire(const char *path, int &err)
+{
+    if (m_shard_capacity == 0)
+    {
+        return load(path, http_parser::ENCODING_IDENTITY, err);
+    }
+
+    std::string key(path);
+    shard &s = m_shards[std::hash<std::string>()(key) % SHARD_NUMBER];
+    time_t now = time(NULL);
+
+    s.lock.lock();
+    std::unordered_map<std::string, entry>::iterator it = s.map.find(key);
+    if (it != s.map.end())
+    {
+        cached_file *file = it->second.file;
+        bool valid = true;
+        if (now - file->checked >= m_check_interval)
+        {
+            //超过检查间隔，确认文件没有被修改或删除
+            struct stat st;
+            valid = stat(path, &st) == 0 && st.st_ino == file->st.st_ino &&
+                    st.st_size == file->st.st_size &&
+                    st.st_mtim.tv_sec == file->st.st_mtim.tv_sec &&
+                    st.st_mtim.tv_nsec == file->st.st_mtim.tv_nsec &&
+                    st.st_mode == file->st.st_mode;
+            file->checked = now;
+        }
+        if (valid)
+        {
+            s.lru.splice(s.lru.begin(), s.lru, it->second.lru);
+            file->refs.fetch_add(1);
+            s.lock.unlock();
+            return file;
+        }
+        erase(s, it);
+    }
+    s.lock.unlock();
+
+    cached_file *file = load(path, http_parser::ENCODING_IDENTITY, err);
+    if (!file)
+    {
+        return NULL;
+    }
+    size_t bytes = file_bytes(file);
+    if (bytes > m_shard_capacity)
+    {
+        //超过单个分片容量的文件不缓存，用完即释放
+        return file;
+    }
+
+    s.lock.lock();
+    it = s.map.find(key);
+    if (it != s.map.end())
+    {
+        //其他线程已经加载了同一个文件
+        erase(s, it);
+    }
+    while (!s.lru.empty() && (s.bytes + bytes > m_shard_capacity || s.map.size() >= MAX_ENTRIES_PER_SHARD))
+    {
+        erase(s, s.map.find(s.lru.back()));
+    }
+    s.lru.push_front(key);
+    entry e;
+    e.file = file;
+    e.lru = s.lru.begin();
+    s.map[key] = e;
+    s.bytes += bytes;
+    //缓存持有一个引用，调用者持有一个引用
+    file->refs.fetch_add(1);
+    s.lock.unlock();
+    return file;
+}
+
+const cached_file *file_cache::acquire_encoded(const char *path, const cached_file *file, unsigned accepted)
+{
+    if (m_variant_shard_capacity == 0 || !file->compressible)
+    {
+        return NULL;
+    }
+    for (int i = http_parser::ENCODING_IDENTITY + 1; i < http_parser::ENCODING_NUMBER; ++i)
+    {
+        if (accepted & (1u << i))
+        {
+            const cached_file *variant = acquire_variant(path, file, (http_parser::ENCODING)i);
+            if (variant)
+            {
+                return variant;
+            }
+        }
+    }
+    return NULL;
+}
+
+const cached_file *file_cache::acquire_variant(const char *path, const cached_file *file,
+                                               http_parser::ENCODING encoding)
+{
+    //键也是预压缩文件的路径；deflate没有通行的预压缩文件名，只在内存中压缩
+    static const char *const suffix[http_parser::ENCODING_NUMBER] = {"", ".br", ".zst", ".gz", ".zz"};
+    std::string key(path);
+    key += suffix[encoding];
+    shard &s = m_variant_shards[std::hash<std::string>()(key) % SHARD_NUMBER];
+
+    s.lock.lock();
+    std::unordered_map<std::string, entry>::iterator it = s.map.find(key);
+    if (it != s.map.end())
+    {
+        entry &e = it->second;
+        if (e.ino == file->st.st_ino && e.size == file->st.st_size && e.mtime.tv_sec == file->st.st_mtim.tv_sec &&
+            e.mtime.tv_nsec == file->st.st_mtim.tv_nsec)
+        {
+            s.lru.splice(s.lru.begin(), s.lru, e.lru);
+            cached_file *variant = e.file;
+            if (variant)
+            {
+                variant->refs.fetch_add(1);
+            }
+            s.lock.unlock();
+            return variant;
+        }
+        //原文件已经变化
+        erase(s, it);
+    }
+    s.lock.unlock();
+
+    cached_file *variant = NULL;
+    if (encoding != http_parser::ENCODING_DEFLATE)
+    {
+        int err = 0;
+        variant = load(key.c_str(), encoding, err);
+        if (variant && (variant->st.st_mtim.tv_sec < file->st.st_mtim.tv_sec ||
+                        (variant->st.st_mtim.tv_sec == file->st.st_mtim.tv_sec &&
+                         variant->st.st_mtim.tv_nsec < file->st.st_mtim.tv_nsec)))
+        {
+            //预压缩文件比原文件旧，已经过期
+            release(variant);
+            variant = NULL;
+        }
+        else if (variant)
+        {
+            //预压缩文件的Content-Type和原文件相同
+            variant->mime = file->mime;
+            make_headers(variant);
+        }
+    }
+    if (!variant && file->data && (size_t)file->st.st_size <= m_variant_shard_capacity)
+    {
+        variant = compress(file, encoding);
+    }
+    size_t bytes = file_bytes(variant);
+    if (bytes > m_variant_shard_capacity)
+    {
+        return variant;
+    }
+
+    s.lock.lock();
+    it = s.map.find(key);
+    if (it != s.map.end())
+    {
+        erase(s, it);
+    }
+    while (!s.lru.empty() &&
+           (s.bytes + bytes > m_variant_shard_capacity || s.map.size() >= MAX_ENTRIES_PER_SHARD))
+    {
+        erase(s, s.map.find(s.lru.back()));
+    }
+    s.lru.push_front(key);
+    entry e;
+    e.file = variant;
+    e.lru = s.lru.begin();
+    e.ino = file->st.st_ino;
+    e.size = file->st.st_size;
+    e.mtime = file->st.st_mtim;
+    s.map[key] = e;
+    s.bytes += bytes;
+    //没有可用的压缩版本也记录下来，之后的请求不再查找预压缩文件和尝试压缩
+    if (variant)
+    {
+        variant->refs.fetch_add(1);
+    }
+    s.lock.unlock();
+    return variant;
+}
@@ -0,0 +1,151 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <atomic>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include "locker.h"
+#include "http_parser.h"
+#include "mime_types.h"
+
+//缓存的静态文件：stat结果、文件内容(小文件固定映射在内存中，大文件保持打开用sendfile发送)
+//以及预先生成的应答头部。用引用计数管理，被缓存淘汰后等最后一个使用者归还才真正释放
+struct cached_file
+{
+    cached_file()
+        : data(NULL), fd(-1), encoding(http_parser::ENCODING_IDENTITY), compressible(false), mime(NULL),
+          meta_pos(0), validators_pos(0), checked(0), refs(1)
+    {
+    }
+    ~cached_file();
+
+    //文件的stat结果
+    struct stat st;
+
+    //小于sendfile阈值的文件整体映射到内存中的起始位置，否则为NULL
+    char *data;
+
+    //不小于sendfile阈值的文件的描述符，多个连接以各自的偏移量共用，否则为-1
+    int fd;
+
+    //内容编码，压缩版本的st.st_size是压缩后的大小
+    http_parser::ENCODING encoding;
+
+    //原文件是否可能有压缩版本(MIME类型值得压缩并且不太小)，这时应答带Vary:Accept-Encoding
+    bool compressible;
+
+    //按原文件扩展名查到的MIME类型，压缩版本和原文件相同
+    const mime_types::entry *mime;
+
+    //预先生成的200应答头部，依次是Content-Length、从meta_pos开始的Content-Type、Content-Encoding、Accept-Ranges，
+    //以及从validators_pos开始的ETag、Last-Modified、Vary；206和304应答只使用后面的部分
+    std::string headers;
+    size_t meta_pos;
+    size_t validators_pos;
+
+    //带引号的强实体标签，由mtime、大小和内容编码生成
+    std::string etag;
+
+    //上次检查文件是否被修改的时间
+    time_t checked;
+
+    mutable std::atomic<int> refs;
+};
+
+//按路径缓存静态文件的分片LRU缓存，总大小(映射到内存的字节数)有上限
+//命中且未到检查间隔时不需要任何系统调用，超过检查间隔时用stat比较mtime、大小和inode决定是否重新加载
+//另有一个同样分片、容量单独计算的压缩版本缓存：优先使用同目录下预先压缩的兄弟文件(path.br、path.zst、path.gz)，
+//没有时把内存中的小文件压缩一次放入缓存，之后的请求直接发送压缩结果
+class file_cache
+{
+public:
+    static file_cache *get_instance()
+    {
+        static file_cache instance;
+        return &instance;
+    }
+
+    /*capacity是缓存的总字节数，为0时不缓存；check_interval是检查文件是否被修改的间隔(秒)；
+      sendfile_threshold是使用sendfile发送的文件大小下限，为0时所有文件都映射到内存*/
+    void init(size_t capacity, int check_interval, off_t sendfile_threshold);
+
+    //取得path对应的文件并增加引用计数，用完后必须调用release
+    //失败时返回NULL，err为ENOENT(不存在)、EACCES(不可读)、EISDIR(是目录)或其他errno
+    const cached_file *acquire(const char *path, int &err);
+
+    /*开启压缩：capacity是压缩版本缓存的总字节数，为0时不压缩也不使用预压缩文件；
+      level是zlib的压缩级别(1-9)，brotli和zstd使用相近的级别*/
+    void init_compression(size_t capacity, int level);
+
+    //按accepted(Accept-Encoding解析出的编码集合)取得file的压缩版本并增加引用计数，path是file的路径
+    //依次尝试客户端接受的编码，都没有可用的压缩版本(压缩后没有变小、文件太大等)时返回NULL，这时发送原文件
+    //压缩版本随原文件的inode、大小和mtime失效，预压缩文件应和原文件一起更新
+    const cached_file *acquire_encoded(const char *path, const cached_file *file, unsigned accepted);
+
+    //归还acquire得到的文件
+    static void release(const cached_file *file);
+
+    off_t sendfile_threshold() const { return m_sendfile_threshold; }
+
+private:
+    file_cache();
+    ~file_cache();
+
+    static const int SHARD_NUMBER = 16;
+    static const size_t MAX_ENTRIES_PER_SHARD = 1024;
+    //小于这个大小的文件不压缩，省下的字节抵不上Content-Encoding和Vary头部
+    static const off_t COMPRESS_MIN_SIZE = 256;
+
+    struct entry
+    {
+        cached_file *file;
+        std::list<std::string>::iterator lru;
+        //压缩版本缓存中记录生成它的原文件，file为NULL表示该编码没有可用的压缩版本
+        ino_t ino;
+        off_t size;
+        struct timespec mtime;
+    };
+
+    struct shard
+    {
+        locker lock;
+        //最近使用的在链表头部
+        std::list<std::string> lru;
+        std::unordered_map<std::string, entry> map;
+        size_t bytes;
+    };
+
+    //加载文件，不访问缓存；encoding不是identity时path是预压缩文件
+    cached_file *load(const char *path, http_parser::ENCODING encoding, int &err);
+
+    //生成file的应答头部
+    void make_headers(cached_file *file);
+
+    //把内存中的文件压缩成encoding编码，不支持该编码、压缩失败或者没有变小时返回NULL
+    cached_file *compress(const cached_file *file, http_parser::ENCODING encoding);
+
+    //在压缩版本缓存中查找或生成file的encoding编码版本，该编码不可用时返回NULL
+    const cached_file *acquire_variant(const char *path, const cached_file *file, http_parser::ENCODING encoding);
+
+    //文件在内存中占用的字节数
+    static size_t file_bytes(const cached_file *file);
+
+    //把文件从分片中移除，调用者持有分片的锁
+    void erase(shard &s, std::unordered_map<std::string, entry>::iterator it);
+
+private:
+    shard m_shards[SHARD_NUMBER];
+    size_t m_shard_capacity;
+    int m_check_interval;
+    off_t m_sendfile_threshold;
+
+    shard m_variant_shards[SHARD_NUMBER];
+    size_t m_variant_shard_capacity;
+    int m_compress_level;
+};
+
+#endif
@@ -1,15 +1,12 @@
 #include "http_conn.h"
-//定义HTTP响应的一些状态信息
-const char* ok_200_title="OK";
-const char* error_400_title ="Bad Request";
-const char* error_400_form="Your request has bad syntax or is inherently impossible to satisfy.\n";
-const char* error_403_title="Forbidden";
-const char* error_403_form="You do not have permission to get file from this server.\n";
-const char* error_404_title="Not Found";
-const char* error_404_form="The requested file was not found on this server.\n";
-const char* error_500_title="Internal Error";
-const char* error_500_form="There was an unusual problem serving the requested file.\n";
-const char* doc_root="/home/hjx/webserver/Bashu-Tang-poetry";    //网站的根目录
+#include "http_response.h"
+#include "http_parser.h"
+#include "log.h"
+#include "metrics.h"
+#include <time.h>
+#include <ctype.h>
+#include <limits.h>
+//HTTP响应的状态行、固定头部和错误页面由http_response在启动时渲染
 
 
 
@@ -21,8 +18,8 @@ int setnonblocking( int fd ) {
     return old_option;   
 }
 
-// 向epoll中添加需要监听的文件描述符
-void addfd( int epollfd, int fd, bool one_shot ) {
+// 向epoll中添加已经是非阻塞的文件描述符，例如accept4返回的连接
+void registerfd( int epollfd, int fd, bool one_shot ) {
     epoll_event event;
     event.data.fd = fd;
     event.events = EPOLLIN | EPOLLRDHUP;
@@ -33,6 +30,11 @@ void addfd( int epollfd, int fd, bool one_shot ) {
         event.events |= EPOLLONESHOT;
     }
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+}
+
+// 向epoll中添加需要监听的文件描述符
+void addfd( int epollfd, int fd, bool one_shot ) {
+    registerfd( epollfd, fd, one_shot );
     // 设置文件描述符非阻塞
     setnonblocking(fd);  
 }
@@ -52,9 +54,35 @@ void modfd(int epollfd, int fd, int ev) {
 }
 
 // 所有的客户数
-int http_conn::m_user_count = 0;
+std::atomic<int> http_conn::m_user_count(0);
+// 读缓冲区的上限
+size_t http_conn::m_max_request_size = 32 * 1024;
+// 是否写访问日志
+bool http_conn::m_access_log = false;
+// 统计URL
+const char* http_conn::m_stats_url = "/stats";
+// 网站的根目录
+const char* http_conn::m_doc_root = "/home/hjx/webserver/Bashu-Tang-poetry";
+// 是否用不带EPOLLONESHOT的边缘触发模式
+bool http_conn::m_edge_triggered = false;
+// 连接数上限
+int http_conn::m_max_connections = 65536;
+// 长连接和慢速客户端的限制
+int http_conn::m_max_requests = 1000;
+int http_conn::m_keepalive_timeout = 15;
+int http_conn::m_header_timeout = 10;
+int http_conn::m_min_rate = 512;
+// 请求体的上限和接收者
+int64_t http_conn::m_max_body_size = 64 * 1024 * 1024;
+body_handler* (*http_conn::m_new_body_handler)() = NULL;
 
-int http_conn::m_epollfd = -1;
+static const char* const METHOD_NAME[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT"};
+
+int64_t http_conn::now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
 // 关闭连接
 void http_conn::close_conn() {
@@ -63,18 +91,59 @@ void http_conn::close_conn() {
         removefd(m_epollfd, m_sockfd);
         m_sockfd = -1;
         m_user_count--; // 关闭一个连接，将客户总数量-1
+        release_buffers();
+    }
+}
+
+// 解除文件映射，把读写缓冲区归还给缓冲区池
+void http_conn::release_buffers() {
+    if(m_body_active){
+        //请求体没有收完连接就关闭了
+        m_body->abort();
+        m_body_active=false;
     }
+    delete m_body;
+    m_body=NULL;
+    unmap();
+    m_read_buf.Release();
+    m_write_buf.Release();
+    m_access_buf.Release();
 }
 
 // 初始化连接,外部调用初始化套接字地址
-void http_conn::init(int sockfd, const sockaddr_in& addr){
+void http_conn::init(int sockfd, const sockaddr_in& addr, int epollfd, int closefd){
     m_sockfd = sockfd;
     m_address = addr;
+    m_epollfd = epollfd;
+    m_closefd = closefd;
+    m_conn_id.fetch_add(1, std::memory_order_relaxed);
+    m_sched.store(0, std::memory_order_relaxed);
+    //新连接还没有占用缓冲区和文件映射，上一个使用该下标的连接关闭时已经归还
+    m_read_buf.SetInitSize(READ_BUFFER_SIZE);
+    m_read_buf.SetMaxSize(m_max_request_size);
+    m_write_buf.SetInitSize(WRITE_BUFFER_SIZE);
+    m_access_buf.SetInitSize(ACCESS_BUFFER_SIZE);
+    m_file = NULL;
+    m_response_count = 0;
+    m_response_sent = 0;
+    m_t_accept = m_access_log ? now_ns() : 0;
+    m_t_first_read = 0;
+    m_requests = 0;
+    m_request_start = 0;
+    m_idle_since.store(0, std::memory_order_relaxed);
     
-    // 端口复用
-    int reuse = 1;
-    setsockopt( m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof( reuse ) );
-    addfd( m_epollfd, sockfd, true );
+    //连接由accept4创建时已经是非阻塞的，只需注册到epoll
+    if(m_epollfd<0){
+        //io_uring后端直接向内核提交收发请求
+    }else if(m_edge_triggered){
+        //一次注册读写两种事件，之后每个请求都不需要epoll_ctl
+        epoll_event event;
+        event.data.fd = sockfd;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+        epoll_ctl( m_epollfd, EPOLL_CTL_ADD, sockfd, &event );
+    }else{
+        registerfd( m_epollfd, sockfd, true );
+    }
     m_user_count++;
 
     init();
@@ -84,103 +153,239 @@ void http_conn::init(int sockfd, const sockaddr_in& addr){
 void http_conn::init(){
     bytes_have_send=0;
     bytes_to_send=0;
+    m_start_line=0;
+    m_checked_index=0;      //当前分析字符串首行位置初始化    
+    //读缓冲区中的请求都处理完毕，读写缓冲区归还给缓冲区池，下一个请求到来时再取
+    m_read_buf.Release();
+    m_write_buf.Release();
+    m_access_buf.Release();
+    init_request();
+    update_deadline();
+}
+
+void http_conn::init_request(){
     m_check_state=CHECK_STATE_REQUESTLINE;      //初始化状态为解析请求首行
     m_linger=false;
     m_method=GET;
     m_url=0;
     m_version=0;
     m_content_length=0;
+    m_chunked=false;
+    m_bad_coding=false;
+    m_expect_continue=false;
+    if(m_body_active){
+        //请求体出错，请求在收完之前结束
+        m_body->abort();
+        m_body_active=false;
+    }
     m_host=0;
+    m_accept_encoding=0;
+    m_if_none_match=0;
+    m_if_modified_since=-1;
+    m_range=0;
+    m_if_range=0;
+    m_range_count=0;
+    m_status=0;
+    m_t_lookup_start=0;
+    m_t_lookup_end=0;
+    //取走已经处理完的请求，流水线中的下一个请求紧跟在它之后，不需要清零或搬移
+    m_read_buf.Retrieve(m_checked_index);
     m_start_line=0;
-    m_checked_index=0;      //当前分析字符串首行位置初始化    
-    m_read_idx=0;
-    m_write_idx=0;
-    memset(m_read_buf,'\0',READ_BUFFER_SIZE);
-    memset(m_write_buf,'\0',WRITE_BUFFER_SIZE);
-    memset(m_real_file,'\0',FILENAME_LEN);
-    
+    m_checked_index=0;
+    //流水线中的下一个请求已经开始接收
+    m_recv_bytes=m_read_buf.ReadableBytes();
+    m_request_start=m_recv_bytes>0?time(NULL):0;
+}
+
+void http_conn::update_deadline(){
+    time_t now=time(NULL);
+    time_t deadline;
+    if(bytes_to_send>0){
+        //发送应答：对方接收得太慢时不再延长，到期后关闭
+        if(!rate_ok(now,m_send_start,m_send_bytes)){
+            return;
+        }
+        deadline=now+m_keepalive_timeout;
+    }else if(m_request_start){
+        if(m_check_state!=CHECK_STATE_CONTENT){
+            //请求头必须在限定时间内收完，逐字节发送请求头的客户端不能一直占住连接
+            deadline=m_request_start+m_header_timeout;
+        }else{
+            if(!rate_ok(now,m_request_start,m_recv_bytes)){
+                return;
+            }
+            deadline=now+m_keepalive_timeout;
+        }
+    }else{
+        //等待下一个请求；新连接按请求头的超时等待第一个请求
+        deadline=now+(m_requests?m_keepalive_timeout:m_header_timeout);
+    }
+    m_deadline.store(deadline,std::memory_order_relaxed);
+    time_t idle=0;
+    if(m_requests&&bytes_to_send==0&&!m_request_start){
+        idle=m_idle_since.load(std::memory_order_relaxed);
+        idle=idle?idle:now;
+    }
+    m_idle_since.store(idle,std::memory_order_relaxed);
+}
+
+bool http_conn::rate_ok(time_t now,time_t& start,int64_t& bytes){
+    time_t elapsed=now-start;
+    if(m_min_rate==0||elapsed<m_header_timeout){
+        return true;
+    }
+    if(bytes<(int64_t)m_min_rate*elapsed){
+        return false;
+    }
+    //按m_header_timeout秒一段分段计算，开始时填满socket缓冲区的数据不能一直抵消之后的慢速
+    start=now;
+    bytes=0;
+    return true;
+}
+
+time_t http_conn::idle_since() const{
+    if(busy()){
+        return 0;
+    }
+    return m_idle_since.load(std::memory_order_relaxed);
+}
+
+void http_conn::rebase(const char* old_base){
+    const char* base=m_read_buf.Peek();
+    if(!old_base||base==old_base){
+        return;
+    }
+    if(m_url){
+        m_url=m_read_buf.Peek()+(m_url-old_base);
+    }
+    if(m_version){
+        m_version=m_read_buf.Peek()+(m_version-old_base);
+    }
+    if(m_host){
+        m_host=m_read_buf.Peek()+(m_host-old_base);
+    }
+    if(m_if_none_match){
+        m_if_none_match=m_read_buf.Peek()+(m_if_none_match-old_base);
+    }
+    if(m_range){
+        m_range=m_read_buf.Peek()+(m_range-old_base);
+    }
+    if(m_if_range){
+        m_if_range=m_read_buf.Peek()+(m_if_range-old_base);
+    }
 }
 
 // 循环读取客户数据，直到无数据可读或者对方关闭连接
 bool http_conn::read() {
 
-    if(m_read_idx>=READ_BUFFER_SIZE){       //超出读缓冲区最大
+    if(m_read_buf.ReadableBytes()>=m_max_request_size){       //超出读缓冲区上限
         return false;
     }
 
-    //读到的字节
-    int bytes_read =0;
-    while(true){
-        bytes_read=recv(m_sockfd,m_read_buf+m_read_idx,READ_BUFFER_SIZE-m_read_idx,0);
+    //读缓冲区的存储可能在读取时搬移或增长
+    const char* old_base=m_read_buf.Peek();
+    size_t old_bytes=m_read_buf.ReadableBytes();
+    bool ret=true;
+    m_read_capped=false;
+    //读缓冲区达到上限时先处理已读到的请求，剩下的数据留在socket中，处理完后重新注册EPOLLIN时再读
+    while(m_read_buf.ReadableBytes()<m_max_request_size){
+        int save_errno=0;
+        ssize_t bytes_read=m_read_buf.ReadFd(m_sockfd,&save_errno);
         if(bytes_read==-1){
-            if(errno==EAGAIN||errno==EWOULDBLOCK){
+            if(save_errno==EAGAIN||save_errno==EWOULDBLOCK){
                 //没有数据
                 break;
             }
-            return false;
+            ret=false;
+            break;
         }else if(bytes_read==0){
-            return false;
+            ret=false;
+            break;
         }
-        m_read_idx+=bytes_read;
-
+        m_read_capped=m_read_buf.ReadableBytes()>=m_max_request_size;
     }
-    return true;
+    rebase(old_base);
+    received(m_read_buf.ReadableBytes()-old_bytes);
+    //返回后reactor立即把连接交给线程池
+    m_t_queued=now_ns();
+    if(m_access_log&&m_t_first_read==0&&m_read_buf.ReadableBytes()>0){
+        m_t_first_read=m_t_queued;
+    }
+    return ret;
 }
 
-// 写HTTP响应
+// 写HTTP响应：reactor线程收到EPOLLOUT后续发工作线程没有发完的应答
 bool http_conn::write()
 {
-   int temp=0;
-
-   if(bytes_to_send==0){
-    modfd(m_epollfd,m_sockfd,EPOLLIN);
-    init();
-    return true;
-   }
-   while(1){
-    temp=writev(m_sockfd,m_iv,m_iv_count);
-    if(temp<=-1){
-        //如果TCP写缓冲没有空间，则等待下一轮EPOLLOUT事件，虽然再次期间，服务器无法立即接收到同一客户的下一个请求，但这可以保证连接的完整性
-        if(errno==EAGAIN){
-            modfd(m_epollfd,m_sockfd,EPOLLOUT);
-            return true;
-        }
-        unmap();
+    if(bytes_to_send==0){
+        init();
+        rearm(EPOLLIN);
+        return true;
+    }
+    int ret=send_batch();
+    if(ret<0){
+        return false;
+    }
+    if(ret==0){
+        //TCP写缓冲没有空间，等待下一轮EPOLLOUT事件
+        rearm(EPOLLOUT);
+        return true;
+    }
+    if(!finish_batch()){
         return false;
     }
-    bytes_to_send-=temp;
-    bytes_have_send+=temp;
+    if(m_read_buf.ReadableBytes()>0){
+        //读缓冲区中还有流水线发来的请求，不等待新的EPOLLIN直接处理
+        m_t_queued=now_ns();
+        return process_requests();
+    }
+    init();
+    rearm(EPOLLIN);
+    return true;
+}
 
-    if (bytes_have_send >= m_iv[0].iov_len)
-        {
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
-        }
-        else
-        {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - temp;
+int http_conn::send_batch()
+{
+    while(1){
+        ssize_t temp=send_once();
+        metrics::add(metrics::WRITES);
+        if(temp==0){
+            //文件在发送过程中被截断
+            return -1;
         }
-
-        if (bytes_to_send <= 0)
-        {
-            // 没有数据要发送了
-            unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
-
-            if (m_linger)
-            {
-                init();
-                return true;
-            }
-            else
-            {
-                return false;
+        if(temp<0){
+            if(errno==EAGAIN){
+                metrics::add(metrics::WRITE_EAGAIN);
+                return 0;
             }
+            return -1;
         }
+        if(sent(temp)){
+            return 1;
+        }
+    }
+}
 
-    }   
+bool http_conn::finish_batch()
+{
+    // 是否保持连接由这一批的最后一个请求决定
+    bool linger=m_responses[m_response_count-1].linger;
+    unmap();
+    m_response_count=0;
+    m_response_sent=0;
+    bytes_have_send=0;
+    m_write_buf.RetrieveAll();
+    m_access_buf.RetrieveAll();
+    return linger;
+}
+
+void http_conn::rearm(int ev)
+{
+    if(!m_edge_triggered){
+        //重新注册之后reactor线程可能立即再次派发，要先清除标记
+        m_sched.store(0,std::memory_order_release);
+        modfd(m_epollfd,m_sockfd,ev);
+    }
 }
 
 //主状态机,从大的范围解析请求//解析HTTP请求
@@ -188,18 +393,19 @@ http_conn::HTTP_CODE http_conn::process_read(){
     LINE_STATUS line_status =LINE_OK;
     HTTP_CODE ret=NO_REQUEST;
     char *text=0;
-    //如果主状态机正在解析主状态体并且从状态机解析完或者解析到了一行完整的数据
-    while(((m_check_state==CHECK_STATE_CONTENT)&&(line_status==LINE_OK))||((line_status=parse_line())==LINE_OK)){
+    //如果主状态机正在解析请求体并且还没有等待更多数据，或者解析到了一行完整的数据；请求体不按行解析
+    while(((m_check_state==CHECK_STATE_CONTENT)&&(line_status==LINE_OK))||
+          ((m_check_state!=CHECK_STATE_CONTENT)&&((line_status=parse_line())==LINE_OK))){
         //获取一行数据
         text=get_line();
         m_start_line=m_checked_index;
-        printf("got 1 http line :%s\n",text);
 
         switch(m_check_state){
             case CHECK_STATE_REQUESTLINE:
             {
                 ret=parse_request_line(text);
                 if(ret==BAD_REQUEST){
+                    m_linger=false;
                     return BAD_REQUEST;
                 }
                 break;
@@ -208,9 +414,12 @@ http_conn::HTTP_CODE http_conn::process_read(){
             {
                 ret=parse_headers(text);
                 if(ret==BAD_REQUEST){
+                    m_linger=false;
                     return BAD_REQUEST;
                 }else if(ret==GET_REQUEST){     //请求头完成了,认为完成了
                     return do_request();
+                }else if(ret!=NO_REQUEST){      //请求体被拒绝
+                    return ret;
                 }
                 break;
             }
@@ -220,6 +429,11 @@ http_conn::HTTP_CODE http_conn::process_read(){
                 if(ret==GET_REQUEST){
                     return do_request();
                 }
+                if(ret!=NO_REQUEST){
+                    //请求体出错，之后的数据找不到下一个请求的边界，应答后关闭连接
+                    m_linger=false;
+                    return ret;
+                }
                 line_status=LINE_OPEN;
                 break;
             }
@@ -229,6 +443,16 @@ http_conn::HTTP_CODE http_conn::process_read(){
             }
         }
     }
+    if(line_status==LINE_BAD){
+        //找不到请求的边界，后面的数据无法再解析，应答后关闭连接
+        m_linger=false;
+        return BAD_REQUEST;
+    }
+    if(m_read_buf.ReadableBytes()>=m_max_request_size){
+        //读缓冲区已满仍然没有得到完整的请求
+        m_linger=false;
+        return TOO_LARGE_REQUEST;
+    }
     return NO_REQUEST;
 }   
 
@@ -243,6 +467,10 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char * text){
     char * method=text;
     if(strcasecmp(method,"GET")==0){
         m_method=GET;
+    }else if(strcasecmp(method,"POST")==0){
+        m_method=POST;
+    }else if(strcasecmp(method,"PUT")==0){
+        m_method=PUT;
     }else{
         return BAD_REQUEST;
     }
@@ -272,209 +500,952 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char * text){
 http_conn::HTTP_CODE http_conn::parse_headers(char * text){
     //遇到空行，表示头部字段解析完毕
     if(text[0]=='\0'){
-        //如果HTTP请求有消息体，还需要读取m_content_length字节的消息体,状态机转移到CHECK_STAATE_CONTENT状态
-        if(m_content_length!=0){
-            m_check_state=CHECK_STATE_CONTENT;
-            return NO_REQUEST;
+        return start_body();
+    }
+    //parse_line把行尾的两个字节置成了'\0'，行结束于m_checked_index-2
+    const char* end=m_read_buf.Peek()+m_checked_index-2;
+    const char* colon=http_parser::find_char(text,end,':');
+    if(colon==end){
+        return NO_REQUEST;
+    }
+    http_parser::HEADER header=http_parser::header_id(text,colon-text);
+    text+=colon-text+1;
+    text+=strspn(text," \t");
+    switch(header){
+        case http_parser::HEADER_CONNECTION:    //处理CONNECTION头部字段
+        {
+            if(strcasecmp(text,"keep-alive")==0){
+                m_linger=true;
+            }
+            break;
+        }
+        case http_parser::HEADER_CONTENT_LENGTH:    //处理CONTENT-LENGTH头部字段
+        {
+            char* end;
+            m_content_length=strtoll(text,&end,10);
+            end+=strspn(end," \t");
+            if(text[0]<'0'||text[0]>'9'||*end!='\0'||m_content_length==LLONG_MAX){
+                //长度不可信时找不到请求体的结束位置
+                return BAD_REQUEST;
+            }
+            break;
+        }
+        case http_parser::HEADER_TRANSFER_ENCODING:
+        {
+            //只支持chunked，其它传输编码的请求体无法确定边界
+            if(strcasecmp(text,"chunked")==0){
+                m_chunked=true;
+            }else{
+                m_bad_coding=true;
+            }
+            break;
         }
-        //否则说明已经得到一个完整的HTTP请求
+        case http_parser::HEADER_EXPECT:
+        {
+            if(strcasecmp(text,"100-continue")==0){
+                m_expect_continue=true;
+            }
+            break;
+        }
+        case http_parser::HEADER_HOST:  //处理Host头部字段
+        {
+            m_host=text;
+            break;
+        }
+        case http_parser::HEADER_ACCEPT_ENCODING:   //处理Accept-Encoding头部字段
+        {
+            m_accept_encoding=http_parser::accept_encoding(text);
+            break;
+        }
+        case http_parser::HEADER_IF_NONE_MATCH:
+        {
+            m_if_none_match=text;
+            break;
+        }
+        case http_parser::HEADER_IF_MODIFIED_SINCE:
+        {
+            m_if_modified_since=http_parser::parse_date(text);
+            break;
+        }
+        case http_parser::HEADER_RANGE:
+        {
+            m_range=text;
+            break;
+        }
+        case http_parser::HEADER_IF_RANGE:
+        {
+            m_if_range=text;
+            break;
+        }
+        default:
+            break;
+    }
+    return NO_REQUEST;
+}
+
+http_conn::HTTP_CODE http_conn::start_body(){
+    bool upload=m_method==POST||m_method==PUT;
+    bool has_body=m_chunked||m_content_length>0;
+    if(m_bad_coding){
+        m_linger=false;
+        m_body_status=501;
+        return UPLOAD_REQUEST;
+    }
+    if(m_chunked){
+        //同时带Content-Length的请求可能是请求走私，以分块为准，应答后关闭连接
+        if(m_content_length>0){
+            m_linger=false;
+        }
+        m_content_length=-1;
+    }
+    if(m_content_length>m_max_body_size){
+        //不接收超过上限的请求体，process_write按请求体状态应答413
+        m_check_state=CHECK_STATE_CONTENT;
+        m_linger=false;
+        return TOO_LARGE_REQUEST;
+    }
+    if(upload){
+        if(!m_new_body_handler){
+            m_body_status=405;
+        }else{
+            if(!m_body){
+                m_body=m_new_body_handler();
+            }
+            m_body_status=m_body->begin(m_method,m_url,m_content_length);
+        }
+        if(m_body_status!=0){
+            //被拒绝的请求体不再接收，应答后关闭连接
+            if(has_body){
+                m_linger=false;
+            }
+            return UPLOAD_REQUEST;
+        }
+        m_body_active=true;
+    }
+    if(!has_body){
         return GET_REQUEST;
-    }else if(strncasecmp(text,"Connection:",11)==0){    //处理CONNECTION头部字段
-        text+=11;
-        text+=strspn(text," \t");
-        if(strcasecmp(text,"keep-alive")==0){
-            m_linger=true;
-        }
-    }else if(strncasecmp(text,"Content-Length:",15)==0){    //处理CONTENT-LENGTH头部字段
-        text+=15;
-        text+=strspn(text," \t");
-        m_content_length=atol(text);
-    }else if(strncasecmp(text,"Host:",5)==0){   //处理Host头部字段
-        text+=5;
-        text+=strspn(text," \t");
-        m_host=text;
-    }else{
-        printf("oop! unknow header %s\n",text);
-    }   
-    return NO_REQUEST;  
+    }
+    if(m_expect_continue){
+        send_continue();
+    }
+    //GET等请求的请求体不交给任何接收者，收完后丢弃
+    m_body_state=m_chunked?BODY_CHUNK_SIZE:BODY_DATA;
+    m_body_left=m_content_length;
+    m_body_size=0;
+    m_check_state=CHECK_STATE_CONTENT;
+    return NO_REQUEST;
 }
 
-//解析请求体(判断是否完整读入)
+//解析请求体：读缓冲区中已经收到的部分交给body_handler，处理过的字节随即从读缓冲区中删除，
+//读缓冲区只保存请求头和还没有处理的少量数据，请求体再大也不会超过m_max_request_size
 http_conn::HTTP_CODE http_conn::parse_content(char * text){
-    if(m_read_idx>=(m_content_length+m_checked_index)){
-        text[m_content_length]='\0';
+    //请求体从请求头之后开始，之后可能紧跟着流水线中的下一个请求
+    char* body=m_read_buf.Peek()+m_checked_index;
+    char* end=m_read_buf.Peek()+m_read_buf.ReadableBytes();
+    char* p=body;
+    bool done=false;
+    bool partial=false;
+    while(!done&&!partial&&p<end){
+        switch(m_body_state){
+            case BODY_DATA:
+            {
+                int64_t n=end-p<m_body_left?end-p:m_body_left;
+                if(m_body_active&&!m_body->write(p,n)){
+                    return INTERNAL_ERROR;
+                }
+                p+=n;
+                m_body_left-=n;
+                if(m_body_left==0){
+                    if(m_chunked){
+                        m_body_state=BODY_CHUNK_END;
+                    }else{
+                        done=true;
+                    }
+                }
+                break;
+            }
+            case BODY_CHUNK_SIZE:
+            {
+                char* eol=(char*)memchr(p,'\n',end-p);
+                if(!eol){
+                    if(end-p>MAX_CHUNK_LINE){
+                        return BAD_REQUEST;
+                    }
+                    partial=true;
+                    break;
+                }
+                //十六进制的块大小，之后的块扩展忽略
+                int64_t size=0;
+                char* q=p;
+                for(;q<eol&&isxdigit((unsigned char)*q);++q){
+                    if(size>(m_max_body_size>>4)){
+                        return TOO_LARGE_REQUEST;
+                    }
+                    size=size*16+(*q<='9'?*q-'0':(*q|0x20)-'a'+10);
+                }
+                if(q==p){
+                    return BAD_REQUEST;
+                }
+                m_body_size+=size;
+                if(m_body_size>m_max_body_size){
+                    return TOO_LARGE_REQUEST;
+                }
+                p=eol+1;
+                if(size==0){
+                    m_body_state=BODY_TRAILER;
+                }else{
+                    m_body_state=BODY_DATA;
+                    m_body_left=size;
+                }
+                break;
+            }
+            case BODY_CHUNK_END:
+            {
+                //块数据之后的\r\n
+                if(*p=='\r'&&end-p<2){
+                    partial=true;
+                    break;
+                }
+                if(*p=='\r'&&p[1]=='\n'){
+                    p+=2;
+                }else if(*p=='\n'){
+                    p+=1;
+                }else{
+                    return BAD_REQUEST;
+                }
+                m_body_state=BODY_CHUNK_SIZE;
+                break;
+            }
+            case BODY_TRAILER:
+            {
+                //trailer中的头部不使用，遇到空行时请求结束
+                char* eol=(char*)memchr(p,'\n',end-p);
+                if(!eol){
+                    if(end-p>MAX_CHUNK_LINE){
+                        return BAD_REQUEST;
+                    }
+                    partial=true;
+                    break;
+                }
+                done=eol==p||(eol==p+1&&*p=='\r');
+                p=eol+1;
+                break;
+            }
+        }
+    }
+    if(done){
+        m_checked_index+=p-body;
         return GET_REQUEST;
     }
+    //处理过的请求体不再需要，删除后读缓冲区中只剩请求头和没有处理的部分
+    m_read_buf.Erase(m_checked_index,p-body);
     return NO_REQUEST;
-}       
+}
 
 //解析一行，判断依据\r\n
+//行结束符由http_parser按CPU支持的指令集成块查找，不完整的行下次从m_checked_index继续
 http_conn::LINE_STATUS http_conn::parse_line(){
-    char temp;
-    for(;m_checked_index<m_read_idx;++m_checked_index){
-
-        temp=m_read_buf[m_checked_index];
-        if(temp=='\r'){
-            if((m_checked_index+1)==m_read_idx){
-                return LINE_OPEN;
-            }else if(m_read_buf[m_checked_index+1]=='\n'){
-                m_read_buf[m_checked_index++]='\0';     //先\r再\n
-                m_read_buf[m_checked_index++]='\0';
-                return LINE_OK;
-            }         
-            return LINE_BAD;
-        } else if(temp=='\n'){
-            if((m_checked_index>1)&&(m_read_buf[m_checked_index-1]=='\r')){
-                m_read_buf[m_checked_index-1]='\0';     //先\n再\r
-                m_read_buf[m_checked_index++]='\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
-        }        
-    }   
-    return LINE_OPEN;
+    char* buf=m_read_buf.Peek();
+    int read_idx=m_read_buf.ReadableBytes();
+    m_checked_index=http_parser::find_line_end(buf+m_checked_index,buf+read_idx)-buf;
+    if(m_checked_index>=read_idx){
+        return LINE_OPEN;
+    }
+    if(buf[m_checked_index]=='\r'){
+        if((m_checked_index+1)==read_idx){
+            return LINE_OPEN;
+        }else if(buf[m_checked_index+1]=='\n'){
+            buf[m_checked_index++]='\0';     //先\r再\n
+            buf[m_checked_index++]='\0';
+            return LINE_OK;
+        }
+        return LINE_BAD;
+    }
+    if((m_checked_index>1)&&(buf[m_checked_index-1]=='\r')){
+        buf[m_checked_index-1]='\0';     //先\n再\r
+        buf[m_checked_index++]='\0';
+        return LINE_OK;
+    }
+    return LINE_BAD;
 }
 
 
 http_conn::HTTP_CODE http_conn::do_request(){
-    strcpy(m_real_file,doc_root);
-    int len =strlen(doc_root);
+    if(m_access_log){
+        m_t_lookup_start=now_ns();
+    }
+    if(m_body_active){
+        //请求体已经全部交给接收者，由它决定应答
+        m_body_active=false;
+        m_body_status=m_body->finish();
+        return UPLOAD_REQUEST;
+    }
+    if(m_stats_url&&strcmp(m_url,m_stats_url)==0){
+        return STATS_REQUEST;
+    }
+    strcpy(m_real_file,m_doc_root);
+    int len =strlen(m_doc_root);
     strncpy(m_real_file+len,m_url,FILENAME_LEN-len-1);
-    if(stat(m_real_file,&m_file_stat)<0){
+    //从文件缓存取得目标文件，命中时不需要stat、open和mmap
+    int err=0;
+    m_file=file_cache::get_instance()->acquire(m_real_file,err);
+    //客户端接受压缩时换成预压缩文件或者缓存中的压缩版本，Range请求总是使用原文件
+    if(m_file&&!m_range&&m_accept_encoding&&m_file->compressible){
+        const cached_file* encoded=file_cache::get_instance()->acquire_encoded(m_real_file,m_file,m_accept_encoding);
+        if(encoded){
+            file_cache::release(m_file);
+            m_file=encoded;
+        }
+    }
+    if(m_access_log){
+        m_t_lookup_end=now_ns();
+    }
+    if(!m_file){
+        if(err==EACCES){
+            return FORBIDDEN_REQUEST;
+        }
+        if(err==EISDIR){
+            return BAD_REQUEST;
+        }
         return NO_RESOURCE;
     }
-    if(!(m_file_stat.st_mode&S_IROTH)){
-        return FORBIDDEN_REQUEST;
+    return check_conditions();
+}
+
+http_conn::HTTP_CODE http_conn::check_conditions(){
+    //If-None-Match存在时忽略If-Modified-Since，GET请求的If-None-Match使用弱比较
+    if(m_if_none_match){
+        if(http_parser::etag_match(m_if_none_match,m_file->etag.data(),m_file->etag.size(),true)){
+            return NOT_MODIFIED;
+        }
+    }else if(m_if_modified_since>=0&&m_file->st.st_mtim.tv_sec<=m_if_modified_since){
+        return NOT_MODIFIED;
     }
-    if(S_ISDIR(m_file_stat.st_mode)){
-        return BAD_REQUEST;
+    if(!m_range){
+        return FILE_REQUEST;
+    }
+    if(m_if_range){
+        //客户端已有的部分和当前文件不是同一个版本时发送整个文件；日期必须和Last-Modified完全相同
+        bool same;
+        if(m_if_range[0]=='"'||m_if_range[0]=='W'){
+            same=http_parser::etag_match(m_if_range,m_file->etag.data(),m_file->etag.size(),false);
+        }else{
+            same=http_parser::parse_date(m_if_range)==m_file->st.st_mtim.tv_sec;
+        }
+        if(!same){
+            return FILE_REQUEST;
+        }
+    }
+    m_range_count=http_parser::parse_range(m_range,m_file->st.st_size,m_ranges,MAX_RANGES);
+    if(m_range_count<0){
+        return FILE_REQUEST;
+    }
+    if(m_range_count==0){
+        return RANGE_NOT_SATISFIABLE;
+    }
+    if(m_range_count>1){
+        off_t total=0;
+        for(int i=0;i<m_range_count;++i){
+            total+=m_ranges[i].last-m_ranges[i].first+1;
+        }
+        if(total>MAX_MULTIRANGE_BYTES){
+            return FILE_REQUEST;
+        }
+    }
+    return RANGE_REQUEST;
+}
+
+ssize_t http_conn::send_once(){
+    struct msghdr msg;
+    int flags,file_fd;
+    off_t offset;
+    size_t len;
+    if(prepare_send(msg,flags,file_fd,offset,len)==1){
+        //显式传入偏移量，sendfile不改变文件描述符自身的读写位置
+        return sendfile(m_sockfd,file_fd,&offset,len);
+    }
+    return sendmsg(m_sockfd,&msg,flags);
+}
+
+int http_conn::prepare_send(struct msghdr& msg,int& flags,int& file_fd,off_t& offset,size_t& len){
+    const response& cur=m_responses[m_response_sent];
+    if(cur.file&&cur.file->fd!=-1&&bytes_have_send>=cur.head_len){
+        //大文件的应答头已经发出，接着发送文件内容
+        file_fd=cur.file->fd;
+        offset=cur.body_off+bytes_have_send-cur.head_len;
+        len=cur.head_len+cur.body_len-bytes_have_send;
+        return 1;
+    }
+
+    int count=0;
+    flags=0;
+    ssize_t skip=bytes_have_send;
+    for(int i=m_response_sent;i<m_response_count;++i){
+        const response& r=m_responses[i];
+        if(skip<r.head_len){
+            m_iv[count].iov_base=m_write_buf.Peek()+r.head+skip;
+            m_iv[count].iov_len=r.head_len-skip;
+            ++count;
+            skip=0;
+        }else{
+            skip-=r.head_len;
+        }
+        if(r.body_len==0){
+            continue;
+        }
+        if(r.file->fd!=-1){
+            //MSG_MORE让内核等待后面sendfile发送的文件内容，应答头不单独成包
+            flags=MSG_MORE;
+            break;
+        }
+        m_iv[count].iov_base=r.file->data+r.body_off+skip;
+        m_iv[count].iov_len=r.body_len-skip;
+        ++count;
+        skip=0;
+    }
+
+    memset(&msg,0,sizeof(msg));
+    msg.msg_iov=m_iv;
+    msg.msg_iovlen=count;
+    return 0;
+}
+
+bool http_conn::sent(ssize_t n){
+    bytes_to_send-=n;
+    m_send_bytes+=n;
+    advance(n);
+    update_deadline();
+    return bytes_to_send<=0;
+}
+
+void http_conn::received(size_t n){
+    if(n==0){
+        return;
+    }
+    if(!m_request_start){
+        m_request_start=time(NULL);
+        m_recv_bytes=0;
+    }
+    m_recv_bytes+=n;
+    update_deadline();
+}
+
+void http_conn::advance(ssize_t temp){
+    int64_t now=0;
+    while(temp>0){
+        response& r=m_responses[m_response_sent];
+        ssize_t left=r.head_len+r.body_len-bytes_have_send;
+        if(temp<left){
+            bytes_have_send+=temp;
+            return;
+        }
+        //这个应答发送完毕，尽早归还文件
+        temp-=left;
+        if(now==0){
+            now=now_ns();
+        }
+        metrics::latency(now-r.start);
+        metrics::add(metrics::RESPONSE_BYTES,r.head_len+r.body_len);
+        if(r.access>=0){
+            log_access(r,now);
+        }
+        file_cache::release(r.file);
+        r.file=NULL;
+        ++m_response_sent;
+        bytes_have_send=0;
     }
-    int fd=open(m_real_file,O_RDONLY);
-    m_file_address=(char* )mmap(0,m_file_stat.st_size,PROT_READ,MAP_PRIVATE,fd,0);
-    close(fd);
-    return FILE_REQUEST;
 }
 
 void http_conn::process() {
-    // 解析HTTP请求
-    HTTP_CODE read_ret=process_read();
-    if(read_ret==NO_REQUEST){
-        modfd(m_epollfd,m_sockfd,EPOLLIN);
+    if(m_edge_triggered){
+        process_et();
         return;
     }
-    bool write_ret=process_write(read_ret);
-    if(!write_ret){
-        close_conn();
+    if(!process_requests()){
+        request_close();
     }
-    modfd(m_epollfd,m_sockfd,EPOLLOUT);
+}
 
+bool http_conn::parse_batch() {
+    if(m_access_log){
+        m_t_dequeued=now_ns();
+        m_t_parse=m_t_dequeued;
+    }
+    //依次解析读缓冲区中已经完整的请求，把它们的应答排成一批一起发送
+    while(m_response_count<MAX_PIPELINE&&m_write_buf.ReadableBytes()<(size_t)WRITE_BUFFER_SIZE){
+        // 解析HTTP请求
+        HTTP_CODE read_ret=process_read();
+        if(read_ret==NO_REQUEST){
+            break;
+        }
+        if(++m_requests==m_max_requests){
+            //达到每个连接的请求数上限，这个应答之后关闭连接
+            m_linger=false;
+        }
+        bool write_ret=process_write(read_ret);
+        if(!write_ret){
+            return false;
+        }
+        bool linger=m_linger;
+        init_request();
+        if(m_access_log){
+            m_t_parse=now_ns();
+        }
+        if(!linger){
+            //不保持连接的请求之后的数据不再处理
+            break;
+        }
+    }
+    update_deadline();
+    return true;
 }
 
-//对内存映射区执行munmap操作
-void http_conn::unmap(){
-    if(m_file_address){
-        munmap(m_file_address,m_file_stat.st_size);
-        m_file_address=0;
+bool http_conn::process_requests() {
+    while(true){
+        if(!parse_batch()){
+            return false;
+        }
+        if(m_response_count==0){
+            if(m_read_buf.ReadableBytes()==0){
+                //上一批应答发完后没有再收到请求，空闲期间不占用缓冲区
+                init();
+            }
+            rearm(EPOLLIN);
+            return true;
+        }
+        if(!m_edge_triggered&&!m_responses[m_response_count-1].linger){
+            //要关闭的连接交给reactor线程发送，发完后由它关闭连接并删除定时器
+            rearm(EPOLLOUT);
+            return true;
+        }
+        //先直接发送，多数应答一次就能发完，不必注册EPOLLOUT再等一轮事件
+        int ret=send_batch();
+        if(ret<0){
+            if(m_edge_triggered){
+                return false;
+            }
+            //出错的连接交给reactor线程，它再次发送失败或者收到EPOLLERR时关闭连接
+            rearm(EPOLLOUT);
+            return true;
+        }
+        if(ret==0){
+            rearm(EPOLLOUT);
+            return true;
+        }
+        if(!finish_batch()){
+            return false;
+        }
+        if(m_read_buf.ReadableBytes()==0){
+            //重新注册之后连接可能立即被reactor线程读取，不能再访问它
+            init();
+            rearm(EPOLLIN);
+            return true;
+        }
+        //读缓冲区中还有流水线发来的请求，继续处理
+        m_t_queued=now_ns();
     }
 }
 
-bool http_conn::add_response(const char* format,...){
-    if(m_write_idx>=WRITE_BUFFER_SIZE){
-        return false;
+size_t http_conn::receive(const char* data,size_t len){
+    size_t used=m_read_buf.ReadableBytes();
+    if(used+len>m_max_request_size){
+        len=used<m_max_request_size?m_max_request_size-used:0;
+    }
+    if(len==0){
+        return 0;
+    }
+    //读缓冲区的存储可能在追加时搬移或增长
+    const char* old_base=m_read_buf.Peek();
+    if(!m_read_buf.Append(data,len)){
+        return 0;
     }
-    va_list arg_list;
-    va_start(arg_list,format);
-    int len=vsnprintf(m_write_buf+m_write_idx,WRITE_BUFFER_SIZE-1-m_write_idx,format,arg_list);
-    if(len>=(WRITE_BUFFER_SIZE-1-m_write_idx)){
+    rebase(old_base);
+    received(len);
+    m_t_queued=now_ns();
+    if(m_access_log&&m_t_first_read==0){
+        m_t_first_read=m_t_queued;
+    }
+    return len;
+}
+
+bool http_conn::build_batch(){
+    if(!parse_batch()){
         return false;
     }
-    m_write_idx+=len;
-    va_end(arg_list);
+    if(m_response_count==0&&m_read_buf.ReadableBytes()==0){
+        init();
+    }
     return true;
 }
 
-bool http_conn::add_status_line(int status,const char* title){
-    return add_response("%s %d %s\r\n","HTTP/1.1",status,title);
+bool http_conn::on_event()
+{
+    int s=m_sched.load(std::memory_order_acquire);
+    while(true){
+        if(s&SCHED_CLOSING){
+            return false;
+        }
+        if(m_sched.compare_exchange_weak(s,s|SCHED_QUEUED|SCHED_AGAIN,std::memory_order_acq_rel)){
+            return !(s&SCHED_QUEUED);
+        }
+    }
+}
+
+void http_conn::on_dispatch()
+{
+    m_sched.store(SCHED_QUEUED,std::memory_order_release);
+}
+
+bool http_conn::busy() const
+{
+    return m_sched.load(std::memory_order_acquire)&SCHED_QUEUED;
+}
+
+bool http_conn::serve()
+{
+    if(bytes_to_send>0){
+        //上一批应答还没有发完
+        int ret=send_batch();
+        if(ret<0){
+            return false;
+        }
+        if(ret==0){
+            return true;
+        }
+        if(!finish_batch()){
+            return false;
+        }
+    }
+    if(!read()){
+        return false;
+    }
+    return process_requests();
+}
+
+void http_conn::process_et()
+{
+    while(true){
+        m_sched.fetch_and(~SCHED_AGAIN,std::memory_order_acq_rel);
+        if(!serve()){
+            //保留SCHED_QUEUED，reactor处理关闭请求之前定时器和淘汰都不会关闭连接，下标不会被新连接复用
+            m_sched.store(SCHED_CLOSING|SCHED_QUEUED,std::memory_order_release);
+            request_close();
+            return;
+        }
+        if(m_read_capped&&bytes_to_send==0){
+            //socket中还有没读的数据，不会再有新的边缘事件
+            continue;
+        }
+        int s=SCHED_QUEUED;
+        if(m_sched.compare_exchange_strong(s,0,std::memory_order_acq_rel)){
+            return;
+        }
+        //处理期间又收到了事件，再处理一轮
+    }
+}
+
+void http_conn::request_close()
+{
+    close_msg msg={m_sockfd,conn_id()};
+    //不超过PIPE_BUF的写入是原子的，管道满时阻塞到reactor读走
+    while(::write(m_closefd,&msg,sizeof(msg))<0&&errno==EINTR){
+    }
 }
 
-bool http_conn::add_headers(int content_len){
-    add_content_length(content_len);
-    add_content_type();
-    add_linger();
-    add_blank_line();
+//归还从文件缓存取得的目标文件，映射和文件描述符由缓存负责释放
+void http_conn::unmap(){
+    if(m_file){
+        file_cache::release(m_file);
+        m_file=NULL;
+    }
+    for(int i=m_response_sent;i<m_response_count;++i){
+        file_cache::release(m_responses[i].file);
+        m_responses[i].file=NULL;
+    }
 }
 
-bool http_conn::add_content_length(int content_len){
-    return add_response("Content-Length:%d\r\n",content_len);
+//把一段预先渲染的应答块复制到写缓冲区，写缓冲区不够时增长
+bool http_conn::add_bytes(const char* data,size_t len){
+    return m_write_buf.Append(data,len);
 }
 
-bool http_conn::add_linger(){
-    return add_response("Connection: %s\r\n",(m_linger==true)?"Keep-alive":"close");
+bool http_conn::add_bytes(const std::string& block){
+    return add_bytes(block.data(),block.size());
 }
 
-bool http_conn::add_blank_line(){
-    return add_response("%s","\r\n");
+//添加当前秒的Date头部
+bool http_conn::add_date(){
+    char date[http_response::DATE_LEN];
+    return add_bytes(date,http_response::write_date(date));
 }
 
-bool http_conn::add_content(const char* content){
-    return add_response("%s",content);
+//错误应答：预先渲染的状态行和头部 + Date + Connection和错误页面
+bool http_conn::add_error(int status){
+    m_status=status;
+    return add_bytes(http_response::error_head(status)) && add_date() &&
+           add_bytes(http_response::error_tail(status,m_linger));
 }
 
-bool http_conn::add_content_type() {
-    return add_response("Content-Type:%s\r\n", "text/html");
+
+bool http_conn::add_stats(){
+    static const char head[]="Content-Type:text/plain; version=0.0.4\r\nCache-Control:no-cache\r\nContent-Length:";
+    m_status=200;
+    std::string body=metrics::render();
+    char num[http_response::UINT_LEN];
+    return add_bytes(http_response::status_line(200)) && add_date() &&
+           add_bytes(head,sizeof(head)-1) && add_bytes(num,http_response::write_uint(num,body.size())) &&
+           add_bytes("\r\n",2) && add_bytes(http_response::connection(m_linger)) && add_bytes(body);
+}
+
+bool http_conn::add_not_modified(){
+    //304没有内容，只带ETag、Last-Modified和Vary
+    m_status=304;
+    const std::string& h=m_file->headers;
+    return add_bytes(http_response::status_line(304)) && add_date() &&
+           add_bytes(h.data()+m_file->validators_pos,h.size()-m_file->validators_pos) &&
+           add_bytes(http_response::connection(m_linger));
+}
+
+bool http_conn::add_upload(){
+    m_status=m_body_status;
+    return add_bytes(http_response::status_line(m_status)) && add_date() &&
+           (m_status==204 || add_bytes("Content-Length:0\r\n",18)) && add_bytes(http_response::connection(m_linger));
+}
+
+void http_conn::send_continue(){
+    static const char CONTINUE[]="HTTP/1.1 100 Continue\r\n\r\n";
+    //前面还有没发完的应答时不发送，客户端等待一段时间后也会直接发送请求体
+    if(m_response_count==0&&bytes_to_send==0){
+        ::send(m_sockfd,CONTINUE,sizeof(CONTINUE)-1,MSG_NOSIGNAL|MSG_DONTWAIT);
+    }
+}
+
+bool http_conn::add_range_error(){
+    m_status=416;
+    char num[http_response::UINT_LEN];
+    return add_bytes(http_response::error_head(416)) && add_date() && add_bytes("Content-Range:bytes */",22) &&
+           add_bytes(num,http_response::write_uint(num,m_file->st.st_size)) && add_bytes("\r\n",2) &&
+           add_bytes(http_response::error_tail(416,m_linger));
+}
+
+//添加单个区间的Content-Range和Content-Length头部
+bool http_conn::add_content_range(off_t first,off_t last){
+    char num[http_response::UINT_LEN];
+    return add_bytes("Content-Range:bytes ",20) && add_bytes(num,http_response::write_uint(num,first)) &&
+           add_bytes("-",1) && add_bytes(num,http_response::write_uint(num,last)) && add_bytes("/",1) &&
+           add_bytes(num,http_response::write_uint(num,m_file->st.st_size)) && add_bytes("\r\nContent-Length:",17) &&
+           add_bytes(num,http_response::write_uint(num,last-first+1)) && add_bytes("\r\n",2);
+}
+
+//多个区间：multipart/byteranges，每部分带自己的Content-Type和Content-Range，内容从映射或者用pread复制过来
+bool http_conn::add_multipart(){
+    static const char boundary[]="0a1b2c3d4e5f6789";
+    char num[http_response::UINT_LEN];
+    std::string body;
+    for(int i=0;i<m_range_count;++i){
+        const http_parser::byte_range& r=m_ranges[i];
+        body+="\r\n--";
+        body+=boundary;
+        body+="\r\nContent-Type:";
+        body+=m_file->mime->type;
+        body+="\r\nContent-Range:bytes ";
+        body.append(num,http_response::write_uint(num,r.first));
+        body+="-";
+        body.append(num,http_response::write_uint(num,r.last));
+        body+="/";
+        body.append(num,http_response::write_uint(num,m_file->st.st_size));
+        body+="\r\n\r\n";
+        size_t len=r.last-r.first+1;
+        if(m_file->data){
+            body.append(m_file->data+r.first,len);
+            continue;
+        }
+        size_t pos=body.size();
+        body.resize(pos+len);
+        size_t done=0;
+        while(done<len){
+            ssize_t n=pread(m_file->fd,&body[pos+done],len-done,r.first+done);
+            if(n<=0){
+                if(n<0&&errno==EINTR){
+                    continue;
+                }
+                return false;
+            }
+            done+=n;
+        }
+    }
+    body+="\r\n--";
+    body+=boundary;
+    body+="--\r\n";
+
+    static const char type[]="Content-Type:multipart/byteranges; boundary=";
+    const std::string& h=m_file->headers;
+    return add_bytes(http_response::status_line(206)) && add_date() && add_bytes(type,sizeof(type)-1) &&
+           add_bytes(boundary,sizeof(boundary)-1) && add_bytes("\r\nContent-Length:",17) &&
+           add_bytes(num,http_response::write_uint(num,body.size())) && add_bytes("\r\n",2) &&
+           add_bytes(h.data()+m_file->validators_pos,h.size()-m_file->validators_pos) &&
+           add_bytes(http_response::connection(m_linger)) && add_bytes(body);
+}
+
+void http_conn::queue_response(int head,const cached_file* file,off_t offset,off_t len){
+    if(m_response_count==0){
+        m_send_start=time(NULL);
+        m_send_bytes=0;
+    }
+    response& r=m_responses[m_response_count++];
+    r.head=head;
+    r.head_len=m_write_buf.ReadableBytes()-head;
+    r.file=file;
+    r.body_off=offset;
+    r.body_len=len;
+    r.linger=m_linger;
+    r.access=m_access_log?add_access(now_ns(),r.head_len+r.body_len):-1;
+    r.start=m_t_queued;
+    bytes_to_send+=r.head_len+r.body_len;
+    metrics::add(metrics::REQUESTS);
+    metrics::status(m_status);
 }
 
-//根据服务器处理HTTP请求的结果，决定返回客户端的内容
+int http_conn::add_access(int64_t now,off_t bytes){
+    access_entry e;
+    e.queued=now;
+    e.bytes=bytes;
+    e.accept_ns=-1;
+    if(m_t_first_read>0){
+        e.accept_ns=m_t_first_read-m_t_accept;
+        m_t_first_read=-1;
+    }
+    e.queue_ns=m_t_dequeued-m_t_queued;
+    //没有查找文件的错误应答，从开始解析到加入发送队列都算作解析
+    e.parse_ns=(m_t_lookup_start?m_t_lookup_start:now)-m_t_parse;
+    e.lookup_ns=m_t_lookup_start?m_t_lookup_end-m_t_lookup_start:-1;
+    e.status=m_status;
+    e.method=m_url?m_method:-1;
+    e.linger=m_linger;
+    const char* url=m_url?m_url:"-";
+    size_t len=strnlen(url,FILENAME_LEN);
+    int pos=m_access_buf.ReadableBytes();
+    if(!m_access_buf.Append(&e,sizeof(e))||!m_access_buf.Append(url,len)||!m_access_buf.Append("",1)){
+        return -1;
+    }
+    return pos;
+}
+
+/* 访问日志每行的列(制表符分隔)：时间 方法 URL 状态码 字节数 是否保持连接
+   accept到第一次读到数据 线程池排队 解析 查找文件 发送，耗时的单位是纳秒，-1表示没有这一阶段 */
+void http_conn::log_access(const response& r,int64_t now){
+    access_entry e;
+    const char* p=m_access_buf.Peek()+r.access;
+    memcpy(&e,p,sizeof(e));
+    static const int format_id=Log::RegisterFormat("%s\t%s\t%d\t%lld\t%d\t%lld\t%lld\t%lld\t%lld\t%lld");
+    Log::Access()->WriteDeferred(1,format_id,e.method>=0?METHOD_NAME[e.method]:"-",p+sizeof(e),e.status,
+                                 e.bytes,e.linger?1:0,e.accept_ns,e.queue_ns,e.parse_ns,e.lookup_ns,now-e.queued);
+}
+
+//根据服务器处理HTTP请求的结果，决定返回客户端的内容，应答追加到发送队列的末尾
 bool http_conn::process_write(HTTP_CODE ret){
+    int head=m_write_buf.ReadableBytes();
     switch(ret){
         case INTERNAL_ERROR:
         {
-            add_status_line(500,error_500_title);
-            add_headers(strlen(error_500_form));
-            if(!add_content(error_500_form)){
+            if(!add_error(500)){
                 return false;
             }
             break;
         }
         case BAD_REQUEST:
         {
-            add_status_line(400,error_400_title);
-            add_headers(strlen(error_400_form));
-            if(!add_content(error_400_form)){
+            if(!add_error(400)){
                 return false;
             }
             break;
         }
         case NO_RESOURCE:
         {
-            add_status_line(404,error_404_title);
-            add_headers(strlen(error_404_form));
-            if(!add_content(error_404_form)){
+            if(!add_error(404)){
                 return false;
             }
             break;
         }
         case FORBIDDEN_REQUEST:
         {
-            add_status_line(403,error_403_title);
-            add_headers(strlen(error_403_form));
-            if(!add_content(error_403_form)){
+            if(!add_error(403)){
+                return false;
+            }
+            break;
+        }
+        case STATS_REQUEST:
+        {
+            if(!add_stats()){
+                return false;
+            }
+            break;
+        }
+        case TOO_LARGE_REQUEST:
+        {
+            //请求头没有读完时是431，请求体超过上限时是413
+            if(!add_error(m_check_state==CHECK_STATE_CONTENT?413:431)){
                 return false;
             }
             break;
         }
         case FILE_REQUEST:
         {
-            add_status_line(200, ok_200_title );
-            add_headers(m_file_stat.st_size);
-            m_iv[ 0 ].iov_base = m_write_buf;
-            m_iv[ 0 ].iov_len = m_write_idx;
-            m_iv[ 1 ].iov_base = m_file_address;
-            m_iv[ 1 ].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
-
-            bytes_to_send = m_write_idx + m_file_stat.st_size;
-
+            //Content-Length、Content-Type和Content-Encoding已由文件缓存预先生成
+            m_status=200;
+            if (!add_bytes(http_response::status_line(200)) || !add_date() ||
+                !add_bytes(m_file->headers) || !add_bytes(http_response::connection(m_linger))) {
+                return false;
+            }
+            //文件交给发送队列，发送完毕后归还
+            queue_response(head,m_file,0,m_file->st.st_size);
+            m_file=NULL;
+            return true;
+        }
+        case NOT_MODIFIED:
+        {
+            if(!add_not_modified()){
+                return false;
+            }
+            break;
+        }
+        case UPLOAD_REQUEST:
+        {
+            if(m_body_status>=300){
+                if(!add_error(m_body_status)){
+                    return false;
+                }
+            }else if(!add_upload()){
+                return false;
+            }
+            break;
+        }
+        case RANGE_NOT_SATISFIABLE:
+        {
+            if(!add_range_error()){
+                return false;
+            }
+            break;
+        }
+        case RANGE_REQUEST:
+        {
+            m_status=206;
+            if(m_range_count>1){
+                if(!add_multipart()){
+                    return false;
+                }
+                break;
+            }
+            //单个区间：文件中的这一段直接从映射或者用sendfile发送
+            const http_parser::byte_range& r=m_ranges[0];
+            const std::string& h=m_file->headers;
+            if (!add_bytes(http_response::status_line(206)) || !add_date() || !add_content_range(r.first,r.last) ||
+                !add_bytes(h.data()+m_file->meta_pos,h.size()-m_file->meta_pos) ||
+                !add_bytes(http_response::connection(m_linger))) {
+                return false;
+            }
+            queue_response(head,m_file,r.first,r.last-r.first+1);
+            m_file=NULL;
             return true;
         }
         default:
@@ -482,9 +1453,11 @@ bool http_conn::process_write(HTTP_CODE ret){
             return false;
         }
     }
-    m_iv[0].iov_base=m_write_buf;
-    m_iv[0].iov_len=m_write_idx;
-    m_iv_count=1;
-    bytes_to_send = m_write_idx;
+    //304、416和多区间的应答不再引用文件
+    if(m_file){
+        file_cache::release(m_file);
+        m_file=NULL;
+    }
+    queue_response(head,NULL,0,0);
     return true;
-}
\ No newline at end of file
+}
@@ -19,17 +19,30 @@
 #include <stdarg.h>
 #include <errno.h>
 #include "locker.h"
+#include "mem_pool.h"
+#include "file_cache.h"
+#include "buffer.h"
+#include "body_handler.h"
 #include <sys/uio.h>
+#include <string>
+#include <sys/sendfile.h>
+#include <stdint.h>
+#include <atomic>
 
 class http_conn
 {
 public:
     
     static const int FILENAME_LEN=200;              //文件名最大长度
-    static const int READ_BUFFER_SIZE=2048;     //读缓冲区大小
-    static const int WRITE_BUFFER_SIZE=1024;    //写缓冲区大小
+    static const int READ_BUFFER_SIZE=2048;     //读缓冲区初始大小，请求更大时增长到m_max_request_size
+    static const int WRITE_BUFFER_SIZE=4096;    //写缓冲区初始大小，一批应答头超过它时不再继续排队
+    static const int MAX_PIPELINE=16;           //一批最多排队的应答数
+    static const int ACCESS_BUFFER_SIZE=512;    //访问日志缓冲区初始大小
+    static const int MAX_RANGES=16;             //Range中最多的区间数，更多时忽略Range发送整个文件
+    static const int MAX_MULTIRANGE_BYTES=256*1024;    //多区间应答的内容复制到写缓冲区，总大小超过它时发送整个文件
+    static const int MAX_CHUNK_LINE=1024;       //分块传输中块大小行和trailer行的最大长度
 
-    // HTTP请求方法，这里只支持GET
+    // HTTP请求方法，这里支持GET，以及上传文件的POST和PUT
     enum METHOD {GET = 0, POST, HEAD, PUT, DELETE, TRACE, OPTIONS, CONNECT};  
     /*
         解析客户端请求时，主状态机的状态
@@ -48,31 +61,102 @@ public:
         FILE_REQUEST        :   文件请求,获取文件成功
         INTERNAL_ERROR      :   表示服务器内部错误
         CLOSED_CONNECTION   :   表示客户端已经关闭连接了
+        TOO_LARGE_REQUEST   :   表示请求头或请求体超过了读缓冲区的上限
+        STATS_REQUEST       :   请求的是保留的统计URL，应答运行时指标
+        NOT_MODIFIED        :   条件请求的文件没有变化，应答304
+        RANGE_REQUEST       :   Range请求的区间可以满足，应答206
+        RANGE_NOT_SATISFIABLE   :   Range中没有可以满足的区间，应答416
+        UPLOAD_REQUEST      :   请求体已交给body_handler或者被拒绝，应答m_body_status
     */
-    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION };
+    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION, TOO_LARGE_REQUEST, STATS_REQUEST, NOT_MODIFIED, RANGE_REQUEST, RANGE_NOT_SATISFIABLE, UPLOAD_REQUEST };
     
     // 从状态机的三种可能状态，即行的读取状态，分别表示
     // 1.读取到一个完整的行 2.行出错 3.行数据尚且不完整
     enum LINE_STATUS { LINE_OK = 0, LINE_BAD, LINE_OPEN };
+
+    // 接收请求体时的状态：BODY_DATA正在接收Content-Length或者一个块的数据，BODY_CHUNK_SIZE等待块大小行，
+    // BODY_CHUNK_END等待块数据之后的\r\n，BODY_TRAILER等待最后一个块之后的trailer和空行
+    enum BODY_STATE { BODY_DATA = 0, BODY_CHUNK_SIZE, BODY_CHUNK_END, BODY_TRAILER };
 public:
-    http_conn(){}
-    ~http_conn(){}
+    // 构造函数是平凡的：连接数组放在清零的内存中，全0就是空闲连接的状态，各个成员在init()中设置，
+    // 这样启动时不必逐个写入所有下标；占用的资源在release_buffers()中归还，不依赖析构函数
 
-    // 初始化新接受的连接
-    void init(int sockfd, const sockaddr_in& addr); 
+    // 初始化新接受的连接，epollfd为接受该连接的reactor的epoll文件描述符，为-1时连接由io_uring后端驱动，不注册到epoll；
+    // closefd是该reactor的关闭请求管道的写端，工作线程要关闭连接时把文件描述符写入其中
+    void init(int sockfd, const sockaddr_in& addr, int epollfd, int closefd); 
+    // 工作线程通过关闭请求管道发给reactor的消息；文件描述符关闭后可能马上被新连接复用，
+    // reactor只在id和连接当前的id相同时才关闭
+    struct close_msg { int fd; unsigned id; };
     // 关闭连接
     void close_conn();  
     // 处理客户端请求
     void process(); 
+    // 边缘触发模式下reactor收到连接上的事件时调用，返回true表示需要把连接交给线程池，
+    // 连接正在被工作线程处理或者已经请求关闭时返回false
+    bool on_event();
+    // 单次触发模式下reactor把连接交给线程池之前调用，工作线程重新注册事件时清除
+    void on_dispatch();
+    // 连接已交给线程池或者正在被工作线程处理，这期间只有工作线程能关闭连接和释放缓冲区
+    bool busy() const;
     // 非阻塞读
     bool read();
     // 非阻塞写
     bool write();
+    // 释放连接占用的文件映射和读写缓冲区，连接被定时器关闭时由reactor调用
+    void release_buffers();
+    // 连接的超时时刻，由处理连接的线程在状态改变时计算，reactor线程用它设置定时器
+    time_t deadline() const { return m_deadline.load(std::memory_order_relaxed); }
+    unsigned conn_id() const { return m_conn_id.load(std::memory_order_relaxed); }
+    // 连接作为空闲的长连接开始等待下一个请求的时刻，不空闲或者正在被工作线程处理时为0；
+    // 连接数达到上限时reactor按它淘汰空闲最久的连接
+    time_t idle_since() const;
+
+    //下面这一组函数供io_uring后端使用：收发由后端提交给内核，解析请求和填充应答仍由同一个状态机完成
+    //把收到的数据追加到读缓冲区，返回追加的字节数，读缓冲区达到上限时少于len
+    size_t receive(const char* data,size_t len);
+    //解析读缓冲区中所有完整的请求，把应答排入发送队列，返回false表示连接需要关闭；
+    //没有应答并且读缓冲区为空时归还缓冲区
+    bool build_batch();
+    //发送队列中是否有应答
+    bool has_batch() const { return m_response_count>0; }
+    //准备下一次发送：返回0时msg中是要用flags发送的内存块，返回1时要从file_fd的offset处发送len字节，
+    //msg引用的内存块在下一次调用之前保持有效
+    int prepare_send(struct msghdr& msg,int& flags,int& file_fd,off_t& offset,size_t& len);
+    //已发送n字节，返回true表示这一批应答全部发完
+    bool sent(ssize_t n);
+    //一批应答发送完毕，清空发送队列，返回这一批最后一个请求是否要求保持连接
+    bool finish_batch();
 
 
 private:
     // 初始化连接
     void init();
+    // 一个请求解析完毕，从下一个字节开始解析下一个请求，读缓冲区中剩余的数据保留
+    void init_request();
+    // 读缓冲区的存储搬移或增长后，让已经解析出的字段指向新的位置
+    void rebase(const char* old_base);
+    // 按当前状态重新计算超时时刻，在收到数据、发出数据和连接变为空闲时调用
+    void update_deadline();
+    // 收到了n字节，记录当前请求开始接收的时刻
+    void received(size_t n);
+    // 从start开始传输了bytes字节，平均速率是否满足m_min_rate；满足时从now开始下一段计算
+    bool rate_ok(time_t now,time_t& start,int64_t& bytes);
+
+    //解析读缓冲区中所有完整的请求并直接发送应答，返回false表示连接需要关闭
+    bool process_requests();
+    //解析读缓冲区中已经完整的请求，把它们的应答排成一批，返回false表示填充应答失败
+    bool parse_batch();
+
+    //发送队列中的应答直到发完或者socket缓冲区已满，返回1表示发完，0表示需要等待EPOLLOUT，-1表示出错
+    int send_batch();
+    //重新注册EPOLLONESHOT的事件；边缘触发模式下连接一直关注读写事件，不需要修改注册
+    void rearm(int ev);
+
+    //边缘触发模式下工作线程处理一次事件：续发上一批应答，读取并处理新的请求，返回false表示连接需要关闭
+    bool serve();
+    void process_et();
+    //请求reactor线程关闭连接，关闭和删除定时器都在reactor线程完成，之后不能再访问连接
+    void request_close();
 
     //解析HTTP请求
     HTTP_CODE process_read();
@@ -84,47 +168,124 @@ private:
     HTTP_CODE parse_request_line(char * text);     //解析请求首行
     HTTP_CODE parse_headers(char * text);       //解析请求头
     HTTP_CODE parse_content(char * text);       //解析请求体
+    HTTP_CODE start_body();     //请求头收完，决定接收、丢弃还是拒绝请求体
     HTTP_CODE do_request();
-    char * get_line(){ return m_read_buf+m_start_line;}
+    //按If-None-Match、If-Modified-Since、If-Range和Range决定文件请求的应答
+    HTTP_CODE check_conditions();
+    char * get_line(){ return m_read_buf.Peek()+m_start_line;}
     LINE_STATUS parse_line();
 
+    //流水线中排队的一个应答：应答头在写缓冲区中，内容来自文件缓存(错误应答没有文件)
+    struct response
+    {
+        int head;                   //应答头在写缓冲区中的起始位置
+        int head_len;
+        const cached_file* file;    //小文件内容在file->data，大文件用sendfile从file->fd发送
+        off_t body_off;             //发送的内容在文件中的起始位置，Range请求时不为0
+        off_t body_len;
+        bool linger;                //发送完是否保持连接
+        int access;                 //访问日志记录在m_access_buf中的起始位置，不写访问日志时为-1
+        int64_t start;              //请求读完交给线程池的时刻，用于统计请求耗时
+    };
+
+    //访问日志中一个应答的信息，后面紧跟以'\0'结尾的URL，应答发送完毕时和发送耗时一起写入访问日志
+    //各阶段耗时的单位是纳秒
+    struct access_entry
+    {
+        int64_t queued;             //应答加入发送队列的时刻
+        int64_t bytes;
+        int64_t accept_ns;          //accept到读到第一个字节，不是连接上的第一个请求时为-1
+        int64_t queue_ns;           //在线程池队列中等待
+        int64_t parse_ns;           //解析请求
+        int64_t lookup_ns;          //do_request查找文件
+        int status;
+        int method;                 //请求行没有解析出URL时为-1
+        bool linger;
+    };
+
+    //记录当前请求的访问日志信息，返回在m_access_buf中的位置
+    int add_access(int64_t now,off_t bytes);
+    //应答r在now时刻发送完毕，写一条访问日志
+    void log_access(const response& r,int64_t now);
+    //把当前请求的应答加入发送队列，应答头已经填充在写缓冲区从head开始的末尾部分，
+    //内容是file中从offset开始的len字节
+    void queue_response(int head,const cached_file* file,off_t offset,off_t len);
+
+    //发送一次数据：连续的应答头和内存中的文件内容合并成一次sendmsg，遇到大文件时它的应答头带MSG_MORE，
+    //随后由sendfile直接从文件发送内容
+    ssize_t send_once();
+
+    //已发送temp字节，推进发送进度并归还已发送完的文件
+    void advance(ssize_t temp);
+
     //下面这一组函数被process_write调用以填充HTTP应答
     void unmap();
-    bool add_response(const char* format,...);
-    bool add_content(const char* content);
-    bool add_content_type();
-    bool add_status_line(int status,const char* title);
-    bool add_headers(int content_length);
-    bool add_content_length(int content_length);
-    bool add_linger();
-    bool add_blank_line();
-
-    //所有socket上的事件都被注册到同一个epoll内核事件表中，所以epoll文件描述符设置为静态的
+    bool add_bytes(const char* data,size_t len);
+    bool add_bytes(const std::string& block);
+    bool add_date();
+    bool add_error(int status);
+    //统计应答：运行时指标按Prometheus文本格式作为内容，整个应答都在写缓冲区中
+    bool add_stats();
+    //m_file的条件请求和Range请求的应答：304、416和多区间的206整个在写缓冲区中
+    bool add_not_modified();
+    bool add_range_error();
+    bool add_content_range(off_t first,off_t last);
+    bool add_multipart();
+    //上传成功的应答：201或者204，没有内容
+    bool add_upload();
+    //请求带Expect: 100-continue时直接发送100应答
+    void send_continue();
+
+    //写访问日志时使用的单调时钟，单位纳秒
+    static int64_t now_ns();
+
 public:
-    static int m_epollfd;      
-    static int m_user_count;    // 统计用户的数量
+    static std::atomic<int> m_user_count;    // 统计用户的数量，reactor线程增加，工作线程和定时器回调减少
+    static size_t m_max_request_size;   // 读缓冲区的上限，请求头(和请求体)超过它时返回431(413)并关闭连接
+    static bool m_access_log;   // 是否写访问日志(Log::Access())，关闭时不读取各阶段的时钟
+    static const char* m_stats_url;     // 应答运行时指标的保留URL，NULL表示不提供
+    static const char* m_doc_root;      // 网站的根目录，不以'/'结尾
+    static bool m_edge_triggered;   // 连接用边缘触发且不带EPOLLONESHOT注册，同一连接同时只由一个工作线程处理
+    static int m_max_connections;   // 连接数上限，达到时先淘汰空闲最久的长连接，没有空闲连接才拒绝新连接
+    static int m_max_requests;      // 每个连接最多处理的请求数，最后一个应答带Connection: close，0表示不限
+    static int m_keepalive_timeout; // 空闲长连接的超时(秒)，传输中每次有进展也延长这么久
+    static int m_header_timeout;    // 从收到请求的第一个字节到请求头收完的最长时间(秒)，新连接也要在这之内发来请求
+    static int m_min_rate;          // 传输请求体和应答的最低平均速率(字节/秒)，开始传输m_header_timeout秒后检查，0表示不限
+    static int64_t m_max_body_size; // 请求体的上限，超过时返回413并关闭连接
+    static body_handler* (*m_new_body_handler)();   // 为连接创建请求体的接收者，NULL表示不接受POST和PUT
 private:
+    //连接的调度状态，单次触发模式下只用到SCHED_QUEUED
+    enum { SCHED_QUEUED = 1,    //已交给线程池，或者正在被工作线程处理
+           SCHED_AGAIN = 2,     //处理期间又收到了事件
+           SCHED_CLOSING = 4 }; //工作线程已经请求关闭连接，同时保留SCHED_QUEUED直到reactor关闭连接
+
+    //连接所属reactor的epoll文件描述符，连接的事件始终注册在这个epoll内核事件表中
+    int m_epollfd;
+    //所属reactor的关闭请求管道的写端
+    int m_closefd;
+    //每次init()加1，区分先后使用同一个下标的连接，见close_msg
+    std::atomic<unsigned> m_conn_id;
+    //调度状态，SCHED_*的组合
+    std::atomic<int> m_sched;
+
     // 该HTTP连接的socket和对方的socket地址
     int m_sockfd;           
     sockaddr_in m_address;
 
-    //读缓冲区
-    char m_read_buf[READ_BUFFER_SIZE];
-
-    //标识读缓冲区中以及读入的客户端数据的最后一个字节的下一个位置
-    int m_read_idx;    
+    //读缓冲区，收到数据时才从缓冲区池取得，读缓冲区中的请求都处理完毕后归还，空闲连接不占用
+    //Peek()指向当前正在解析的请求的起始位置，之前的请求已经处理完并取走
+    Buffer m_read_buf;
+    //读缓冲区达到上限时socket中可能还有数据，边缘触发模式下处理完后要主动再读
+    bool m_read_capped;
 
-    //当前正在分析的字符在读缓冲区位置
+    //当前正在分析的字符相对于当前请求起始位置的偏移
     int m_checked_index;
 
-    //当前正在解析的行的起始位置
+    //当前正在解析的行相对于当前请求起始位置的偏移
     int m_start_line; 
 
-    //写缓冲区
-    char m_write_buf[WRITE_BUFFER_SIZE];
-
-    //写缓冲区中待发送的字节数
-    int m_write_idx;          
+    //写缓冲区，填充应答时才从缓冲区池取得，一批应答发送完毕后归还
+    Buffer m_write_buf;
 
     //主状态机当前所处的状态
     CHECK_STATE m_check_state;      
@@ -133,7 +294,7 @@ private:
     METHOD m_method;
 
     //客户请求的目标文件的完整路径，doc_root+m_url
-    char m_real_file[FILENAME_MAX];
+    char m_real_file[FILENAME_LEN];
 
     //请求目标文件文件名
     char * m_url;
@@ -144,27 +305,83 @@ private:
     //主机名
     char * m_host;
 
-    //HTTP请求的消息体的长度
-    int m_content_length;
+    //HTTP请求的消息体的长度，分块传输时为-1
+    int64_t m_content_length;
+    //Transfer-Encoding是chunked；是其它不支持的传输编码；请求带Expect: 100-continue
+    bool m_chunked;
+    bool m_bad_coding;
+    bool m_expect_continue;
+
+    //接收请求体的状态，当前块(或者整个Content-Length请求体)还没有收到的字节数，以及分块传输时已收到的总字节数
+    BODY_STATE m_body_state;
+    int64_t m_body_left;
+    int64_t m_body_size;
+    //请求体的接收者，连接第一次上传时创建；m_body_active表示它正在接收当前请求的请求体
+    body_handler* m_body;
+    bool m_body_active;
+    //上传请求的应答状态码
+    int m_body_status;
 
     //HTTP请求是否要保持连接
     bool m_linger;
 
-    //客户请求的目标文件被mmap到内存中的起始位置
-    char* m_file_address;
+    //条件请求和Range请求的头部，不存在时为NULL；If-Modified-Since解析成时间，不存在或无法解析时为-1
+    char* m_if_none_match;
+    time_t m_if_modified_since;
+    char* m_range;
+    char* m_if_range;
+
+    //check_conditions解析出的Range区间
+    http_parser::byte_range m_ranges[MAX_RANGES];
+    int m_range_count;
+
+    //Accept-Encoding中客户端接受的内容编码，第i位对应http_parser::ENCODING i
+    unsigned m_accept_encoding;
+
+    //从文件缓存取得的目标文件，加入发送队列后由队列持有
+    const cached_file* m_file;
+
+    //发送队列，一批流水线请求的应答按请求的顺序连续发送
+    response m_responses[MAX_PIPELINE];
+    int m_response_count;
+
+    //正在发送的应答在队列中的下标
+    int m_response_sent;
+
+    //sendmsg使用的内存块，每个应答最多两块(应答头和文件内容)
+    struct iovec m_iv[2*MAX_PIPELINE];
+
+    //队列中待发送的总字节数，以及正在发送的应答已发送的字节数，EAGAIN后据此续传
+    ssize_t bytes_to_send;
+    ssize_t bytes_have_send;
 
-    //目标文件的状态，通过它我们可以判断文件是否存在、是否为目录、是否可读，并获取文件大小等信息
-    struct stat m_file_stat;
+    //当前请求的应答状态码
+    int m_status;
 
-    //采用writev来执行写操作
-    //被写内存块
-    struct iovec m_iv[2];
+    //超时时刻和开始空闲的时刻，见deadline()和idle_since()
+    std::atomic<time_t> m_deadline;
+    std::atomic<time_t> m_idle_since;
+    //连接上已经解析的请求数
+    int m_requests;
+    //当前请求收到第一个字节的时刻(没有未处理完的请求时为0)和从那时起收到的字节数，
+    //接收请求体时是当前计速段的开始时刻和这一段收到的字节数
+    time_t m_request_start;
+    int64_t m_recv_bytes;
+    //发送当前这批应答的计速段的开始时刻和这一段发出的字节数
+    time_t m_send_start;
+    int64_t m_send_bytes;
 
-    //被写内存块数量
-    int m_iv_count;
+    //访问日志的各个时刻，只在m_access_log为true时记录
+    int64_t m_t_accept;         //连接被accept
+    int64_t m_t_first_read;     //连接上第一次读到数据，写过第一个请求的访问日志后为-1
+    int64_t m_t_queued;         //读完数据交给线程池，统计请求耗时时总是记录
+    int64_t m_t_dequeued;       //工作线程开始处理
+    int64_t m_t_parse;          //开始解析当前请求
+    int64_t m_t_lookup_start;   //do_request的开始和结束
+    int64_t m_t_lookup_end;
 
-    int bytes_to_send;
-    int bytes_have_send;
+    //一批应答的访问日志信息，和写缓冲区一起在一批应答发送完毕后清空
+    Buffer m_access_buf;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,385 @@
+#include "http_parser.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_PARSER_X86
+#endif
+
+//未调用init之前使用逐字节扫描
+http_parser::ISA http_parser::m_isa = http_parser::ISA_SCALAR;
+http_parser::find_func http_parser::m_find = http_parser::find_scalar;
+
+const char *http_parser::m_names[HEADER_NUMBER] = {
+    "",
+    "Accept",
+    "Accept-Encoding",
+    "Accept-Language",
+    "Cache-Control",
+    "Connection",
+    "Content-Length",
+    "Content-Type",
+    "Cookie",
+    "Expect",
+    "Host",
+    "If-Modified-Since",
+    "If-None-Match",
+    "If-Range",
+    "Origin",
+    "Pragma",
+    "Range",
+    "Referer",
+    "Transfer-Encoding",
+    "Upgrade",
+    "User-Agent",
+};
+
+unsigned char http_parser::m_lengths[HEADER_NUMBER];
+unsigned char http_parser::m_table[HASH_SIZE];
+
+void http_parser::init(ISA max_isa)
+{
+    m_isa = ISA_SCALAR;
+    m_find = find_scalar;
+#ifdef HTTP_PARSER_X86
+    __builtin_cpu_init();
+    if (max_isa >= ISA_AVX2 && __builtin_cpu_supports("avx2"))
+    {
+        m_isa = ISA_AVX2;
+        m_find = find_avx2;
+    }
+    else if (max_isa >= ISA_SSE42 && __builtin_cpu_supports("sse4.2"))
+    {
+        m_isa = ISA_SSE42;
+        m_find = find_sse42;
+    }
+#endif
+
+    memset(m_table, HEADER_UNKNOWN, sizeof(m_table));
+    for (int i = 1; i < HEADER_NUMBER; ++i)
+    {
+        m_lengths[i] = strlen(m_names[i]);
+        unsigned h = hash(m_names[i], m_lengths[i]);
+        //增加头部时如果出现冲突，需要重新选择哈希函数的系数
+        assert(m_table[h] == HEADER_UNKNOWN);
+        m_table[h] = i;
+    }
+}
+
+const char *http_parser::isa_name(ISA isa)
+{
+    switch (isa)
+    {
+    case ISA_AVX2:
+        return "avx2";
+    case ISA_SSE42:
+        return "sse4.2";
+    default:
+        return "scalar";
+    }
+}
+
+unsigned http_parser::hash(const char *name, size_t len)
+{
+    //头部名只含字母、数字和'-'，或上0x20即可统一成小写
+    return ((name[0] | 0x20) + (name[len - 1] | 0x20) + 24 * len) % HASH_SIZE;
+}
+
+http_parser::HEADER http_parser::header_id(const char *name, size_t len)
+{
+    if (len == 0)
+    {
+        return HEADER_UNKNOWN;
+    }
+    int id = m_table[hash(name, len)];
+    if (id == HEADER_UNKNOWN || m_lengths[id] != len || strncasecmp(name, m_names[id], len) != 0)
+    {
+        return HEADER_UNKNOWN;
+    }
+    return (HEADER)id;
+}
+
+const char *http_parser::header_name(HEADER id)
+{
+    return m_names[id];
+}
+
+const char *http_parser::encoding_name(ENCODING e)
+{
+    static const char *const names[ENCODING_NUMBER] = {"identity", "br", "zstd", "gzip", "deflate"};
+    return names[e];
+}
+
+unsigned http_parser::accept_encoding(const char *value)
+{
+    unsigned accepted = 0;
+    const char *p = value;
+    while (*p)
+    {
+        //一个编码项：名称[;q=权重]，项之间用逗号分隔
+        p += strspn(p, " \t,");
+        const char *name = p;
+        p += strcspn(p, " \t,;");
+        size_t len = p - name;
+        bool zero = false;
+        while (*p && *p != ',')
+        {
+            if (*p == ';')
+            {
+                p += strspn(p + 1, " \t") + 1;
+                if ((*p == 'q' || *p == 'Q') && p[1] == '=')
+                {
+                    //q=0、q=0.0、q=0.000都表示不接受
+                    p += 2;
+                    zero = *p == '0';
+                    const char *digits = p + (*p == '0');
+                    if (zero && *digits == '.')
+                    {
+                        ++digits;
+                        digits += strspn(digits, "0");
+                    }
+                    zero = zero && (*digits == '\0' || strchr(" \t,;", *digits));
+                    continue;
+                }
+            }
+            ++p;
+        }
+        if (len == 0 || zero)
+        {
+            continue;
+        }
+        if (len == 1 && name[0] == '*')
+        {
+            accepted |= ((1u << ENCODING_NUMBER) - 1) & ~(1u << ENCODING_IDENTITY);
+        }
+        else if ((len == 4 && strncasecmp(name, "gzip", 4) == 0) || (len == 6 && strncasecmp(name, "x-gzip", 6) == 0))
+        {
+            accepted |= 1u << ENCODING_GZIP;
+        }
+        else if (len == 7 && strncasecmp(name, "deflate", 7) == 0)
+        {
+            accepted |= 1u << ENCODING_DEFLATE;
+        }
+        else if (len == 2 && strncasecmp(name, "br", 2) == 0)
+        {
+            accepted |= 1u << ENCODING_BR;
+        }
+        else if (len == 4 && strncasecmp(name, "zstd", 4) == 0)
+        {
+            accepted |= 1u << ENCODING_ZSTD;
+        }
+    }
+    return accepted;
+}
+
+time_t http_parser::parse_date(const char *value)
+{
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(value, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!end)
+    {
+        return -1;
+    }
+    return timegm(&tm);
+}
+
+bool http_parser::etag_match(const char *list, const char *etag, size_t len, bool weak)
+{
+    const char *p = list;
+    while (*p)
+    {
+        p += strspn(p, " \t,");
+        if (*p == '*')
+        {
+            return true;
+        }
+        bool is_weak = false;
+        if ((p[0] == 'W' || p[0] == 'w') && p[1] == '/')
+        {
+            is_weak = true;
+            p += 2;
+        }
+        if (*p != '"')
+        {
+            //不是实体标签，跳到下一项
+            p += strcspn(p, ",");
+            continue;
+        }
+        const char *close = strchr(p + 1, '"');
+        if (!close)
+        {
+            return false;
+        }
+        size_t n = close + 1 - p;
+        if ((weak || !is_weak) && n == len && memcmp(p, etag, len) == 0)
+        {
+            return true;
+        }
+        p = close + 1;
+    }
+    return false;
+}
+
+//读取一个非负十进制数，没有数字或者溢出时返回-1
+static off_t parse_offset(const char *&p)
+{
+    if (!isdigit((unsigned char)*p))
+    {
+        return -1;
+    }
+    off_t v = 0;
+    for (; isdigit((unsigned char)*p); ++p)
+    {
+        if (v > (off_t)((~0ull >> 1) - 9) / 10)
+        {
+            return -1;
+        }
+        v = v * 10 + (*p - '0');
+    }
+    return v;
+}
+
+int http_parser::parse_range(const char *value, off_t size, byte_range *ranges, int max)
+{
+    if (strncasecmp(value, "bytes=", 6) != 0)
+    {
+        return -1;
+    }
+    const char *p = value + 6;
+    int count = 0;
+    int specs = 0;
+    while (true)
+    {
+        p += strspn(p, " \t");
+        if (*p == '\0')
+        {
+            break;
+        }
+        if (*p == ',')
+        {
+            ++p;
+            continue;
+        }
+        if (++specs > max)
+        {
+            return -1;
+        }
+        off_t first, last;
+        if (*p == '-')
+        {
+            //后缀区间：最后n个字节
+            ++p;
+            off_t n = parse_offset(p);
+            if (n < 0)
+            {
+                return -1;
+            }
+            first = n >= size ? 0 : size - n;
+            last = n == 0 ? -1 : size - 1;
+        }
+        else
+        {
+            first = parse_offset(p);
+            if (first < 0 || *p++ != '-')
+            {
+                return -1;
+            }
+            p += strspn(p, " \t");
+            if (isdigit((unsigned char)*p))
+            {
+                last = parse_offset(p);
+                if (last < first)
+                {
+                    return -1;
+                }
+            }
+            else
+            {
+                last = size - 1;
+            }
+            if (last > size - 1)
+            {
+                last = size - 1;
+            }
+        }
+        p += strspn(p, " \t");
+        if (*p != ',' && *p != '\0')
+        {
+            return -1;
+        }
+        if (first < size && first <= last)
+        {
+            ranges[count].first = first;
+            ranges[count].last = last;
+            ++count;
+        }
+    }
+    return specs == 0 ? -1 : count;
+}
+
+const char *http_parser::find_scalar(const char *begin, const char *end, char a, char b)
+{
+    for (; begin < end; ++begin)
+    {
+        if (*begin == a || *begin == b)
+        {
+            break;
+        }
+    }
+    return begin;
+}
+
+#ifdef HTTP_PARSER_X86
+//用pcmpestri一次比较16个字节是否等于a或b，剩余不足16字节的部分逐字节扫描
+__attribute__((target("sse4.2")))
+const char *http_parser::find_sse42(const char *begin, const char *end, char a, char b)
+{
+    const __m128i set = _mm_setr_epi8(a, b, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    while (end - begin >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)begin);
+        int idx = _mm_cmpestri(set, 2, chunk, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if (idx != 16)
+        {
+            return begin + idx;
+        }
+        begin += 16;
+    }
+    return find_scalar(begin, end, a, b);
+}
+
+//一次比较32个字节，两个比较结果合并后由最低的置位得到位置
+__attribute__((target("avx2")))
+const char *http_parser::find_avx2(const char *begin, const char *end, char a, char b)
+{
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    while (end - begin >= 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)begin);
+        __m256i eq = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, va), _mm256_cmpeq_epi8(chunk, vb));
+        unsigned mask = _mm256_movemask_epi8(eq);
+        if (mask)
+        {
+            return begin + __builtin_ctz(mask);
+        }
+        begin += 32;
+    }
+    return find_sse42(begin, end, a, b);
+}
+#else
+//非x86平台只有逐字节扫描
+const char *http_parser::find_sse42(const char *begin, const char *end, char a, char b)
+{
+    return find_scalar(begin, end, a, b);
+}
+
+const char *http_parser::find_avx2(const char *begin, const char *end, char a, char b)
+{
+    return find_scalar(begin, end, a, b);
+}
+#endif
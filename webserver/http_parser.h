@@ -0,0 +1,125 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+//HTTP请求解析用到的扫描和头部分类函数
+//行结束符和头部分隔符的查找按CPU支持的指令集一次比较16(SSE4.2)或32(AVX2)个字节，
+//不支持时退回逐字节扫描，实现在init时根据__builtin_cpu_supports选定；
+//已知头部名按长度和首尾字符做完美哈希，分类时只需一次比较
+class http_parser
+{
+public:
+    //解析器关心的头部，HEADER_UNKNOWN表示其他头部
+    enum HEADER
+    {
+        HEADER_UNKNOWN = 0,
+        HEADER_ACCEPT,
+        HEADER_ACCEPT_ENCODING,
+        HEADER_ACCEPT_LANGUAGE,
+        HEADER_CACHE_CONTROL,
+        HEADER_CONNECTION,
+        HEADER_CONTENT_LENGTH,
+        HEADER_CONTENT_TYPE,
+        HEADER_COOKIE,
+        HEADER_EXPECT,
+        HEADER_HOST,
+        HEADER_IF_MODIFIED_SINCE,
+        HEADER_IF_NONE_MATCH,
+        HEADER_IF_RANGE,
+        HEADER_ORIGIN,
+        HEADER_PRAGMA,
+        HEADER_RANGE,
+        HEADER_REFERER,
+        HEADER_TRANSFER_ENCODING,
+        HEADER_UPGRADE,
+        HEADER_USER_AGENT,
+        HEADER_NUMBER
+    };
+
+    //内容编码，按服务器的偏好从高到低排列，协商时选客户端接受的第一个可用编码
+    enum ENCODING
+    {
+        ENCODING_IDENTITY = 0,
+        ENCODING_BR,
+        ENCODING_ZSTD,
+        ENCODING_GZIP,
+        ENCODING_DEFLATE,
+        ENCODING_NUMBER
+    };
+
+    //Range中的一个字节区间[first, last]
+    struct byte_range
+    {
+        off_t first;
+        off_t last;
+    };
+
+    //扫描使用的指令集
+    enum ISA { ISA_SCALAR = 0, ISA_SSE42, ISA_AVX2 };
+
+    //选定扫描实现并建立头部哈希表，必须在解析请求之前调用一次
+    //max_isa限制可以使用的最高指令集，基准测试用它比较不同实现
+    static void init(ISA max_isa = ISA_AVX2);
+
+    //当前使用的指令集
+    static ISA isa() { return m_isa; }
+    static const char *isa_name(ISA isa);
+
+    //返回[begin, end)中第一个'\r'或'\n'的位置，没有时返回end
+    static const char *find_line_end(const char *begin, const char *end)
+    {
+        return m_find(begin, end, '\r', '\n');
+    }
+
+    //返回[begin, end)中第一个c的位置，没有时返回end
+    static const char *find_char(const char *begin, const char *end, char c)
+    {
+        return m_find(begin, end, c, c);
+    }
+
+    //按头部名(不含冒号，不区分大小写)分类
+    static HEADER header_id(const char *name, size_t len);
+
+    //头部的规范名称
+    static const char *header_name(HEADER id);
+
+    //解析Accept-Encoding的值，返回客户端接受(q不为0)的编码集合，第i位对应ENCODING i
+    //"*"表示接受所有编码，不认识的编码忽略；不检查identity，总是可以退回原文件
+    static unsigned accept_encoding(const char *value);
+
+    //内容编码在Content-Encoding中的名称
+    static const char *encoding_name(ENCODING e);
+
+    //解析If-Modified-Since等头部中的HTTP日期(IMF-fixdate格式)，无法解析时返回-1
+    static time_t parse_date(const char *value);
+
+    //If-None-Match、If-Range中的实体标签列表是否包含etag(带引号)，"*"匹配任何标签
+    //weak为true时按弱比较忽略W/前缀，否则弱标签不匹配
+    static bool etag_match(const char *list, const char *etag, size_t len, bool weak);
+
+    //解析Range的值，size是文件大小，可满足的区间按出现顺序写入ranges(最后一个字节截断到文件末尾)
+    //返回可满足的区间个数，0表示都不可满足(416)；格式错误、单位不是bytes或者区间多于max个时返回-1，这时忽略Range
+    static int parse_range(const char *value, off_t size, byte_range *ranges, int max);
+
+private:
+    typedef const char *(*find_func)(const char *begin, const char *end, char a, char b);
+
+    static const char *find_scalar(const char *begin, const char *end, char a, char b);
+    static const char *find_sse42(const char *begin, const char *end, char a, char b);
+    static const char *find_avx2(const char *begin, const char *end, char a, char b);
+
+    //哈希表大小，(首字符 + 尾字符 + 24 * 长度) % 64 对所有已知头部名无冲突
+    static const int HASH_SIZE = 64;
+    static unsigned hash(const char *name, size_t len);
+
+    static ISA m_isa;
+    static find_func m_find;
+    static const char *m_names[HEADER_NUMBER];
+    static unsigned char m_lengths[HEADER_NUMBER];
+    static unsigned char m_table[HASH_SIZE];
+};
+
+#endif
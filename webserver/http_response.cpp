@@ -0,0 +1,147 @@
+#include "http_response.h"
+#include <string.h>
+#include <time.h>
+
+//定义HTTP响应的一些状态信息
+http_response::status_block http_response::m_blocks[] = {
+    {200, "OK", NULL},
+    {201, "Created", NULL},
+    {204, "No Content", NULL},
+    {206, "Partial Content", NULL},
+    {304, "Not Modified", NULL},
+    {400, "Bad Request", "Your request has bad syntax or is inherently impossible to satisfy.\n"},
+    {403, "Forbidden", "You do not have permission to get file from this server.\n"},
+    {404, "Not Found", "The requested file was not found on this server.\n"},
+    {405, "Method Not Allowed", "The requested method is not allowed for this URL.\n"},
+    {409, "Conflict", "The request conflicts with the current state of the target file.\n"},
+    {413, "Payload Too Large", "The request body is larger than the server is willing to process.\n"},
+    {416, "Range Not Satisfiable", "None of the requested ranges overlap the file.\n"},
+    {431, "Request Header Fields Too Large", "The request header fields are larger than the server is willing to process.\n"},
+    {500, "Internal Error", "There was an unusual problem serving the requested file.\n"},
+    {501, "Not Implemented", "The transfer coding of the request is not supported.\n"},
+};
+
+std::string http_response::m_connection[2];
+
+const int http_response::BLOCK_NUMBER = sizeof(m_blocks) / sizeof(m_blocks[0]);
+
+void http_response::init()
+{
+    m_connection[0] = "Connection: close\r\n\r\n";
+    m_connection[1] = "Connection: Keep-alive\r\n\r\n";
+
+    char num[UINT_LEN];
+    for (int i = 0; i < BLOCK_NUMBER; ++i)
+    {
+        status_block &b = m_blocks[i];
+        b.line = "HTTP/1.1 ";
+        b.line.append(num, write_uint(num, b.status));
+        b.line += " ";
+        b.line += b.title;
+        b.line += "\r\n";
+        if (!b.form)
+        {
+            continue;
+        }
+        b.head = b.line;
+        b.head += "Content-Length:";
+        b.head.append(num, write_uint(num, strlen(b.form)));
+        b.head += "\r\nContent-Type:text/html\r\n";
+        for (int k = 0; k < 2; ++k)
+        {
+            b.tail[k] = m_connection[k] + b.form;
+        }
+    }
+}
+
+http_response::status_block &http_response::block(int status)
+{
+    for (int i = 0; i < BLOCK_NUMBER; ++i)
+    {
+        if (m_blocks[i].status == status)
+        {
+            return m_blocks[i];
+        }
+    }
+    //未知状态按500处理
+    return block(500);
+}
+
+const std::string &http_response::status_line(int status)
+{
+    return block(status).line;
+}
+
+const std::string &http_response::error_head(int status)
+{
+    return block(status).head;
+}
+
+const std::string &http_response::error_tail(int status, bool keep_alive)
+{
+    return block(status).tail[keep_alive];
+}
+
+const std::string &http_response::connection(bool keep_alive)
+{
+    return m_connection[keep_alive];
+}
+
+size_t http_response::write_date(char *buf)
+{
+    static thread_local time_t t_date_sec = 0;
+    static thread_local char t_date[DATE_LEN + 1];
+
+    time_t now = time(NULL);
+    if (now != t_date_sec)
+    {
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        strftime(t_date, sizeof(t_date), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+        t_date_sec = now;
+    }
+    memcpy(buf, t_date, DATE_LEN);
+    return DATE_LEN;
+}
+
+size_t http_response::write_http_date(char *buf, time_t t)
+{
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char tmp[HTTP_DATE_LEN + 1];
+    strftime(tmp, sizeof(tmp), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    memcpy(buf, tmp, HTTP_DATE_LEN);
+    return HTTP_DATE_LEN;
+}
+
+size_t http_response::write_uint(char *buf, unsigned long v)
+{
+    static const char digits[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+
+    //从低位开始每次转换两位，写到临时缓冲区的末尾
+    char tmp[UINT_LEN];
+    char *p = tmp + UINT_LEN;
+    while (v >= 100)
+    {
+        unsigned idx = (v % 100) * 2;
+        v /= 100;
+        *--p = digits[idx + 1];
+        *--p = digits[idx];
+    }
+    if (v >= 10)
+    {
+        unsigned idx = v * 2;
+        *--p = digits[idx + 1];
+        *--p = digits[idx];
+    }
+    else
+    {
+        *--p = '0' + v;
+    }
+    size_t len = tmp + UINT_LEN - p;
+    memcpy(buf, p, len);
+    return len;
+}
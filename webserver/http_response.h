@@ -0,0 +1,65 @@
+#ifndef HTTP_RESPONSE_H
+#define HTTP_RESPONSE_H
+
+#include <stddef.h>
+#include <time.h>
+#include <string>
+
+//预先渲染的HTTP应答块
+//状态行、固定头部和错误页面在启动时渲染一次，之后只读；
+//填充应答时只需memcpy这些块，再拼接每秒缓存一次的Date头部和整数格式化的Content-Length
+class http_response
+{
+public:
+    //渲染所有固定的应答块，必须在处理请求之前调用一次
+    static void init();
+
+    //状态行，如"HTTP/1.1 200 OK\r\n"
+    static const std::string &status_line(int status);
+
+    //错误应答中Date之前的部分：状态行、Content-Length和Content-Type
+    static const std::string &error_head(int status);
+
+    //错误应答中Date之后的部分：Connection头部、空行和错误页面
+    static const std::string &error_tail(int status, bool keep_alive);
+
+    //Connection头部和结束头部的空行
+    static const std::string &connection(bool keep_alive);
+
+    //Date头部"Date: Sun, 18 Oct 2026 06:12:00 GMT\r\n"的长度
+    static const size_t DATE_LEN = 37;
+
+    //把当前秒的Date头部复制到buf，每个线程每秒只格式化一次，返回DATE_LEN
+    static size_t write_date(char *buf);
+
+    //HTTP日期"Sun, 18 Oct 2026 06:12:00 GMT"的长度
+    static const size_t HTTP_DATE_LEN = 29;
+
+    //把t格式化成HTTP日期写到buf，不写结尾的'\0'，返回HTTP_DATE_LEN；用于Last-Modified等头部
+    static size_t write_http_date(char *buf, time_t t);
+
+    //无符号整数转十进制的最大长度
+    static const size_t UINT_LEN = 20;
+
+    //把v的十进制表示写到buf，不写结尾的'\0'，返回写入的字节数
+    static size_t write_uint(char *buf, unsigned long v);
+
+private:
+    struct status_block
+    {
+        int status;
+        const char *title;
+        const char *form;
+        std::string line;
+        std::string head;
+        std::string tail[2];
+    };
+
+    static status_block &block(int status);
+
+    static status_block m_blocks[];
+    static const int BLOCK_NUMBER;
+    static std::string m_connection[2];
+};
+
+#endif
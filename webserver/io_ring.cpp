@@ -0,0 +1,266 @@
+#include "io_ring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+io_ring::io_ring()
+    : m_fd(-1), m_sq_head(NULL), m_sq_tail(NULL), m_sq_mask(0), m_sq_entries(0), m_sqes(NULL), m_sqe_head(0),
+      m_sqe_tail(0), m_cq_head(NULL), m_cq_tail(NULL), m_cq_mask(0), m_cqes(NULL), m_sq_ring(MAP_FAILED),
+      m_cq_ring(MAP_FAILED), m_sq_ring_size(0), m_cq_ring_size(0), m_sqes_size(0), m_buf_ring(NULL),
+      m_buf_ring_size(0), m_bufs(NULL), m_buf_count(0), m_buf_size(0), m_buf_tail(0), m_bgid(-1)
+{
+}
+
+io_ring::~io_ring()
+{
+    if (m_buf_ring)
+    {
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.bgid = m_bgid;
+        sys_io_uring_register(m_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        munmap(m_buf_ring, m_buf_ring_size);
+        free(m_bufs);
+    }
+    if (m_sqes)
+    {
+        munmap(m_sqes, m_sqes_size);
+    }
+    if (m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring)
+    {
+        munmap(m_cq_ring, m_cq_ring_size);
+    }
+    if (m_sq_ring != MAP_FAILED)
+    {
+        munmap(m_sq_ring, m_sq_ring_size);
+    }
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+    }
+}
+
+bool io_ring::init(unsigned entries, unsigned cq_factor, unsigned flags)
+{
+    struct io_uring_params p;
+    while (true)
+    {
+        memset(&p, 0, sizeof(p));
+        p.flags = flags | IORING_SETUP_CQSIZE;
+        p.cq_entries = entries * cq_factor;
+        m_fd = sys_io_uring_setup(entries, &p);
+        if (m_fd >= 0 || errno != EINVAL || flags == 0)
+        {
+            break;
+        }
+        //较老的内核不认识新的标志，去掉最高的一个再试
+        unsigned top = 1u << (31 - __builtin_clz(flags));
+        flags &= ~top;
+    }
+    if (m_fd < 0)
+    {
+        return false;
+    }
+
+    m_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        //两个队列在同一块映射中
+        if (m_cq_ring_size > m_sq_ring_size)
+        {
+            m_sq_ring_size = m_cq_ring_size;
+        }
+        m_cq_ring_size = m_sq_ring_size;
+    }
+    m_sq_ring = mmap(NULL, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd,
+                     IORING_OFF_SQ_RING);
+    if (m_sq_ring == MAP_FAILED)
+    {
+        return false;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        m_cq_ring = m_sq_ring;
+    }
+    else
+    {
+        m_cq_ring = mmap(NULL, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd,
+                         IORING_OFF_CQ_RING);
+        if (m_cq_ring == MAP_FAILED)
+        {
+            return false;
+        }
+    }
+    m_sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(NULL, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        return false;
+    }
+    m_sqes = (struct io_uring_sqe *)sqes;
+
+    char *sq = (char *)m_sq_ring;
+    m_sq_head = (unsigned *)(sq + p.sq_off.head);
+    m_sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    m_sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    m_sq_entries = *(unsigned *)(sq + p.sq_off.ring_entries);
+    //提交项总是按顺序使用，下标数组固定为恒等映射
+    unsigned *array = (unsigned *)(sq + p.sq_off.array);
+    for (unsigned i = 0; i < m_sq_entries; ++i)
+    {
+        array[i] = i;
+    }
+    m_sqe_head = m_sqe_tail = *m_sq_tail;
+
+    char *cq = (char *)m_cq_ring;
+    m_cq_head = (unsigned *)(cq + p.cq_off.head);
+    m_cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    m_cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    m_cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return true;
+}
+
+bool io_ring::setup_buffers(int bgid, unsigned count, unsigned size)
+{
+    //环本身按页对齐，内核直接映射这块内存
+    m_buf_ring_size = count * sizeof(struct io_uring_buf);
+    void *ring = mmap(NULL, m_buf_ring_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (ring == MAP_FAILED)
+    {
+        return false;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring;
+    reg.ring_entries = count;
+    reg.bgid = bgid;
+    if (sys_io_uring_register(m_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        int save_errno = errno;
+        munmap(ring, m_buf_ring_size);
+        errno = save_errno;
+        return false;
+    }
+    if (posix_memalign((void **)&m_bufs, 4096, (size_t)count * size) != 0)
+    {
+        sys_io_uring_register(m_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        munmap(ring, m_buf_ring_size);
+        errno = ENOMEM;
+        return false;
+    }
+    m_buf_ring = (struct io_uring_buf_ring *)ring;
+    m_buf_count = count;
+    m_buf_size = size;
+    m_buf_tail = 0;
+    m_bgid = bgid;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        recycle_buffer(i);
+    }
+    publish_buffers();
+    return true;
+}
+
+void io_ring::recycle_buffer(unsigned bid)
+{
+    //不使用bufs成员：内核头文件用空结构体声明柔性数组，C++中空结构体占1字节，bufs的偏移会错成8
+    struct io_uring_buf *buf = (struct io_uring_buf *)m_buf_ring + (m_buf_tail & (m_buf_count - 1));
+    buf->addr = (uint64_t)(uintptr_t)buffer(bid);
+    buf->len = m_buf_size;
+    buf->bid = bid;
+    ++m_buf_tail;
+}
+
+void io_ring::publish_buffers()
+{
+    __atomic_store_n(&m_buf_ring->tail, m_buf_tail, __ATOMIC_RELEASE);
+}
+
+unsigned io_ring::sq_space() const
+{
+    return m_sq_entries - (m_sqe_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE));
+}
+
+struct io_uring_sqe *io_ring::get_sqe()
+{
+    if (sq_space() == 0)
+    {
+        return NULL;
+    }
+    struct io_uring_sqe *sqe = &m_sqes[m_sqe_tail & m_sq_mask];
+    ++m_sqe_tail;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int io_ring::submit_and_wait(unsigned wait_nr)
+{
+    unsigned to_submit = m_sqe_tail - m_sqe_head;
+    if (to_submit)
+    {
+        //提交项的内容必须在内核看到新的tail之前写完
+        __atomic_store_n(m_sq_tail, m_sqe_tail, __ATOMIC_RELEASE);
+        m_sqe_head = m_sqe_tail;
+    }
+    if (to_submit == 0 && wait_nr == 0)
+    {
+        return 0;
+    }
+    int ret = sys_io_uring_enter(m_fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    return ret < 0 ? -errno : ret;
+}
+
+struct io_uring_cqe *io_ring::peek_cqe()
+{
+    unsigned head = *m_cq_head;
+    if (head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE))
+    {
+        return NULL;
+    }
+    return &m_cqes[head & m_cq_mask];
+}
+
+void io_ring::cqe_seen()
+{
+    __atomic_store_n(m_cq_head, *m_cq_head + 1, __ATOMIC_RELEASE);
+}
+
+bool io_ring::probe(const int *ops, int n)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = sys_io_uring_setup(4, &p);
+    if (fd < 0)
+    {
+        return false;
+    }
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *pr = (struct io_uring_probe *)calloc(1, size);
+    bool ok = pr && sys_io_uring_register(fd, IORING_REGISTER_PROBE, pr, 256) == 0;
+    for (int i = 0; ok && i < n; ++i)
+    {
+        ok = ops[i] <= pr->last_op && (pr->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(pr);
+    close(fd);
+    return ok;
+}
@@ -0,0 +1,84 @@
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+/*
+io_uring的最小封装，直接使用io_uring_setup/io_uring_enter/io_uring_register系统调用，不依赖liburing。
+提交队列和完成队列都只由创建它的事件循环线程访问：
+get_sqe取得提交项并填充，submit_and_wait一次系统调用提交全部新的提交项并等待完成项，
+peek_cqe/cqe_seen逐个取出完成项。
+另外管理一个注册到内核的提供缓冲区环(provided buffer ring)，多次触发的recv从中选取缓冲区，
+完成项的flags中带有缓冲区编号，处理完数据后用recycle_buffer还给内核。
+*/
+class io_ring
+{
+public:
+    io_ring();
+    ~io_ring();
+
+    //创建队列，entries是提交队列的大小，完成队列是它的cq_factor倍；flags不被内核支持时逐个去掉重试
+    //失败时返回false，errno为原因
+    bool init(unsigned entries, unsigned cq_factor, unsigned flags);
+
+    //注册count个(2的幂)大小为size的缓冲区，组编号为bgid
+    bool setup_buffers(int bgid, unsigned count, unsigned size);
+
+    //取得一个清零的提交项，提交队列已满时返回NULL
+    struct io_uring_sqe *get_sqe();
+    //提交队列中空闲的提交项个数，链接在一起的请求必须在同一次提交中
+    unsigned sq_space() const;
+    //提交所有新的提交项并等待至少wait_nr个完成项，返回提交的个数或者-errno
+    int submit_and_wait(unsigned wait_nr);
+
+    //取出下一个完成项，没有时返回NULL；处理完后调用cqe_seen
+    struct io_uring_cqe *peek_cqe();
+    void cqe_seen();
+
+    //缓冲区编号对应的内存
+    char *buffer(unsigned bid) const { return m_bufs + (size_t)bid * m_buf_size; }
+    unsigned buffer_size() const { return m_buf_size; }
+    //把缓冲区还给内核，publish_buffers之后内核才能看到
+    void recycle_buffer(unsigned bid);
+    void publish_buffers();
+
+    //检查内核是否支持ops中的全部操作
+    static bool probe(const int *ops, int n);
+
+private:
+    int m_fd;
+
+    //提交队列：内核的head/tail、下标数组和提交项，m_sqe_tail是已经取出但还没有提交的位置
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned m_sq_mask;
+    unsigned m_sq_entries;
+    struct io_uring_sqe *m_sqes;
+    unsigned m_sqe_head;
+    unsigned m_sqe_tail;
+
+    //完成队列
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned m_cq_mask;
+    struct io_uring_cqe *m_cqes;
+
+    void *m_sq_ring;
+    void *m_cq_ring;
+    size_t m_sq_ring_size;
+    size_t m_cq_ring_size;
+    size_t m_sqes_size;
+
+    //提供缓冲区环和它管理的缓冲区
+    struct io_uring_buf_ring *m_buf_ring;
+    size_t m_buf_ring_size;
+    char *m_bufs;
+    unsigned m_buf_count;
+    unsigned m_buf_size;
+    unsigned short m_buf_tail;
+    int m_bgid;
+};
+
+#endif
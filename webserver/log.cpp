@@ -1,181 +1,662 @@
 #include "log.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <chrono>
+#include <zlib.h>
 
 using namespace std;
 
-Log::Log() {
-    lineCount_ = 0;
+static const char* const LEVEL_TITLE[] = {"[debug]: ", "[info] : ", "[warn] : ", "[error]: "};
+static const size_t LEVEL_TITLE_LEN = 9;
+
+static inline int level_index(int level) {
+    return level >= 0 && level <= 3 ? level : 1;
+}
+
+//t所在那一天结束(下一天零点)的时间
+static time_t next_day(struct tm t) {
+    t.tm_mday += 1;
+    t.tm_hour = 0;
+    t.tm_min = 0;
+    t.tm_sec = 0;
+    t.tm_isdst = -1;
+    return mktime(&t);
+}
+
+const char* Log::formats_[MAX_FORMATS];
+atomic<int> Log::formatCount_(0);
+
+Log::Log(bool title) {
+    static atomic<int> count(0);
+    id_ = count.fetch_add(1);
+    assert(id_ < MAX_LOGS);
+    title_ = title;
     isAsync_ = false;
+    isOpen_ = false;
+    level_ = 1;
+    mode_ = MODE_TEXT;
+    policy_ = POLICY_BLOCK;
+    sampleRate_ = 8;
+    for(int i = 0; i < 4; ++i) {
+        lostDropped_[i] = 0;
+        reportedDropped_[i] = 0;
+    }
+    reportTime_ = 0;
     writeThread_ = nullptr;
-    deque_ = nullptr;
-    toDay_ = 0;
-    fp_ = nullptr;
+    dayEnd_ = 0;
+    part_ = 0;
+    fd_ = -1;
+    fileName_[0] = '\0';
+    fileSize_ = 0;
+    fileLimit_ = FILE_LIMIT;
+    compress_ = false;
+    compressStop_ = false;
+    ringCapacity_ = 0;
+    ringCount_ = 0;
+    batch_ = nullptr;
+    batchLen_ = 0;
+    memset(emitted_, 0, sizeof(emitted_));
+    stop_ = false;
 }
 
 Log::~Log() {
     if(writeThread_ && writeThread_->joinable()) {
-        while(!deque_->empty()) {
-            deque_->flush();
-        };
-        deque_->Close();
+        stop_ = true;
+        cond_.notify_one();
         writeThread_->join();
     }
-    if(fp_) {
-        lock_guard<mutex> locker(mtx_);
-        flush();
-        fclose(fp_);
+    for(int i = 0; i < ringCount_; ++i) {
+        delete[] rings_[i]->records;
+        delete rings_[i];
+    }
+    delete[] batch_;
+    CloseFile_(false);
+    if(compressThread_) {
+        //压缩完已经排队的文件再退出
+        {
+            lock_guard<mutex> locker(compressMtx_);
+            compressStop_ = true;
+        }
+        compressCond_.notify_one();
+        compressThread_->join();
     }
 }
 
 int Log::GetLevel() {
-    lock_guard<mutex> locker(mtx_);
-    return level_;
+    return level_.load(memory_order_relaxed);
 }
 
 void Log::SetLevel(int level) {
-    lock_guard<mutex> locker(mtx_);
-    level_ = level;
+    level_.store(level, memory_order_relaxed);
+}
+
+void Log::SetOverflowPolicy(POLICY policy, int sampleRate) {
+    sampleRate_ = sampleRate > 0 ? sampleRate : 1;
+    policy_.store(policy, memory_order_relaxed);
+}
+
+Log::POLICY Log::GetOverflowPolicy() {
+    return (POLICY)policy_.load(memory_order_relaxed);
+}
+
+uint64_t Log::GetDropped(int level) {
+    int idx = level_index(level);
+    uint64_t total = lostDropped_[idx].load(memory_order_relaxed);
+    int n = ringCount_.load(memory_order_acquire);
+    for(int i = 0; i < n; ++i) {
+        total += rings_[i]->dropped[idx].load(memory_order_relaxed);
+    }
+    return total;
+}
+
+void Log::SetFileLimit(size_t bytes) {
+    //至少能放下几批日志
+    fileLimit_ = bytes < (size_t)BATCH_SIZE ? BATCH_SIZE : bytes;
+}
+
+void Log::SetCompress(bool compress) {
+    compress_ = compress;
+}
+
+int Log::RegisterFormat(const char* format) {
+    static mutex mtx;
+    lock_guard<mutex> locker(mtx);
+    int id = formatCount_.load(memory_order_relaxed) + 1;
+    if(id >= MAX_FORMATS) {
+        //编号用完后这些调用点的日志被丢弃
+        return 0;
+    }
+    formats_[id] = format;
+    formatCount_.store(id, memory_order_release);
+    return id;
 }
 
 void Log::init(int level = 1, const char* path, const char* suffix,
-    int maxQueueSize) {
-    isOpen_ = true;
+    int maxQueueSize, MODE mode) {
     level_ = level;
+    path_ = path;
+    suffix_ = suffix;
+    mode_ = mode;
+    if(!batch_) {
+        batch_ = new char[BATCH_SIZE];
+    }
+
+    time_t timer = time(nullptr);
+    struct tm t;
+    localtime_r(&timer, &t);
+    {
+        lock_guard<mutex> locker(mtx_);
+        CloseFile_(false);
+        dayEnd_ = next_day(t);
+        OpenFile_(t, 0);
+    }
+    if(compress_ && !compressThread_) {
+        compressThread_.reset(new thread([this] { CompressLoop_(); }));
+    }
+
     if(maxQueueSize > 0) {
         isAsync_ = true;
-        if(!deque_) {
-            unique_ptr<BlockDeque<std::string>> newDeque(new BlockDeque<std::string>);
-            deque_ = move(newDeque);
-            
-            std::unique_ptr<std::thread> NewThread(new thread(FlushLogThread));
+        if(!writeThread_) {
+            //每个线程的队列容量取不小于maxQueueSize的2的幂
+            ringCapacity_ = 1;
+            while(ringCapacity_ < (size_t)maxQueueSize) {
+                ringCapacity_ <<= 1;
+            }
+            std::unique_ptr<std::thread> NewThread(new thread([this] { AsyncWrite_(); }));
             writeThread_ = move(NewThread);
         }
     } else {
         isAsync_ = false;
     }
+    isOpen_ = true;
+}
 
-    lineCount_ = 0;
+void Log::OpenFile_(const struct tm& t, int part) {
+    //跳过已经压缩或者已经写满的文件
+    struct stat st;
+    for(;; ++part) {
+        if(part == 0) {
+            snprintf(fileName_, LOG_NAME_LEN - 4, "%s/%04d_%02d_%02d%s",
+                    path_, t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, suffix_);
+        } else {
+            snprintf(fileName_, LOG_NAME_LEN - 4, "%s/%04d_%02d_%02d-%d%s",
+                    path_, t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, part, suffix_);
+        }
+        string gz = string(fileName_) + ".gz";
+        if(stat(gz.c_str(), &st) == 0) {
+            continue;
+        }
+        if(stat(fileName_, &st) != 0 || (size_t)st.st_size + 2 * MAX_LINE_LEN <= fileLimit_) {
+            break;
+        }
+    }
+    fd_ = open(fileName_, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd_ < 0) {
+        mkdir(path_, 0777);
+        fd_ = open(fileName_, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    }
+    assert(fd_ >= 0);
+    part_ = part;
+    fileSize_ = fstat(fd_, &st) == 0 ? st.st_size : 0;
+    //一次分配整个文件的磁盘空间，写日志时不再逐块分配；KEEP_SIZE不改变文件大小，读日志的程序看不到空洞。
+    //文件系统不支持时照常写
+    if(fileSize_ < fileLimit_) {
+        fallocate(fd_, FALLOC_FL_KEEP_SIZE, fileSize_, fileLimit_ - fileSize_);
+    }
+
+    //二进制文件要能单独解码：新文件写文件头，格式定义在本文件中重新写一遍
+    memset(emitted_, 0, sizeof(emitted_));
+    if(mode_ == MODE_BINARY && fileSize_ == 0) {
+        WriteAll_(LOG_BINARY_MAGIC, LOG_BINARY_MAGIC_LEN);
+    }
+}
+
+void Log::CloseFile_(bool compress) {
+    if(fd_ == -1) {
+        return;
+    }
+    //释放文件末尾之后预分配但没有用到的空间
+    if(ftruncate(fd_, fileSize_) < 0) {
+        //失败时只是多占一些磁盘空间
+    }
+    close(fd_);
+    fd_ = -1;
+    if(compress) {
+        {
+            lock_guard<mutex> locker(compressMtx_);
+            compressQueue_.push_back(fileName_);
+        }
+        compressCond_.notify_one();
+    }
+}
 
+void Log::NextFile_() {
     time_t timer = time(nullptr);
-    struct tm *sysTime = localtime(&timer);
-    struct tm t = *sysTime;
-    path_ = path;
-    suffix_ = suffix;
-    char fileName[LOG_NAME_LEN] = {0};
-    snprintf(fileName, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d%s", 
-            path_, t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, suffix_);
-    toDay_ = t.tm_mday;
+    struct tm t;
+    localtime_r(&timer, &t);
+    CloseFile_(compress_);
+    OpenFile_(t, part_ + 1);
+}
 
-    {
-        lock_guard<mutex> locker(mtx_);
-        buff_.RetrieveAll();
-        if(fp_) { 
-            flush();
-            fclose(fp_); 
+void Log::Rotate_() {
+    time_t timer = time(nullptr);
+    if(timer < dayEnd_) {
+        return;
+    }
+    struct tm t;
+    localtime_r(&timer, &t);
+    CloseFile_(compress_);
+    dayEnd_ = next_day(t);
+    OpenFile_(t, 0);
+}
+
+void Log::WriteAll_(const char* data, size_t len) {
+    while(len > 0) {
+        ssize_t n = ::write(fd_, data, len);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return;
         }
+        data += n;
+        len -= n;
+        fileSize_ += n;
+    }
+}
 
-        fp_ = fopen(fileName, "a");
-        if(fp_ == nullptr) {
-            mkdir(path_, 0777);
-            fp_ = fopen(fileName, "a");
-        } 
-        assert(fp_ != nullptr);
+void Log::FlushBatch_() {
+    if(batchLen_ > 0) {
+        WriteAll_(batch_, batchLen_);
+        batchLen_ = 0;
     }
+    Rotate_();
 }
 
-void Log::write(int level, const char *format, ...) {
+bool Log::CompressFile_(const string& name) {
+    int fd = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return false;
+    }
+    string tmp = name + ".gz.tmp";
+    gzFile gz = gzopen(tmp.c_str(), "wb6");
+    if(!gz) {
+        close(fd);
+        return false;
+    }
+    char buf[64 * 1024];
+    bool ok = true;
+    ssize_t n;
+    while((n = ::read(fd, buf, sizeof(buf))) != 0) {
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            ok = false;
+            break;
+        }
+        if(gzwrite(gz, buf, n) != n) {
+            ok = false;
+            break;
+        }
+    }
+    close(fd);
+    ok = gzclose(gz) == Z_OK && ok;
+    if(!ok || rename(tmp.c_str(), (name + ".gz").c_str()) < 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    unlink(name.c_str());
+    return true;
+}
+
+void Log::CompressLoop_() {
+    unique_lock<mutex> locker(compressMtx_);
+    while(true) {
+        compressCond_.wait(locker, [this] { return compressStop_ || !compressQueue_.empty(); });
+        if(compressQueue_.empty()) {
+            return;
+        }
+        string name = compressQueue_.front();
+        compressQueue_.pop_front();
+        locker.unlock();
+        CompressFile_(name);
+        locker.lock();
+    }
+}
+
+size_t Log::FormatPrefix_(char* p, int64_t usec, int level, bool title) {
+    //每个线程缓存当前秒的"年-月-日 时:分:秒."前缀，一秒只调用一次localtime_r
+    static thread_local time_t t_sec = -1;
+    static thread_local char t_prefix[32];
+    static thread_local size_t t_prefix_len = 0;
+
+    time_t sec = usec / 1000000;
+    if(sec != t_sec) {
+        struct tm t;
+        localtime_r(&sec, &t);
+        t_prefix_len = snprintf(t_prefix, sizeof(t_prefix), "%d-%02d-%02d %02d:%02d:%02d.",
+                    t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
+                    t.tm_hour, t.tm_min, t.tm_sec);
+        t_sec = sec;
+    }
+
+    char* start = p;
+    memcpy(p, t_prefix, t_prefix_len);
+    p += t_prefix_len;
+    long us = usec % 1000000;
+    for(int i = 5; i >= 0; --i) {
+        p[i] = '0' + us % 10;
+        us /= 10;
+    }
+    if(!title) {
+        p[6] = '\t';
+        return p + 7 - start;
+    }
+    p[6] = ' ';
+    p += 7;
+    memcpy(p, LEVEL_TITLE[level_index(level)], LEVEL_TITLE_LEN);
+    p += LEVEL_TITLE_LEN;
+    return p - start;
+}
+
+static inline int64_t now_usec() {
     struct timeval now = {0, 0};
     gettimeofday(&now, nullptr);
-    time_t tSec = now.tv_sec;
-    struct tm *sysTime = localtime(&tSec);
-    struct tm t = *sysTime;
-    va_list vaList;
+    return (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
 
-    /* 日志日期 日志行数 */
-    if (toDay_ != t.tm_mday || (lineCount_ && (lineCount_  %  MAX_LINES == 0)))
-    {
-        unique_lock<mutex> locker(mtx_);
-        locker.unlock();
-        
-        char newFile[LOG_NAME_LEN];
-        char tail[36] = {0};
-        snprintf(tail, 36, "%04d_%02d_%02d", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday);
+size_t Log::Format_(Record* rec, int level, const char* format, va_list vaList) {
+    char* p = rec->text;
+    p += FormatPrefix_(p, now_usec(), level, title_);
 
-        if (toDay_ != t.tm_mday)
-        {
-            snprintf(newFile, LOG_NAME_LEN - 72, "%s/%s%s", path_, tail, suffix_);
-            toDay_ = t.tm_mday;
-            lineCount_ = 0;
+    //留一个字节给换行符，过长的日志被截断
+    size_t room = rec->text + sizeof(rec->text) - p - 1;
+    int m = vsnprintf(p, room + 1, format, vaList);
+    if(m < 0) {
+        m = 0;
+    } else if((size_t)m > room) {
+        m = room;
+    }
+    p += m;
+    *p++ = '\n';
+    rec->format = 0;
+    rec->len = p - rec->text;
+    return rec->len;
+}
+
+Log::Ring* Log::ThreadRing_() {
+    static thread_local Ring* t_rings[MAX_LOGS];
+    Ring*& t_ring = t_rings[id_];
+    if(!t_ring) {
+        lock_guard<mutex> locker(mtx_);
+        int n = ringCount_.load(memory_order_relaxed);
+        if(n >= MAX_THREADS) {
+            return nullptr;
         }
-        else {
-            snprintf(newFile, LOG_NAME_LEN - 72, "%s/%s-%d%s", path_, tail, (lineCount_  / MAX_LINES), suffix_);
+        Ring* ring = new Ring;
+        ring->records = new Record[ringCapacity_];
+        ring->mask = ringCapacity_ - 1;
+        ring->head_.store(0, memory_order_relaxed);
+        ring->tail_.store(0, memory_order_relaxed);
+        for(int i = 0; i < 4; ++i) {
+            ring->dropped[i].store(0, memory_order_relaxed);
         }
-        
-        locker.lock();
-        flush();
-        fclose(fp_);
-        fp_ = fopen(newFile, "a");
-        assert(fp_ != nullptr);
+        ring->sampled = 0;
+        rings_[n] = ring;
+        ringCount_.store(n + 1, memory_order_release);
+        t_ring = ring;
     }
+    return t_ring;
+}
 
-    {
-        unique_lock<mutex> locker(mtx_);
-        lineCount_++;
-        int n = snprintf(buff_.BeginWrite(), 128, "%d-%02d-%02d %02d:%02d:%02d.%06ld ",
-                    t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
-                    t.tm_hour, t.tm_min, t.tm_sec, now.tv_usec);
-                    
-        buff_.HasWritten(n);
-        AppendLogLevelTitle_(level);
+bool Log::ShouldDrop_(Ring* ring, size_t used, int level) {
+    size_t capacity = ring->mask + 1;
+    switch(policy_.load(memory_order_relaxed)) {
+    case POLICY_DROP_NEWEST:
+        return used >= capacity;
+    case POLICY_DROP_LEVEL:
+        if(level <= 0) {
+            return used >= capacity / 2;
+        }
+        if(level == 1) {
+            return used >= capacity / 4 * 3;
+        }
+        return used >= capacity;
+    case POLICY_SAMPLE:
+        if(used >= capacity) {
+            return true;
+        }
+        return used >= capacity / 2 && ring->sampled++ % sampleRate_.load(memory_order_relaxed) != 0;
+    default:
+        return false;
+    }
+}
 
-        va_start(vaList, format);
-        int m = vsnprintf(buff_.BeginWrite(), buff_.WritableBytes(), format, vaList);
+Log::Record* Log::Reserve_(Ring** out, int level) {
+    Ring* ring = ThreadRing_();
+    if(!ring) {
+        //超过MAX_THREADS的线程的日志被丢弃
+        lostDropped_[level_index(level)].fetch_add(1, memory_order_relaxed);
+        return nullptr;
+    }
+    size_t tail = ring->tail_.load(memory_order_relaxed);
+    size_t head = ring->head_.load(memory_order_acquire);
+    if(ShouldDrop_(ring, tail - head, level)) {
+        //计数只由本线程修改，不需要原子的加法
+        std::atomic<uint64_t>& dropped = ring->dropped[level_index(level)];
+        dropped.store(dropped.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        cond_.notify_one();
+        return nullptr;
+    }
+    while(tail - head > ring->mask) {
+        //POLICY_BLOCK：队列已满，唤醒后台线程并等待它取走记录
+        cond_.notify_one();
+        this_thread::yield();
+        head = ring->head_.load(memory_order_acquire);
+    }
+    *out = ring;
+    return &ring->records[tail & ring->mask];
+}
+
+void Log::Commit_(Ring* ring, Record* rec) {
+    size_t tail = ring->tail_.load(memory_order_relaxed);
+    ring->tail_.store(tail + 1, memory_order_release);
+    //队列过半时提前唤醒后台线程，否则由它自己定时醒来
+    if(tail + 1 - ring->head_.load(memory_order_relaxed) == (ring->mask + 1) / 2) {
+        cond_.notify_one();
+    }
+}
+
+void Log::write(int level, const char *format, ...) {
+    va_list vaList;
+    va_start(vaList, format);
+    if(!isAsync_) {
+        Record rec;
+        Format_(&rec, level, format, vaList);
         va_end(vaList);
+        lock_guard<mutex> locker(mtx_);
+        Append_(rec);
+        FlushBatch_();
+        return;
+    }
 
-        buff_.HasWritten(m);
-        buff_.Append("\n\0", 2);
+    Ring* ring;
+    Record* rec = Reserve_(&ring, level);
+    if(rec) {
+        Format_(rec, level, format, vaList);
+        Commit_(ring, rec);
+    }
+    va_end(vaList);
+}
 
-        if(isAsync_ && deque_ && !deque_->full()) {
-            deque_->push_back(buff_.RetrieveAllToStr());
-        } else {
-            fputs(buff_.Peek(), fp_);
-        }
-        buff_.RetrieveAll();
-    }
-}
-
-void Log::AppendLogLevelTitle_(int level) {
-    switch(level) {
-    case 0:
-        buff_.Append("[debug]: ", 9);
-        break;
-    case 1:
-        buff_.Append("[info] : ", 9);
-        break;
-    case 2:
-        buff_.Append("[warn] : ", 9);
-        break;
-    case 3:
-        buff_.Append("[error]: ", 9);
-        break;
-    default:
-        buff_.Append("[info] : ", 9);
-        break;
+void Log::WriteEncoded_(int level, int formatId, const char* args, size_t len) {
+    if(formatId == 0) {
+        return;
+    }
+    Record local;
+    Ring* ring = nullptr;
+    Record* rec = isAsync_ ? Reserve_(&ring, level) : &local;
+    if(!rec) {
+        return;
+    }
+    rec->len = len;
+    rec->format = formatId;
+    rec->level = level;
+    rec->usec = now_usec();
+    memcpy(rec->text, args, len);
+    if(ring) {
+        Commit_(ring, rec);
+    } else {
+        lock_guard<mutex> locker(mtx_);
+        Append_(local);
+        FlushBatch_();
+    }
+}
+
+void Log::Append_(const Record& rec) {
+    //一条记录展开后不超过MAX_LINE_LEN，二进制模式再加上一条格式定义
+    if(batchLen_ + 2 * MAX_LINE_LEN > (size_t)BATCH_SIZE) {
+        FlushBatch_();
+    }
+    //按大小切分：在记录追加进批量缓冲区之前换文件，二进制模式的格式定义总是和记录在同一个文件中
+    if(fileSize_ + batchLen_ + 2 * MAX_LINE_LEN > fileLimit_) {
+        FlushBatch_();
+        if(fileSize_ + 2 * MAX_LINE_LEN > fileLimit_) {
+            NextFile_();
+        }
+    }
+    char* p = batch_ + batchLen_;
+    if(rec.format == 0) {
+        if(mode_ == MODE_BINARY) {
+            uint16_t len = rec.len;
+            *p++ = 'T';
+            memcpy(p, &len, sizeof(len));
+            p += sizeof(len);
+        }
+        memcpy(p, rec.text, rec.len);
+        p += rec.len;
+    } else if(mode_ == MODE_BINARY) {
+        uint16_t id = rec.format;
+        if(!emitted_[id]) {
+            const char* format = formats_[id];
+            size_t n = strlen(format);
+            uint16_t len = n < (size_t)MAX_LINE_LEN ? n : MAX_LINE_LEN;
+            *p++ = 'F';
+            memcpy(p, &id, sizeof(id));
+            p += sizeof(id);
+            memcpy(p, &len, sizeof(len));
+            p += sizeof(len);
+            memcpy(p, format, len);
+            p += len;
+            emitted_[id] = true;
+        }
+        uint16_t len = rec.len;
+        *p++ = 'R';
+        *p++ = rec.level;
+        memcpy(p, &id, sizeof(id));
+        p += sizeof(id);
+        memcpy(p, &rec.usec, sizeof(rec.usec));
+        p += sizeof(rec.usec);
+        memcpy(p, &len, sizeof(len));
+        p += sizeof(len);
+        memcpy(p, rec.text, len);
+        p += len;
+    } else {
+        char* start = p;
+        p += FormatPrefix_(p, rec.usec, rec.level, title_);
+        p += LogFormat(p, MAX_LINE_LEN - (p - start) - 1, formats_[rec.format], rec.text, rec.len);
+        *p++ = '\n';
     }
+    batchLen_ = p - batch_;
+}
+
+size_t Log::Drain_() {
+    size_t total = 0;
+    int n = ringCount_.load(memory_order_acquire);
+    for(int i = 0; i < n; ++i) {
+        Ring* ring = rings_[i];
+        size_t start = ring->head_.load(memory_order_relaxed);
+        size_t tail = ring->tail_.load(memory_order_acquire);
+        for(size_t head = start; head != tail; ++head) {
+            Append_(ring->records[head & ring->mask]);
+        }
+        //记录已经复制到批量缓冲区，可以交还给生产者
+        total += tail - start;
+        ring->head_.store(tail, memory_order_release);
+    }
+    if(batchLen_ > 0) {
+        FlushBatch_();
+    }
+    return total;
 }
 
 void Log::flush() {
-    if(isAsync_) { 
-        deque_->flush(); 
+    if(!isAsync_) {
+        //同步模式直接write(2)，没有用户态缓冲
+        return;
+    }
+    size_t targets[MAX_THREADS];
+    int n = ringCount_.load(memory_order_acquire);
+    for(int i = 0; i < n; ++i) {
+        targets[i] = rings_[i]->tail_.load(memory_order_acquire);
+    }
+    cond_.notify_one();
+    for(int i = 0; i < n; ++i) {
+        while(rings_[i]->head_.load(memory_order_acquire) < targets[i]) {
+            cond_.notify_one();
+            this_thread::sleep_for(chrono::microseconds(100));
+        }
     }
-    fflush(fp_);
+}
+
+void Log::ReportDrops_() {
+    if(!title_) {
+        //访问日志只有固定的列，丢弃数由GetDropped查询
+        return;
+    }
+    time_t now = time(nullptr);
+    if(now == reportTime_) {
+        return;
+    }
+    reportTime_ = now;
+    uint64_t dropped[4];
+    bool changed = false;
+    for(int i = 0; i < 4; ++i) {
+        dropped[i] = GetDropped(i);
+        changed |= dropped[i] != reportedDropped_[i];
+    }
+    if(!changed) {
+        return;
+    }
+    Record rec;
+    char* p = rec.text;
+    p += FormatPrefix_(p, (int64_t)now * 1000000, 2, true);
+    p += snprintf(p, rec.text + sizeof(rec.text) - p,
+                "log overflow, dropped debug %llu info %llu warn %llu error %llu\n",
+                (unsigned long long)(dropped[0] - reportedDropped_[0]),
+                (unsigned long long)(dropped[1] - reportedDropped_[1]),
+                (unsigned long long)(dropped[2] - reportedDropped_[2]),
+                (unsigned long long)(dropped[3] - reportedDropped_[3]));
+    rec.format = 0;
+    rec.len = p - rec.text;
+    memcpy(reportedDropped_, dropped, sizeof(dropped));
+    Append_(rec);
+    FlushBatch_();
 }
 
 void Log::AsyncWrite_() {
-    string str = "";
-    while(deque_->pop(str)) {
-        lock_guard<mutex> locker(mtx_);
-        fputs(str.c_str(), fp_);
+    while(!stop_.load(memory_order_acquire)) {
+        ReportDrops_();
+        if(Drain_() == 0) {
+            //没有日志时最多睡10ms，生产者在队列过半或者flush时提前唤醒
+            unique_lock<mutex> locker(mtx_);
+            cond_.wait_for(locker, chrono::milliseconds(10));
+        }
     }
+    Drain_();
 }
 
 Log* Log::Instance() {
@@ -183,6 +664,11 @@ Log* Log::Instance() {
     return &inst;
 }
 
+Log* Log::Access() {
+    static Log inst(false);
+    return &inst;
+}
+
 void Log::FlushLogThread() {
     Log::Instance()->AsyncWrite_();
 }
@@ -4,72 +4,218 @@
 #include <mutex>
 #include <string>
 #include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <sys/time.h>
 #include <string.h>
 #include <stdarg.h>           // vastart va_end
 #include <assert.h>
 #include <sys/stat.h>         //mkdir
-#include "blockqueue.h"
-#include "../buffer/buffer.h"
+#include "log_record.h"
 
+/* 异步日志：每个写日志的线程有自己的单生产者单消费者环形队列，队列中是定长的日志记录，
+   写日志时只在本线程的队列中格式化一条记录，不加锁也不分配内存；
+   后台线程轮流取出各个队列中的记录，拼成大块后用一次write(2)写入文件，并在那里完成按天和大小的切分。
+   日志文件按段预分配磁盘空间，写满的段可以交给压缩线程压缩成.gz。
+   Instance()是运行日志，Access()是访问日志，两者各有队列、后台线程和文件，访问日志的行没有级别标题。
+   maxQueueCapacity为0时是同步模式，调用者直接write(2)。
+   MODE_DEFERRED和MODE_BINARY下LOG_*宏只记录格式字符串的编号和原始参数，
+   前者由后台线程格式化成文本，后者直接写二进制文件，由tools/log_decode离线格式化 */
 class Log {
 public:
+    enum MODE { MODE_TEXT = 0, MODE_DEFERRED, MODE_BINARY };
+    /* 异步模式下队列满时的处理：
+       POLICY_BLOCK       等待后台线程取走记录
+       POLICY_DROP_NEWEST 丢弃新的记录
+       POLICY_DROP_LEVEL  队列过半丢弃debug，过3/4丢弃info，满时全部丢弃
+       POLICY_SAMPLE      队列过半后每sampleRate条保留一条，满时全部丢弃 */
+    enum POLICY { POLICY_BLOCK = 0, POLICY_DROP_NEWEST, POLICY_DROP_LEVEL, POLICY_SAMPLE };
+
     static Log *get_instance()
      {
-         static Log instance;
-         return &instance;
+         return Instance();
      }
-    void init(int level, const char* path = "./log", 
+    void init(int level, const char* path = "./log",
                 const char* suffix =".log",
-                int maxQueueCapacity = 1024);
+                int maxQueueCapacity = 1024,
+                MODE mode = MODE_TEXT);
 
     static Log* Instance();
+    static Log* Access();
     static void FlushLogThread();
 
     void write(int level, const char *format,...);
+    //延迟格式化：formatId由RegisterFormat得到，参数只编码不格式化
+    template <typename... Args>
+    void WriteDeferred(int level, int formatId, const Args&... args) {
+        LogArgs encoded;
+        encoded.Encode(args...);
+        WriteEncoded_(level, formatId, encoded.Data(), encoded.Size());
+    }
+    //登记一个格式字符串(必须是字面量)，返回从1开始的编号，每个调用点只在第一次执行时登记
+    static int RegisterFormat(const char* format);
+    //等待此前写入的日志全部落到文件
     void flush();
 
     int GetLevel();
     void SetLevel(int level);
+    void SetOverflowPolicy(POLICY policy, int sampleRate = 8);
+    //单个日志文件的大小上限，在init之前设置
+    void SetFileLimit(size_t bytes);
+    //写满或者过了当天的日志文件用gzip压缩后删除原文件，在init之前设置
+    void SetCompress(bool compress);
+    POLICY GetOverflowPolicy();
+    //按级别统计的被丢弃的日志条数
+    uint64_t GetDropped(int level);
     bool IsOpen() { return isOpen_; }
-    
+    bool IsDeferred() { return mode_ != MODE_TEXT; }
+
+    //一条日志记录的大小，超出的部分被截断
+    static const int LOG_RECORD_SIZE = 256;
+    //最多支持的写日志线程数
+    static const int MAX_THREADS = 256;
+    //最多登记的格式字符串数
+    static const int MAX_FORMATS = 4096;
+    //Log实例的个数
+    static const int MAX_LOGS = 2;
+
 private:
-    Log();
-    void AppendLogLevelTitle_(int level);
+    explicit Log(bool title = true);
     virtual ~Log();
     void AsyncWrite_();
 
+    //format为0时text是格式化好的一行，否则text是LogArgs编码的参数，usec是写日志的时间
+    struct Record {
+        uint32_t len;
+        uint16_t format;
+        uint8_t level;
+        int64_t usec;
+        char text[LOG_RECORD_SIZE - 16];
+    };
+
+    //一个线程的日志队列，tail_只由所属线程修改，head_只由后台线程修改
+    struct Ring {
+        Record* records;
+        size_t mask;
+        //只由所属线程修改的丢弃计数和采样计数
+        std::atomic<uint64_t> dropped[4];
+        uint32_t sampled;
+        alignas(64) std::atomic<size_t> head_;
+        alignas(64) std::atomic<size_t> tail_;
+    };
+
+    //当前线程在本实例中的队列，第一次写日志时创建并登记，线程退出后仍由Log持有
+    Ring* ThreadRing_();
+
+    //取得本线程队列中的下一个记录位置，队列满时等待后台线程；线程数超过MAX_THREADS时返回nullptr
+    Record* Reserve_(Ring** ring, int level);
+    //按溢出策略判断是否丢弃，used是队列中已有的记录数
+    bool ShouldDrop_(Ring* ring, size_t used, int level);
+    void Commit_(Ring* ring, Record* rec);
+    void WriteEncoded_(int level, int formatId, const char* args, size_t len);
+
+    //把"时间 级别"前缀写到p，返回长度；title为false时只有时间和一个制表符
+    static size_t FormatPrefix_(char* p, int64_t usec, int level, bool title);
+    //把一条完整的日志格式化到rec，返回长度
+    size_t Format_(Record* rec, int level, const char* format, va_list vaList);
+
+    //后台线程：取出所有队列中的记录写入文件，返回取出的记录数
+    size_t Drain_();
+    //把一条记录按当前模式追加到batch_，空间不够时先写出
+    void Append_(const Record& rec);
+    //写出batch_，然后检查日期是否变化，只在持有文件的线程调用
+    void FlushBatch_();
+    void WriteAll_(const char* data, size_t len);
+    void Rotate_();
+    //当前文件写满时换到当天的下一个文件
+    void NextFile_();
+    //关闭当前文件，需要压缩时交给压缩线程
+    void CloseFile_(bool compress);
+    void CompressLoop_();
+    static bool CompressFile_(const std::string& name);
+    //丢弃计数增加时写一行汇总，每秒最多一次
+    void ReportDrops_();
+    //打开当天第part个之后第一个还有空间的文件并预分配
+    void OpenFile_(const struct tm& t, int part);
+
 private:
     static const int LOG_PATH_LEN = 256;
     static const int LOG_NAME_LEN = 256;
-    static const int MAX_LINES = 50000;
+    //默认的单个日志文件大小
+    static const size_t FILE_LIMIT = 64 * 1024 * 1024;
+    //后台线程一次write(2)的最大字节数
+    static const int BATCH_SIZE = 256 * 1024;
+    //延迟格式化的一行的最大长度
+    static const int MAX_LINE_LEN = 1024;
 
     const char* path_;
     const char* suffix_;
 
-    int MAX_LINES_;
-
-    int lineCount_;
-    int toDay_;
+    //当天结束的时间，到了之后换新文件
+    time_t dayEnd_;
+    //当天的第几个文件
+    int part_;
 
     bool isOpen_;
- 
-    Buffer buff_;
-    int level_;
+    //实例编号，用来区分每个线程在各个实例中的队列
+    int id_;
+    //行首是否带级别标题
+    bool title_;
+
+    std::atomic<int> level_;
     bool isAsync_;
+    MODE mode_;
+    std::atomic<int> policy_;
+    std::atomic<int> sampleRate_;
+    //超过MAX_THREADS的线程没有队列，它们的日志全部丢弃
+    std::atomic<uint64_t> lostDropped_[4];
+    uint64_t reportedDropped_[4];
+    time_t reportTime_;
+
+    int fd_;
+    char fileName_[LOG_NAME_LEN];
+    //当前文件的大小和上限
+    size_t fileSize_;
+    size_t fileLimit_;
 
-    FILE* fp_;
-    std::unique_ptr<BlockDeque<std::string>> deque_; 
+    size_t ringCapacity_;
+    Ring* rings_[MAX_THREADS];
+    std::atomic<int> ringCount_;
+
+    char* batch_;
+    size_t batchLen_;
+    //当前文件中已经写过定义的格式编号，换文件时清空
+    bool emitted_[MAX_FORMATS];
+
+    static const char* formats_[MAX_FORMATS];
+    static std::atomic<int> formatCount_;
     std::unique_ptr<std::thread> writeThread_;
+    std::atomic<bool> stop_;
+
+    //同步模式下保护文件，异步模式下用于唤醒后台线程和登记队列
     std::mutex mtx_;
+    std::condition_variable cond_;
+
+    //等待压缩的文件
+    bool compress_;
+    std::unique_ptr<std::thread> compressThread_;
+    std::deque<std::string> compressQueue_;
+    bool compressStop_;
+    std::mutex compressMtx_;
+    std::condition_variable compressCond_;
 };
 
 #define LOG_BASE(level, format, ...) \
     do {\
         Log* log = Log::Instance();\
         if (log->IsOpen() && log->GetLevel() <= level) {\
-            log->write(level, format, ##__VA_ARGS__); \
-            log->flush();\
+            if (log->IsDeferred()) {\
+                static const int logFormatId = Log::RegisterFormat(format);\
+                log->WriteDeferred(level, logFormatId, ##__VA_ARGS__);\
+            } else {\
+                log->write(level, format, ##__VA_ARGS__); \
+            }\
         }\
     } while(0);
 
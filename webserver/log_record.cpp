@@ -0,0 +1,170 @@
+#include "log_record.h"
+#include <stdio.h>
+
+//取出下一个参数，返回类型标记，参数用完或者编码损坏时返回0
+static char next_arg(const char*& p, const char* end, int64_t& i, double& d, const char*& s, size_t& n) {
+    if(p >= end) {
+        return 0;
+    }
+    char type = *p++;
+    switch(type) {
+    case LOG_ARG_INT:
+    case LOG_ARG_UINT:
+    case LOG_ARG_PTR:
+        if(end - p < 8) {
+            return 0;
+        }
+        memcpy(&i, p, 8);
+        p += 8;
+        return type;
+    case LOG_ARG_DOUBLE:
+        if(end - p < 8) {
+            return 0;
+        }
+        memcpy(&d, p, 8);
+        p += 8;
+        return type;
+    case LOG_ARG_STR: {
+        uint16_t n16;
+        if(end - p < 2) {
+            return 0;
+        }
+        memcpy(&n16, p, 2);
+        p += 2;
+        if((size_t)(end - p) < n16) {
+            return 0;
+        }
+        s = p;
+        n = n16;
+        p += n16;
+        return type;
+    }
+    default:
+        return 0;
+    }
+}
+
+size_t LogFormat(char* out, size_t size, const char* format, const char* args, size_t argsLen) {
+    if(size == 0) {
+        return 0;
+    }
+    const char* ap = args;
+    const char* aend = args + argsLen;
+    char* o = out;
+    char* oend = out + size - 1;
+    const char* f = format;
+    while(*f && o < oend) {
+        if(*f != '%') {
+            *o++ = *f++;
+            continue;
+        }
+        if(f[1] == '%') {
+            *o++ = '%';
+            f += 2;
+            continue;
+        }
+
+        //把转换说明改写成spec：去掉长度修饰，'*'换成参数的值，再按参数类型补上长度
+        const char* start = f++;
+        char spec[64];
+        size_t sl = 0;
+        spec[sl++] = '%';
+        bool ok = true;
+        while(*f && strchr("-+ #0", *f) && sl < 8) {
+            spec[sl++] = *f++;
+        }
+        for(int part = 0; part < 2 && ok; ++part) {
+            if(part == 1) {
+                if(*f != '.') {
+                    break;
+                }
+                spec[sl++] = *f++;
+            }
+            if(*f == '*') {
+                int64_t i;
+                double d;
+                const char* s;
+                size_t n;
+                char t = next_arg(ap, aend, i, d, s, n);
+                if(t != LOG_ARG_INT && t != LOG_ARG_UINT) {
+                    ok = false;
+                    break;
+                }
+                sl += snprintf(spec + sl, 16, "%d", (int)i);
+                ++f;
+            } else {
+                while(*f >= '0' && *f <= '9' && sl < 40) {
+                    spec[sl++] = *f++;
+                }
+            }
+        }
+        while(*f && strchr("hlLqjzt", *f)) {
+            ++f;
+        }
+        char conv = *f;
+        if(!conv || !ok) {
+            //说明不完整或者参数不符，原样输出
+            size_t len = (conv ? f + 1 : f) - start;
+            if(len > (size_t)(oend - o)) {
+                len = oend - o;
+            }
+            memcpy(o, start, len);
+            o += len;
+            f = conv ? f + 1 : f;
+            continue;
+        }
+        ++f;
+
+        int64_t i = 0;
+        double d = 0;
+        const char* s = NULL;
+        size_t n = 0;
+        const char* save = ap;
+        char type = next_arg(ap, aend, i, d, s, n);
+        size_t room = oend - o + 1;
+        int m = -1;
+        if(strchr("diouxXc", conv) && (type == LOG_ARG_INT || type == LOG_ARG_UINT)) {
+            if(conv == 'c') {
+                spec[sl++] = 'c';
+                spec[sl] = '\0';
+                m = snprintf(o, room, spec, (int)i);
+            } else {
+                spec[sl++] = 'l';
+                spec[sl++] = 'l';
+                spec[sl++] = conv;
+                spec[sl] = '\0';
+                m = snprintf(o, room, spec, (long long)i);
+            }
+        } else if(strchr("fFeEgGaA", conv) && type == LOG_ARG_DOUBLE) {
+            spec[sl++] = conv;
+            spec[sl] = '\0';
+            m = snprintf(o, room, spec, d);
+        } else if(conv == 's' && type == LOG_ARG_STR) {
+            char str[LogArgs::MAX_SIZE + 1];
+            memcpy(str, s, n);
+            str[n] = '\0';
+            spec[sl++] = 's';
+            spec[sl] = '\0';
+            m = snprintf(o, room, spec, str);
+        } else if(conv == 'p' && (type == LOG_ARG_PTR || type == LOG_ARG_UINT)) {
+            spec[sl++] = 'p';
+            spec[sl] = '\0';
+            m = snprintf(o, room, spec, (void*)(uintptr_t)i);
+        } else {
+            //类型不符时不消耗参数，转换说明原样输出
+            ap = save;
+            size_t len = f - start;
+            if(len > (size_t)(oend - o)) {
+                len = oend - o;
+            }
+            memcpy(o, start, len);
+            o += len;
+            continue;
+        }
+        if(m > 0) {
+            o += (size_t)m < room ? (size_t)m : room - 1;
+        }
+    }
+    *o = '\0';
+    return o - out;
+}
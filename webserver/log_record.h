@@ -0,0 +1,98 @@
+#ifndef LOG_RECORD_H
+#define LOG_RECORD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+#include <type_traits>
+
+//延迟格式化日志中参数的类型标记
+enum LogArgType { LOG_ARG_INT = 1, LOG_ARG_UINT, LOG_ARG_DOUBLE, LOG_ARG_STR, LOG_ARG_PTR };
+
+/* 延迟格式化日志的参数编码：每个参数一个字节的类型标记加上原始值，字符串复制内容(过长时截断)。
+   写日志的线程只做编码，vsnprintf留给后台线程或者离线的log_decode工具 */
+class LogArgs {
+public:
+    //编码区的大小，与日志记录中存放参数的区域一致
+    static const size_t MAX_SIZE = 240;
+
+    LogArgs() : len_(0) {}
+
+    void Encode() {}
+
+    template <typename T, typename... Rest>
+    void Encode(const T& v, const Rest&... rest) {
+        Put(v);
+        Encode(rest...);
+    }
+
+    const char* Data() const { return buf_; }
+    size_t Size() const { return len_; }
+
+private:
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type Put(T v) {
+        if(std::is_signed<T>::value) {
+            PutScalar(LOG_ARG_INT, (int64_t)v);
+        } else {
+            PutScalar(LOG_ARG_UINT, (uint64_t)v);
+        }
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_floating_point<T>::value>::type Put(T v) {
+        PutScalar(LOG_ARG_DOUBLE, (double)v);
+    }
+
+    template <typename T>
+    void Put(T* p) {
+        PutScalar(LOG_ARG_PTR, (uint64_t)(uintptr_t)p);
+    }
+
+    void Put(const char* s) { PutStr(s, strlen(s)); }
+    void Put(char* s) { PutStr(s, strlen(s)); }
+    void Put(const std::string& s) { PutStr(s.data(), s.size()); }
+
+    template <typename V>
+    void PutScalar(char type, V v) {
+        if(len_ + 1 + sizeof(v) > MAX_SIZE) {
+            return;
+        }
+        buf_[len_++] = type;
+        memcpy(buf_ + len_, &v, sizeof(v));
+        len_ += sizeof(v);
+    }
+
+    void PutStr(const char* s, size_t n) {
+        if(len_ + 3 > MAX_SIZE) {
+            return;
+        }
+        if(n > MAX_SIZE - len_ - 3) {
+            n = MAX_SIZE - len_ - 3;
+        }
+        uint16_t n16 = n;
+        buf_[len_++] = LOG_ARG_STR;
+        memcpy(buf_ + len_, &n16, sizeof(n16));
+        len_ += sizeof(n16);
+        memcpy(buf_ + len_, s, n);
+        len_ += n;
+    }
+
+    char buf_[MAX_SIZE];
+    size_t len_;
+};
+
+//按format把LogArgs编码的参数格式化到out，返回写入的字节数，结果截断到size-1字节并以'\0'结尾
+//参数不够时剩余的转换说明原样输出
+size_t LogFormat(char* out, size_t size, const char* format, const char* args, size_t argsLen);
+
+/* 二进制日志文件的格式(本机字节序)：
+   文件头 LOG_BINARY_MAGIC
+   'F' u16格式编号 u16长度 格式字符串          —— 每个文件中格式第一次出现前写一次
+   'R' u8级别 u16格式编号 i64微秒时间戳 u16参数长度 参数编码
+   'T' u16长度 已经格式化好的一行 */
+#define LOG_BINARY_MAGIC "WSLOGBIN1\n"
+static const size_t LOG_BINARY_MAGIC_LEN = 10;
+
+#endif
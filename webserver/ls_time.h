@@ -17,8 +17,14 @@ struct client_data
     //socket文件描述符
     int sockfd;
 
+    //所属reactor的epoll文件描述符
+    int epollfd;
+
     //定时器
     util_timer *timer;
+
+    //管理该连接的reactor，连接数达到上限时每个reactor只淘汰自己的连接
+    const void *owner;
 };
 
 //定时器类
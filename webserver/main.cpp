@@ -7,36 +7,31 @@
 #include <string.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <libgen.h>
 #include <sys/epoll.h>
+#include <sys/resource.h>
 #include <cassert>
 #include "locker.h"
 #include "threadpool.h"
+#include "ws_threadpool.h"
 #include "http_conn.h"
 #include "ls_time.h"
-#include"log/log.h"
-
-#define MAX_FD 65536   // 最大的文件描述符个数
-#define MAX_EVENT_NUMBER 10000  // 监听的最大的事件数量
-#define TIMESLOT 5      //最小超时单位
+#include "reactor.h"
+#include "uring_reactor.h"
+#include "file_cache.h"
+#include "http_response.h"
+#include "http_parser.h"
+#include "log.h"
+#include "metrics.h"
 
 
 //#define SYNLOG  //同步写日志
 #define ASYNLOG //异步写日志
 
-//#define listenfdET //边缘触发非阻塞
-#define listenfdLT //水平触发阻塞
-
-//添加文件描述符到epoll中
-extern void addfd( int epollfd, int fd, bool one_shot );
-//从epoll中移除监听的文件描述符
-extern void removefd( int epollfd, int fd );
-
 extern int setnonblocking(int fd);
 
 //设置定时器相关参数
 static int pipefd[2];
-static sort_timer_lst timer_lst;
-static int epollfd = 0;
 
 
 //信号处理函数
@@ -65,345 +60,351 @@ void addsig(int sig, void( handler )(int), bool restart = true){
     assert( sigaction( sig, &sa, NULL ) != -1 );
 }
 
-//定时处理任务，重新定时以不断触发SIGALRM信号
-void timer_handler()
-{
-    timer_lst.tick();
-    alarm(TIMESLOT);
-}
-
-//定时器回调函数，删除非活动连接在socket上的注册事件，并关闭
-void cb_func(client_data *user_data)
-{
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
-    assert(user_data);
-    close(user_data->sockfd);
-    http_conn::m_user_count--;
-    LOG_INFO("close fd %d", user_data->sockfd);
-    Log::get_instance()->flush();
-}
+int main( int argc, char* argv[] ) {
 
-void show_error(int connfd,const char* info){
-    printf("%s",info);
-    send(connfd,info,strlen(info),0);
-    close(connfd);
-}
+    //reactor的数量，1为单循环模式，0表示每个CPU核一个循环
+    int reactor_number = 1;
+    //是否使用工作窃取线程池代替threadpool
+    bool work_stealing = false;
+    //不小于该大小的文件用sendfile发送，0表示关闭sendfile
+    off_t sendfile_threshold = 256 * 1024;
+    //文件缓存的总字节数(0表示不缓存)，以及检查缓存文件是否被修改的间隔(秒)
+    size_t cache_capacity = 64 * 1024 * 1024;
+    int cache_check_interval = 1;
+    //压缩版本缓存的总字节数(0表示不压缩)，以及压缩级别
+    size_t compress_capacity = 16 * 1024 * 1024;
+    int compress_level = 6;
+    //读缓冲区的上限，请求头超过它时返回431
+    size_t max_request_size = 32 * 1024;
+    //日志级别(0 debug到3 error)，-1表示不写日志
+    int log_level = -1;
+    //日志模式：0 文本，1 后台线程格式化，2 二进制文件(用tools/log_decode查看)
+    int log_mode = Log::MODE_TEXT;
+    //日志队列满时的策略，默认按级别丢弃，写日志不会阻塞处理请求的线程
+    int log_policy = Log::POLICY_DROP_LEVEL;
+    //写满的日志文件是否压缩
+    bool log_compress = false;
+    //是否写访问日志
+    bool access_log = false;
+    //网站的根目录
+    std::string doc_root = http_conn::m_doc_root;
+    //监听socket的连接队列长度，突发的新连接超过它时SYN被丢弃，客户端要等1秒后重传
+    int backlog = 1024;
+    //多reactor模式下新连接的分配方式：
+    //0 每个reactor一个SO_REUSEPORT监听socket，内核按四元组哈希分配
+    //1 同上，但用CBPF程序按收到SYN的CPU分配，并把第i个reactor绑定到第i个CPU
+    //2 所有reactor共享一个监听socket，用EPOLLEXCLUSIVE注册，每个新连接只唤醒一个循环
+    int accept_mode = 0;
+    //连接用不带EPOLLONESHOT的边缘触发注册，每个请求不再需要epoll_ctl
+    bool edge_triggered = false;
+    //用io_uring代替epoll和recv/sendmsg，内核不支持时退回epoll
+    bool use_uring = false;
+    //每个连接的请求数上限(0表示不限)、空闲长连接的超时和收完请求头的时限(秒)、传输的最低速率(字节/秒)
+    int max_requests = 1000;
+    int keepalive_timeout = 15;
+    int header_timeout = 10;
+    int min_rate = 512;
+    //连接数上限，0表示按文件描述符的限制自动设置
+    int max_connections = 0;
+    //上传目录，为空时不接受POST和PUT；请求体的上限
+    const char* upload_dir = NULL;
+    long long max_body_size = 64 * 1024 * 1024;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:wz:c:i:g:G:m:l:L:O:Zad:b:A:EUk:K:T:R:M:u:B:")) != -1) {
+        switch (opt) {
+        case 'r':
+            reactor_number = atoi(optarg);
+            break;
+        case 'w':
+            work_stealing = true;
+            break;
+        case 'z':
+            sendfile_threshold = atol(optarg);
+            break;
+        case 'c':
+            cache_capacity = atol(optarg);
+            break;
+        case 'i':
+            cache_check_interval = atoi(optarg);
+            break;
+        case 'g':
+            compress_capacity = atol(optarg);
+            break;
+        case 'G':
+            compress_level = atoi(optarg);
+            break;
+        case 'm':
+            max_request_size = atol(optarg);
+            break;
+        case 'l':
+            log_level = atoi(optarg);
+            break;
+        case 'L':
+            log_mode = atoi(optarg);
+            break;
+        case 'O':
+            log_policy = atoi(optarg);
+            break;
+        case 'Z':
+            log_compress = true;
+            break;
+        case 'a':
+            access_log = true;
+            break;
+        case 'd':
+            doc_root = optarg;
+            break;
+        case 'b':
+            backlog = atoi(optarg);
+            break;
+        case 'A':
+            accept_mode = atoi(optarg);
+            break;
+        case 'E':
+            edge_triggered = true;
+            break;
+        case 'U':
+            use_uring = true;
+            break;
+        case 'k':
+            max_requests = atoi(optarg);
+            break;
+        case 'K':
+            keepalive_timeout = atoi(optarg);
+            break;
+        case 'T':
+            header_timeout = atoi(optarg);
+            break;
+        case 'R':
+            min_rate = atoi(optarg);
+            break;
+        case 'M':
+            max_connections = atoi(optarg);
+            break;
+        case 'u':
+            upload_dir = optarg;
+            break;
+        case 'B':
+            max_body_size = atoll(optarg);
+            break;
+        default:
+            break;
+        }
+    }
 
-int main( int argc, char* argv[] ) {
-    
-    if( argc <= 1 ) {
-        printf( "usage: %s port_number\n", basename(argv[0]));
+    if( optind >= argc ) {
+        printf( "usage: %s [-r reactor_number] [-w] [-z sendfile_threshold] [-c cache_bytes] [-i cache_check_interval] [-g compress_cache_bytes] [-G compress_level] [-m max_request_size] [-l log_level] [-L log_mode] [-O log_overflow_policy] [-Z] [-a] [-d doc_root] [-b backlog] [-A accept_mode] [-E] [-U] [-k max_requests] [-K keepalive_timeout] [-T header_timeout] [-R min_rate] [-M max_connections] [-u upload_dir] [-B max_body_size] port_number\n", basename(argv[0]));
         return 1;
     }
 
-    int port = atoi( argv[1] );         //获取端口号
-    addsig( SIGPIPE, SIG_IGN );         //对SIGPIE信号进行处理
-
-    //创建线程池
-    threadpool< http_conn >* pool = NULL;
-    try {
-        pool = new threadpool<http_conn>;
-    } catch( ... ) {
+    int port = atoi( argv[optind] );         //获取端口号
+    //URL以'/'开头，根目录去掉结尾的'/'后直接与URL拼接
+    while (doc_root.size() > 1 && doc_root[doc_root.size() - 1] == '/') {
+        doc_root.erase(doc_root.size() - 1);
+    }
+    if (doc_root.size() + 1 >= (size_t)http_conn::FILENAME_LEN) {
+        printf( "doc_root is too long\n" );
         return 1;
     }
+    http_conn::m_doc_root = doc_root.c_str();
+    if (reactor_number <= 0) {
+        reactor_number = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    addsig( SIGPIPE, SIG_IGN );         //对SIGPIE信号进行处理
 
-    http_conn* users = new http_conn[ MAX_FD ];     //创建数组用于保存所有的客户端信息
-    assert(users);
-    int user_count=0;
-
-    int listenfd = socket( PF_INET, SOCK_STREAM, 0 );//监听文件描述符
-    assert(listenfd>=0);  
-
-    struct linger tmp={1,0};
-    //SO_LINGER若有数据待发送，延迟关闭
-    setsockopt(listenfd,SOL_SOCKET,SO_LINGER,&tmp,sizeof(tmp));
+    file_cache::get_instance()->init(cache_capacity, cache_check_interval, sendfile_threshold);
+    file_cache::get_instance()->init_compression(compress_capacity, compress_level);
+    if (log_level >= 0) {
+        //异步日志，写到./log目录
+        if (log_mode < Log::MODE_TEXT || log_mode > Log::MODE_BINARY) {
+            log_mode = Log::MODE_TEXT;
+        }
+        Log::Instance()->SetCompress(log_compress);
+        Log::Instance()->init(log_level, "./log", log_mode == Log::MODE_BINARY ? ".blog" : ".log", 1024,
+                              (Log::MODE)log_mode);
+        if (log_policy < Log::POLICY_BLOCK || log_policy > Log::POLICY_SAMPLE) {
+            log_policy = Log::POLICY_DROP_LEVEL;
+        }
+        Log::Instance()->SetOverflowPolicy((Log::POLICY)log_policy);
+    }
+    if (access_log) {
+        //访问日志由后台线程格式化成制表符分隔的行，写到./log/*.access.log，队列满时丢弃
+        Log::Access()->SetCompress(log_compress);
+        Log::Access()->init(1, "./log", ".access.log", 1024, Log::MODE_DEFERRED);
+        Log::Access()->SetOverflowPolicy(Log::POLICY_DROP_NEWEST);
+        http_conn::m_access_log = true;
+    }
+    http_conn::m_max_request_size = max_request_size;
+    http_conn::m_edge_triggered = edge_triggered;
+    http_conn::m_max_requests = max_requests > 0 ? max_requests : 0;
+    http_conn::m_keepalive_timeout = keepalive_timeout > 0 ? keepalive_timeout : 1;
+    http_conn::m_header_timeout = header_timeout > 0 ? header_timeout : 1;
+    http_conn::m_min_rate = min_rate > 0 ? min_rate : 0;
+    if (max_connections <= 0) {
+        //给监听socket、缓存的文件和日志等留出一些文件描述符，连接数先于描述符耗尽达到上限
+        struct rlimit rl;
+        max_connections = MAX_FD;
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < (rlim_t)MAX_FD + 64) {
+            max_connections = rl.rlim_cur > 128 ? (int)rl.rlim_cur - 64 : (int)rl.rlim_cur / 2;
+        }
+    }
+    http_conn::m_max_connections = max_connections < MAX_FD ? max_connections : MAX_FD;
+    http_conn::m_max_body_size = max_body_size > 0 ? max_body_size : 0;
+    if (upload_dir) {
+        //POST和PUT的请求体流式写入上传目录
+        if (!spool_handler::init(upload_dir)) {
+            printf( "cannot open upload_dir %s\n", upload_dir );
+            return 1;
+        }
+        http_conn::m_new_body_handler = spool_handler::create;
+    }
+    if (use_uring && !uring_reactor::supported()) {
+        printf( "io_uring is not supported by the kernel, falling back to epoll\n" );
+        use_uring = false;
+    }
+    //渲染固定的应答块
+    http_response::init();
+    //选定请求解析使用的指令集
+    http_parser::init();
+
+    //创建线程池；io_uring后端在自己的线程中解析和应答，不需要工作线程
+    task_pool< http_conn >* pool = NULL;
+    if (!use_uring) {
+        try {
+            if (work_stealing) {
+                pool = new ws_threadpool<http_conn>;
+            } else {
+                pool = new threadpool<http_conn>;
+            }
+        } catch( ... ) {
+            return 1;
+        }
+    }
 
-    int ret = 0;
-    struct sockaddr_in address;
-    bzero(&address,sizeof(address));
-    address.sin_addr.s_addr =htonl(INADDR_ANY) ;
-    address.sin_family = AF_INET;
-    address.sin_port = htons( port );
+    //在输出时求值的指标，必须在处理请求之前注册
+    metrics::add_gauge("webserver_connections", "Open client connections.", "gauge",
+                       [] { return (double)http_conn::m_user_count.load(); });
+    if (pool) {
+        metrics::add_gauge("webserver_threadpool_queued", "Requests waiting for a worker thread.", "gauge",
+                           [pool] { return (double)pool->queued(); });
+    }
+    static const char* const LOG_LEVELS[] = {"debug", "info", "warn", "error"};
+    for (int i = 0; i < 4; ++i) {
+        std::string name = std::string("webserver_log_dropped_total{log=\"server\",level=\"") + LOG_LEVELS[i] + "\"}";
+        metrics::add_gauge(name.c_str(), "Log records dropped because the log ring was full.", "counter",
+                           [i] { return (double)Log::Instance()->GetDropped(i); });
+    }
+    metrics::add_gauge("webserver_log_dropped_total{log=\"access\",level=\"info\"}",
+                       "Log records dropped because the log ring was full.", "counter",
+                       [] { return (double)Log::Access()->GetDropped(1); });
 
-    // 端口复用
-    int reuse = 1;
-    setsockopt( listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof( reuse ) );
-    ret = bind( listenfd, ( struct sockaddr* )&address, sizeof( address ) );
-    assert(ret >= 0);
-    ret = listen( listenfd, 5 );
-    assert(ret >= 0);
+    //创建数组用于保存所有的客户端信息；calloc得到的大块内存按需映射清零的页，没用到的下标不占物理内存，
+    //http_conn的构造函数是平凡的，全0就是空闲连接的状态
+    http_conn* users = static_cast<http_conn*>(calloc(MAX_FD, sizeof(http_conn)));
+    assert(users);
 
-    // 创建epoll对象，和事件数组，添加
-    epoll_event events[ MAX_EVENT_NUMBER ];
-    epollfd = epoll_create( 5 );
-    assert(epollfd != -1);
-   
-    // 添加到epoll对象中
-    addfd( epollfd, listenfd, false );
-    http_conn::m_epollfd = epollfd;
+    //用户定时器数组
+    client_data *users_timer = new client_data[MAX_FD];
 
     //创建管道套接字
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
+    int ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
     assert(ret != -1);
     //设置管道写端非阻塞
     setnonblocking(pipefd[1]);
 
-    //设置管道读端为ET非阻塞
-    addfd(epollfd, pipefd[0], false);
-
-    //传递给主循环的信号值，这里只关注SIGALRM和SIGTERM  
-    addsig(SIGALRM, sig_handler, false);
+    //传递给主循环的信号值，定时由各reactor的timerfd驱动，这里只关注SIGTERM
     addsig(SIGTERM, sig_handler, false);
-    
-    //用户定时器数组
-    client_data *users_timer = new client_data[MAX_FD];
 
-    //超时标志
-    bool timeout = false;
-
-    //每隔TIMESLOT时间触发SIGALRM信号
-    alarm(TIMESLOT);
-
-    //循环条件
-    bool stop_server = false;
-    while(!stop_server) {
-        //监测发生事件的文件描述符
-        int number = epoll_wait( epollfd, events, MAX_EVENT_NUMBER, -1 );
-        
-        if ( ( number < 0 ) && ( errno != EINTR ) ) {
-            printf( "epoll failure\n" );
-            break;
+    if (reactor_number == 1) {
+        //单循环模式：主线程直接运行事件循环，自己处理信号管道
+        int listenfd = reactor::open_listenfd(port, false, backlog);
+        reactor *main_reactor;
+        if (use_uring) {
+            main_reactor = new uring_reactor(listenfd, pipefd[0], users, users_timer);
+        } else {
+            main_reactor = new reactor(listenfd, pipefd[0], pool, users, users_timer);
+        }
+        main_reactor->loop();
+        delete main_reactor;
+        close( listenfd );
+    } else {
+        //多循环模式：每个reactor一个线程，各自持有SO_REUSEPORT监听socket和信号管道，
+        //主线程只负责把收到的信号值转发给所有循环
+        reactor **reactors = new reactor*[reactor_number];
+        int *listenfds = new int[reactor_number];
+        int (*sigpipes)[2] = new int[reactor_number][2];
+        pthread_t *threads = new pthread_t[reactor_number];
+        bool shared = accept_mode == 2;
+        for (int i = 0; i < reactor_number; ++i) {
+            if (shared) {
+                listenfds[i] = i == 0 ? reactor::open_listenfd(port, false, backlog) : listenfds[0];
+            } else {
+                listenfds[i] = reactor::open_listenfd(port, true, backlog);
+            }
+            ret = socketpair(PF_UNIX, SOCK_STREAM, 0, sigpipes[i]);
+            assert(ret != -1);
+            setnonblocking(sigpipes[i][1]);
+            if (use_uring) {
+                //共享的监听socket上每个循环各有一个多次触发的accept，由内核选择完成哪一个
+                reactors[i] = new uring_reactor(listenfds[i], sigpipes[i][0], users, users_timer);
+            } else {
+                reactors[i] = new reactor(listenfds[i], sigpipes[i][0], pool, users, users_timer, shared);
+            }
+        }
+        bool steering = accept_mode == 1;
+        if (steering && !reactor::attach_cpu_steering(listenfds[0], reactor_number)) {
+            printf( "SO_ATTACH_REUSEPORT_CBPF failed, falling back to hashing\n" );
+            steering = false;
+        }
+        int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        for (int i = 0; i < reactor_number; ++i) {
+            printf( "create the %dth reactor\n", i);
+            ret = pthread_create(threads + i, NULL, reactor::worker, reactors[i]);
+            assert(ret == 0);
+            if (steering) {
+                //第i个socket收到的是CPU i上处理的连接，reactor也在该CPU上运行
+                cpu_set_t cpuset;
+                CPU_ZERO(&cpuset);
+                CPU_SET(i % cpus, &cpuset);
+                pthread_setaffinity_np(threads[i], sizeof(cpuset), &cpuset);
+            }
         }
-        //轮询文件描述符
-        for ( int i = 0; i < number; i++ ) {
-            
-            int sockfd = events[i].data.fd;
-            
-            //处理新到的客户连接
-            if( sockfd == listenfd ) {
-                
-                //初始化客户端连接地址
-                struct sockaddr_in client_address;
-                socklen_t client_addrlength = sizeof( client_address );
-#ifdef listenfdLT
-                //该连接分配的文件描述符
-                int connfd = accept( listenfd, ( struct sockaddr* )&client_address, &client_addrlength );
-                
-                if (connfd < 0)
-                {
-                    printf("errno is:%d",errno);
-                    LOG_ERROR("%s:errno is:%d", "accept error", errno);
-                    continue;
-                }
-                if (http_conn::m_user_count >= MAX_FD)
-                {
-                    show_error(connfd, "Internal server busy");
-                    printf("Internal server busy");
-                    LOG_ERROR("%s", "Internal server busy");
-                    continue;
-                }
-                users[connfd].init(connfd, client_address);
-                
-                
-                //初始化该连接对应的连接资源(client_data数据)
-                //创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到链表中
-                users_timer[connfd].address = client_address;
-                users_timer[connfd].sockfd = connfd;
-                //创建定时器临时变量
-                util_timer *timer = new util_timer;
-                //设置定时器对应的连接资源
-                timer->user_data = &users_timer[connfd];
-                //设置回调函数
-                timer->cb_func = cb_func;
-
-                time_t cur = time(NULL);
-
-                //设置绝对超时时间
-                timer->expire = cur + 3 * TIMESLOT;
-                //创建该连接对应的定时器，初始化为前述临时变量
-                users_timer[connfd].timer = timer;
-                //将该定时器添加到链表中
-                timer_lst.add_timer(timer);
-#endif
-
-#ifdef listenfdET
-                while(1){
-                    int connfd = accept(listenfd, (struct sockaddr *)&client_address, &client_addrlength);
-                    if (connfd < 0)
-                    {
-                        printf( "errno is: %d\n", errno );
-                        LOG_ERROR("%s:errno is:%d", "accept error", errno);
-                        break;
-                    }
-                    if (http_conn::m_user_count >= MAX_FD)
-                    {
-
-                        show_error(connfd, "Internal server busy");
-                        //LOG_ERROR("%s", "Internal server busy");
-                        break;
-                    }
-                    users[connfd].init(connfd, client_address);
-                    //初始化client_data数据
-                    //创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到链表中
-                    users_timer[connfd].address = client_address;
-                    users_timer[connfd].sockfd = connfd;
-                    util_timer *timer = new util_timer;
-                    timer->user_data = &users_timer[connfd];
-                    timer->cb_func = cb_func;
-                    time_t cur = time(NULL);
-                    timer->expire = cur + 3 * TIMESLOT;
-                    users_timer[connfd].timer = timer;
-                    timer_lst.add_timer(timer);
 
-                }
+        bool stop_server = false;
+        while (!stop_server) {
+            char signals[1024];
+            ret = recv(pipefd[0], signals, sizeof(signals), 0);
+            if (ret <= 0) {
                 continue;
-#endif               
-              /* if ( connfd < 0 ) {
-                    printf( "errno is: %d\n", errno );
-                    continue;
-                } 
-
-                if( http_conn::m_user_count >= MAX_FD ) {//目前连接数满了//发送客户端，服务器正忙。
-                    close(connfd);
-                    continue;
-                }
-                users[connfd].init( connfd, client_address);
-                */
-
-            } else if( events[i].events & ( EPOLLRDHUP | EPOLLHUP | EPOLLERR ) ) {
-
-                //服务器端关闭连接，移除对应的定时器
-                util_timer *timer = users_timer[sockfd].timer;
-                timer->cb_func(&users_timer[sockfd]);
-
-                if (timer)
-                {
-                    timer_lst.del_timer(timer);
-                }
-                
-                //users[sockfd].close_conn();
-
-            } 
-                //管道读端对应文件描述符发生读事件
-            else if((sockfd == pipefd[0]) &&events[i].events & EPOLLIN) {
-
-                /*if(users[sockfd].read()) {
-                    pool->append(users + sockfd);
-                } else {
-                    users[sockfd].close_conn();
-                }*/
-
-                int sig;
-                char signals[1024];
-                //从管道读端读出信号值，成功返回字节数，失败返回-1
-                //正常情况下，这里的ret返回值总是1，只有14和15两个ASCII码对应的字符
-                ret = recv(pipefd[0], signals, sizeof(signals), 0);
-                if (ret == -1)
-                {
-                    continue;
-                }
-                else if (ret == 0)  //没信号
-                {
-                    continue;
-                }
-                else
-                {
-                    //处理信号对应逻辑
-                    for (int i = 0; i < ret; ++i)
-                    {
-                        switch (signals[i])
-                        {
-                        case SIGALRM:
-                        {
-                            timeout = true;
-                            break;
-                        }
-                        case SIGTERM:
-                        {
-                            stop_server = true;
-                        }
-                        }
-                    }
-                }
-
             }
-            //处理客户连接上接收到的数据
-            else if (events[i].events & EPOLLIN)
-            {
-                util_timer *timer = users_timer[sockfd].timer;
-                if (users[sockfd].read_once())
-                {
-                    LOG_INFO("deal with the client()");
-                    Log::get_instance()->flush();
-
-                    //若监测到读事件，将该事件放入请求队列
-                    pool->append(users + sockfd);
-
-                    //若有数据传输，则将定时器往后延迟3个单位
-                    //并对新的定时器在链表上的位置进行调整
-                    if (timer)
-                    {
-                        time_t cur = time(NULL);
-                        timer->expire = cur + 3 * TIMESLOT;
-                        LOG_INFO("%s", "adjust timer once");
-                        Log::get_instance()->flush();
-                        timer_lst.adjust_timer(timer);
-                    }
+            for (int i = 0; i < ret; ++i) {
+                for (int j = 0; j < reactor_number; ++j) {
+                    send(sigpipes[j][1], signals + i, 1, 0);
                 }
-                else
-                {
-                    timer->cb_func(&users_timer[sockfd]);
-                    if (timer)
-                    {
-                        timer_lst.del_timer(timer);
-                    }
+                if (signals[i] == SIGTERM) {
+                    stop_server = true;
                 }
             }
-            else if( events[i].events & EPOLLOUT ) {
-
-                /*if( !users[sockfd].write() ) {
-                    users[sockfd].close_conn();
-                }*/
-
-                util_timer *timer = users_timer[sockfd].timer;
-                if (users[sockfd].write())
-                {
-                    LOG_INFO("send data to the client()");
-                    Log::get_instance()->flush();
+        }
 
-                    //若有数据传输，则将定时器往后延迟3个单位
-                    //并对新的定时器在链表上的位置进行调整
-                    if (timer)
-                    {
-                        time_t cur = time(NULL);
-                        timer->expire = cur + 3 * TIMESLOT;
-                        LOG_INFO("%s", "adjust timer once");
-                        Log::get_instance()->flush();
-                        timer_lst.adjust_timer(timer);
-                    }
-                }
-                else
-                {
-                    timer->cb_func(&users_timer[sockfd]);
-                    if (timer)
-                    {
-                        timer_lst.del_timer(timer);
-                    }
-                }
+        for (int i = 0; i < reactor_number; ++i) {
+            pthread_join(threads[i], NULL);
+            delete reactors[i];
+            if (!shared || i == 0) {
+                close(listenfds[i]);
             }
+            close(sigpipes[i][0]);
+            close(sigpipes[i][1]);
         }
-        if (timeout)
-        {
-            timer_handler();
-            timeout = false;
-        }
+        delete [] threads;
+        delete [] sigpipes;
+        delete [] listenfds;
+        delete [] reactors;
     }
-    
-    close( epollfd );
-    close( listenfd );
+
     close(pipefd[1]);
     close(pipefd[0]);
-    delete [] users;
+    free(users);
     delete[] users_timer;
     delete pool;
     return 0;
@@ -0,0 +1,141 @@
+#include "mem_pool.h"
+
+//每个线程每个级别最多缓存的块数，以及与全局链表之间一次交换的块数
+static const int CACHE_SIZE = 64;
+static const int BATCH_SIZE = 32;
+
+//线程本地缓存
+struct thread_cache
+{
+    void *head[buffer_pool::CLASS_NUMBER];
+    int count[buffer_pool::CLASS_NUMBER];
+};
+
+static thread_local thread_cache t_cache;
+
+buffer_pool::buffer_pool()
+{
+    for (int i = 0; i < CLASS_NUMBER; ++i)
+    {
+        m_free[i] = NULL;
+    }
+}
+
+int buffer_pool::size_class(size_t size)
+{
+    int cls = 0;
+    size_t cap = MIN_CLASS_SIZE;
+    while (cap < size)
+    {
+        cap <<= 1;
+        ++cls;
+    }
+    return cls;
+}
+
+size_t buffer_pool::class_size(size_t size)
+{
+    if (size > MAX_CLASS_SIZE)
+    {
+        return size;
+    }
+    return MIN_CLASS_SIZE << size_class(size);
+}
+
+int buffer_pool::fetch(int cls, free_block *&list, int count)
+{
+    m_lockers[cls].lock();
+    if (!m_free[cls])
+    {
+        //全局链表为空，按批量大小申请一个slab并切分成块
+        size_t block = MIN_CLASS_SIZE << cls;
+        char *slab = static_cast<char *>(malloc(block * BATCH_SIZE));
+        if (!slab)
+        {
+            m_lockers[cls].unlock();
+            return 0;
+        }
+        for (int i = BATCH_SIZE - 1; i >= 0; --i)
+        {
+            free_block *b = reinterpret_cast<free_block *>(slab + i * block);
+            b->next = m_free[cls];
+            m_free[cls] = b;
+        }
+    }
+    int n = 0;
+    while (n < count && m_free[cls])
+    {
+        free_block *b = m_free[cls];
+        m_free[cls] = b->next;
+        b->next = list;
+        list = b;
+        ++n;
+    }
+    m_lockers[cls].unlock();
+    return n;
+}
+
+void buffer_pool::release(int cls, free_block *list, int count)
+{
+    //先在锁外找到链表尾，再一次性挂到全局链表头部
+    free_block *tail = list;
+    for (int i = 1; i < count; ++i)
+    {
+        tail = tail->next;
+    }
+    m_lockers[cls].lock();
+    tail->next = m_free[cls];
+    m_free[cls] = list;
+    m_lockers[cls].unlock();
+}
+
+char *buffer_pool::allocate(size_t size)
+{
+    if (size > MAX_CLASS_SIZE)
+    {
+        return static_cast<char *>(malloc(size));
+    }
+    int cls = size_class(size);
+    free_block *head = static_cast<free_block *>(t_cache.head[cls]);
+    if (!head)
+    {
+        t_cache.count[cls] = fetch(cls, head, BATCH_SIZE);
+        if (!head)
+        {
+            return NULL;
+        }
+    }
+    t_cache.head[cls] = head->next;
+    --t_cache.count[cls];
+    return reinterpret_cast<char *>(head);
+}
+
+void buffer_pool::deallocate(char *buf, size_t size)
+{
+    if (!buf)
+    {
+        return;
+    }
+    if (size > MAX_CLASS_SIZE)
+    {
+        free(buf);
+        return;
+    }
+    int cls = size_class(size);
+    free_block *b = reinterpret_cast<free_block *>(buf);
+    b->next = static_cast<free_block *>(t_cache.head[cls]);
+    t_cache.head[cls] = b;
+    //缓冲区常在reactor线程取出、在工作线程归还，缓存满时把一半还给全局链表
+    if (++t_cache.count[cls] >= CACHE_SIZE)
+    {
+        free_block *list = b;
+        free_block *last = b;
+        for (int i = 1; i < BATCH_SIZE; ++i)
+        {
+            last = last->next;
+        }
+        t_cache.head[cls] = last->next;
+        t_cache.count[cls] -= BATCH_SIZE;
+        release(cls, list, BATCH_SIZE);
+    }
+}
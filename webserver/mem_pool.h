@@ -0,0 +1,126 @@
+#ifndef MEM_POOL_H
+#define MEM_POOL_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <new>
+#include <vector>
+#include "locker.h"
+
+//对象池，按slab批量申请内存，释放的对象挂在空闲链表上复用
+//不加锁，只能由一个线程使用，例如每个reactor各自的定时器结点
+template<typename T>
+class object_pool
+{
+public:
+    explicit object_pool(size_t slab_size = 256) : m_slab_size(slab_size), m_free(NULL) {}
+
+    ~object_pool()
+    {
+        for (size_t i = 0; i < m_slabs.size(); ++i)
+        {
+            free(m_slabs[i]);
+        }
+    }
+
+    //取出一个对象并调用默认构造函数
+    T *allocate()
+    {
+        if (!m_free)
+        {
+            grow();
+        }
+        node *n = m_free;
+        m_free = n->next;
+        return new (n->storage) T();
+    }
+
+    //析构对象并放回空闲链表
+    void deallocate(T *obj)
+    {
+        if (!obj)
+        {
+            return;
+        }
+        obj->~T();
+        node *n = reinterpret_cast<node *>(obj);
+        n->next = m_free;
+        m_free = n;
+    }
+
+private:
+    union node
+    {
+        node *next;
+        alignas(T) char storage[sizeof(T)];
+    };
+
+    //申请一个新的slab，把其中所有结点串到空闲链表上
+    void grow()
+    {
+        node *slab = static_cast<node *>(malloc(sizeof(node) * m_slab_size));
+        if (!slab)
+        {
+            throw std::bad_alloc();
+        }
+        m_slabs.push_back(slab);
+        for (size_t i = 0; i < m_slab_size; ++i)
+        {
+            slab[i].next = m_free;
+            m_free = &slab[i];
+        }
+    }
+
+private:
+    size_t m_slab_size;
+    node *m_free;
+    std::vector<node *> m_slabs;
+};
+
+//按大小分级的缓冲区池，连接只在处理请求期间持有读写缓冲区，处理完归还
+//每个线程有自己的缓存，缓存空或满时才与全局空闲链表批量交换，全局链表由互斥锁保护
+class buffer_pool
+{
+public:
+    static buffer_pool *get_instance()
+    {
+        static buffer_pool instance;
+        return &instance;
+    }
+
+    //分配不小于size字节的缓冲区，实际大小为所在级别的大小
+    char *allocate(size_t size);
+
+    //归还缓冲区，size必须与分配时传入的大小属于同一级别
+    void deallocate(char *buf, size_t size);
+
+    //size对应级别的实际缓冲区大小
+    static size_t class_size(size_t size);
+
+    //最小级别1KB，每级翻倍，最大64KB，更大的请求直接使用malloc
+    static const int CLASS_NUMBER = 7;
+    static const size_t MIN_CLASS_SIZE = 1024;
+    static const size_t MAX_CLASS_SIZE = MIN_CLASS_SIZE << (CLASS_NUMBER - 1);
+
+private:
+    buffer_pool();
+
+    struct free_block
+    {
+        free_block *next;
+    };
+
+    static int size_class(size_t size);
+
+    //从全局链表取最多count块挂到list上，全局链表为空时申请新的slab，返回取到的块数
+    int fetch(int cls, free_block *&list, int count);
+
+    //把list上的count块放回全局链表
+    void release(int cls, free_block *list, int count);
+
+private:
+    locker m_lockers[CLASS_NUMBER];
+    free_block *m_free[CLASS_NUMBER];
+};
+
+#endif
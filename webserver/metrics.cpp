@@ -0,0 +1,275 @@
+#include "metrics.h"
+#include <stdio.h>
+#include <stdarg.h>
+
+std::atomic<metrics::shard *> metrics::m_shards[MAX_SHARDS];
+std::atomic<int> metrics::m_shard_count(0);
+metrics::shard metrics::m_shared;
+std::vector<metrics::gauge> metrics::m_gauges;
+
+metrics::shard *metrics::local()
+{
+    static thread_local shard *t_shard = NULL;
+    if (!t_shard)
+    {
+        int index = m_shard_count.fetch_add(1, std::memory_order_relaxed);
+        if (index < MAX_SHARDS)
+        {
+            //new出来的atomic没有初始化，逐个清零后再发布
+            shard *s = new shard;
+            for (int i = 0; i < COUNTER_NUMBER; ++i)
+                s->counters[i].store(0, std::memory_order_relaxed);
+            for (int i = 0; i < MAX_STATUS; ++i)
+                s->status[i].store(0, std::memory_order_relaxed);
+            for (int i = 0; i < BUCKET_NUMBER; ++i)
+                s->buckets[i].store(0, std::memory_order_relaxed);
+            s->latency_sum.store(0, std::memory_order_relaxed);
+            m_shards[index].store(s, std::memory_order_release);
+            t_shard = s;
+        }
+        else
+        {
+            t_shard = &m_shared;
+        }
+    }
+    return t_shard;
+}
+
+void metrics::bump(const shard *s, std::atomic<int64_t> &v, int64_t n)
+{
+    if (s == &m_shared)
+    {
+        v.fetch_add(n, std::memory_order_relaxed);
+    }
+    else
+    {
+        //分片只由所属线程修改
+        v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+}
+
+void metrics::add(COUNTER c, int64_t n)
+{
+    shard *s = local();
+    bump(s, s->counters[c], n);
+}
+
+void metrics::set(COUNTER c, int64_t v)
+{
+    shard *s = local();
+    if (s == &m_shared)
+    {
+        //共用分片中的值无法区分线程，只累加
+        return;
+    }
+    s->counters[c].store(v, std::memory_order_relaxed);
+}
+
+void metrics::status(int code)
+{
+    shard *s = local();
+    if (code < 0 || code >= MAX_STATUS)
+    {
+        code = 0;
+    }
+    bump(s, s->status[code], 1);
+}
+
+int metrics::bucket(int64_t ns)
+{
+    if (ns < 8)
+    {
+        return ns < 0 ? 0 : ns;
+    }
+    int e = 63 - __builtin_clzll(ns);
+    int index = (e - 2) * 8 + ((ns >> (e - 3)) & 7);
+    return index < BUCKET_NUMBER ? index : BUCKET_NUMBER - 1;
+}
+
+//桶中值的上界(不含)
+int64_t metrics::bucket_upper(int index)
+{
+    if (index < 8)
+    {
+        return index + 1;
+    }
+    int e = index / 8 + 2;
+    return (int64_t)(9 + index % 8) << (e - 3);
+}
+
+void metrics::latency(int64_t ns)
+{
+    shard *s = local();
+    bump(s, s->buckets[bucket(ns)], 1);
+    bump(s, s->latency_sum, ns);
+}
+
+int64_t metrics::get(COUNTER c)
+{
+    int64_t sum = m_shared.counters[c].load(std::memory_order_relaxed);
+    int n = m_shard_count.load(std::memory_order_relaxed);
+    for (int i = 0; i < n && i < MAX_SHARDS; ++i)
+    {
+        shard *s = m_shards[i].load(std::memory_order_acquire);
+        if (s)
+        {
+            sum += s->counters[c].load(std::memory_order_relaxed);
+        }
+    }
+    return sum;
+}
+
+void metrics::add_gauge(const char *name, const char *help, const char *type, std::function<double()> fn)
+{
+    gauge g;
+    g.name = name;
+    g.help = help;
+    g.type = type;
+    g.fn = fn;
+    m_gauges.push_back(g);
+}
+
+//输出一个指标族的HELP和TYPE，name中的标签部分不输出
+static void append_family(std::string &out, const std::string &name, const char *help, const char *type)
+{
+    std::string family = name.substr(0, name.find('{'));
+    out += "# HELP " + family + " " + help + "\n";
+    out += "# TYPE " + family + " " + type + "\n";
+}
+
+static void append_value(std::string &out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void append_value(std::string &out, const char *format, ...)
+{
+    char line[256];
+    va_list ap;
+    va_start(ap, format);
+    int n = vsnprintf(line, sizeof(line), format, ap);
+    va_end(ap);
+    if (n > 0)
+    {
+        out.append(line, (size_t)n < sizeof(line) ? n : sizeof(line) - 1);
+    }
+}
+
+std::string metrics::render()
+{
+    //汇总所有分片
+    int64_t counters[COUNTER_NUMBER] = {0};
+    static thread_local int64_t status[MAX_STATUS];
+    static thread_local int64_t buckets[BUCKET_NUMBER];
+    int64_t latency_sum = 0;
+    for (int i = 0; i < MAX_STATUS; ++i)
+        status[i] = 0;
+    for (int i = 0; i < BUCKET_NUMBER; ++i)
+        buckets[i] = 0;
+    int n = m_shard_count.load(std::memory_order_relaxed);
+    if (n > MAX_SHARDS)
+    {
+        n = MAX_SHARDS;
+    }
+    for (int k = -1; k < n; ++k)
+    {
+        shard *s = k < 0 ? &m_shared : m_shards[k].load(std::memory_order_acquire);
+        if (!s)
+        {
+            continue;
+        }
+        for (int i = 0; i < COUNTER_NUMBER; ++i)
+            counters[i] += s->counters[i].load(std::memory_order_relaxed);
+        for (int i = 0; i < MAX_STATUS; ++i)
+            status[i] += s->status[i].load(std::memory_order_relaxed);
+        for (int i = 0; i < BUCKET_NUMBER; ++i)
+            buckets[i] += s->buckets[i].load(std::memory_order_relaxed);
+        latency_sum += s->latency_sum.load(std::memory_order_relaxed);
+    }
+
+    std::string out;
+    out.reserve(8192);
+    static const struct
+    {
+        const char *name;
+        const char *help;
+        const char *type;
+    } COUNTER_INFO[COUNTER_NUMBER] = {
+        {"webserver_requests_total", "Requests answered.", "counter"},
+        {"webserver_response_bytes_total", "Response bytes sent.", "counter"},
+        {"webserver_accepted_total", "Connections accepted.", "counter"},
+        {"webserver_accept_errors_total", "Failed or rejected accepts.", "counter"},
+        {"webserver_writes_total", "sendmsg/sendfile calls.", "counter"},
+        {"webserver_write_eagain_total", "Writes that found the socket buffer full.", "counter"},
+        {"webserver_timers", "Connection timers in the time wheels.", "gauge"},
+        {"webserver_timeouts_total", "Connections closed for idling or transferring too slowly.", "counter"},
+        {"webserver_evictions_total", "Idle keep-alive connections closed to admit new ones.", "counter"},
+    };
+    for (int i = 0; i < COUNTER_NUMBER; ++i)
+    {
+        append_family(out, COUNTER_INFO[i].name, COUNTER_INFO[i].help, COUNTER_INFO[i].type);
+        append_value(out, "%s %lld\n", COUNTER_INFO[i].name, (long long)counters[i]);
+    }
+
+    append_family(out, "webserver_responses_total", "Responses by status code.", "counter");
+    for (int i = 0; i < MAX_STATUS; ++i)
+    {
+        if (status[i])
+        {
+            append_value(out, "webserver_responses_total{code=\"%d\"} %lld\n", i, (long long)status[i]);
+        }
+    }
+
+    //直方图按2的幂纳秒输出累计桶，细分的桶用来计算分位数
+    int64_t count = 0;
+    for (int i = 0; i < BUCKET_NUMBER; ++i)
+        count += buckets[i];
+    append_family(out, "webserver_request_duration_seconds",
+                  "Time from reading a request to sending the last byte of its response.", "histogram");
+    int64_t cumulative = 0;
+    int next = 0;
+    for (int e = 10; e <= 36; ++e)
+    {
+        int64_t le = (int64_t)1 << e;
+        while (next < BUCKET_NUMBER && bucket_upper(next) <= le)
+        {
+            cumulative += buckets[next++];
+        }
+        append_value(out, "webserver_request_duration_seconds_bucket{le=\"%.9g\"} %lld\n", le / 1e9,
+                     (long long)cumulative);
+    }
+    append_value(out, "webserver_request_duration_seconds_bucket{le=\"+Inf\"} %lld\n", (long long)count);
+    append_value(out, "webserver_request_duration_seconds_sum %.9f\n", latency_sum / 1e9);
+    append_value(out, "webserver_request_duration_seconds_count %lld\n", (long long)count);
+
+    static const double QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+    append_family(out, "webserver_request_duration_quantile_seconds",
+                  "Request duration quantiles, upper bound of the histogram bucket.", "gauge");
+    for (size_t q = 0; q < sizeof(QUANTILES) / sizeof(QUANTILES[0]); ++q)
+    {
+        int64_t rank = (int64_t)(QUANTILES[q] * count + 0.5);
+        int64_t seen = 0;
+        int i = 0;
+        for (; i < BUCKET_NUMBER - 1; ++i)
+        {
+            seen += buckets[i];
+            if (seen >= rank && seen > 0)
+            {
+                break;
+            }
+        }
+        append_value(out, "webserver_request_duration_quantile_seconds{quantile=\"%g\"} %.9g\n", QUANTILES[q],
+                     count ? bucket_upper(i) / 1e9 : 0.0);
+    }
+
+    std::string last;
+    for (size_t i = 0; i < m_gauges.size(); ++i)
+    {
+        const gauge &g = m_gauges[i];
+        std::string family = g.name.substr(0, g.name.find('{'));
+        if (family != last)
+        {
+            append_family(out, g.name, g.help.c_str(), g.type.c_str());
+            last = family;
+        }
+        append_value(out, "%s %.17g\n", g.name.c_str(), g.fn());
+    }
+    return out;
+}
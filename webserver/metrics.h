@@ -0,0 +1,83 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
+//运行时指标
+//每个线程第一次记录时取得自己的分片，之后只修改自己的分片，不加锁也没有原子的读-改-写；
+//读取时把所有分片相加，/stats请求在工作线程上汇总并按Prometheus文本格式输出
+class metrics
+{
+public:
+    enum COUNTER
+    {
+        REQUESTS = 0,       //已应答的请求
+        RESPONSE_BYTES,     //已发送的应答字节数
+        ACCEPTED,           //accept的连接
+        ACCEPT_ERRORS,      //accept失败或者因连接数已满被拒绝
+        WRITES,             //发送应答的系统调用次数
+        WRITE_EAGAIN,       //发送时socket缓冲区已满
+        TIMERS,             //各reactor时间轮中的定时器数，每次tick时由reactor设置
+        TIMEOUTS,           //因超时或者传输太慢被关闭的连接
+        EVICTIONS,          //连接数达到上限时被淘汰的空闲长连接
+        COUNTER_NUMBER
+    };
+
+    //延迟直方图的桶数：小于8纳秒的值每个一桶，之后每个2的幂区间分成8个桶，相对误差不超过12.5%
+    static const int BUCKET_NUMBER = 320;
+    //记录的最大状态码
+    static const int MAX_STATUS = 600;
+    //最多的分片数，更多的线程共用一个用原子加法的分片
+    static const int MAX_SHARDS = 256;
+
+    static void add(COUNTER c, int64_t n = 1);
+    //设置本线程分片中的值，读取时所有线程的值相加
+    static void set(COUNTER c, int64_t v);
+    //一个应答的状态码
+    static void status(int code);
+    //一个请求从读完数据到应答发送完毕的时间
+    static void latency(int64_t ns);
+
+    //汇总所有分片
+    static int64_t get(COUNTER c);
+
+    //注册一个在输出时求值的指标，name可以带标签，如"webserver_log_dropped_total{level=\"info\"}"
+    //只能在启动时、处理请求之前调用
+    static void add_gauge(const char *name, const char *help, const char *type, std::function<double()> fn);
+
+    //按Prometheus文本格式输出所有指标
+    static std::string render();
+
+private:
+    struct shard
+    {
+        std::atomic<int64_t> counters[COUNTER_NUMBER];
+        std::atomic<int64_t> status[MAX_STATUS];
+        std::atomic<int64_t> buckets[BUCKET_NUMBER];
+        std::atomic<int64_t> latency_sum;
+    };
+
+    struct gauge
+    {
+        std::string name;
+        std::string help;
+        std::string type;
+        std::function<double()> fn;
+    };
+
+    static shard *local();
+    static void bump(const shard *s, std::atomic<int64_t> &v, int64_t n);
+    static int bucket(int64_t ns);
+    static int64_t bucket_upper(int index);
+
+    static std::atomic<shard *> m_shards[MAX_SHARDS];
+    static std::atomic<int> m_shard_count;
+    static shard m_shared;
+    static std::vector<gauge> m_gauges;
+};
+
+#endif
@@ -0,0 +1,161 @@
+#include "mime_types.h"
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#define MIME(ext, type, compressible) {ext, type, "Content-Type:" type "\r\n", compressible}
+
+static constexpr mime_types::entry ENTRIES[] = {
+    MIME("html", "text/html", true),
+    MIME("htm", "text/html", true),
+    MIME("shtml", "text/html", true),
+    MIME("css", "text/css", true),
+    MIME("js", "text/javascript", true),
+    MIME("mjs", "text/javascript", true),
+    MIME("json", "application/json", true),
+    MIME("map", "application/json", true),
+    MIME("webmanifest", "application/manifest+json", true),
+    MIME("xml", "text/xml", true),
+    MIME("rss", "application/rss+xml", true),
+    MIME("atom", "application/atom+xml", true),
+    MIME("txt", "text/plain", true),
+    MIME("csv", "text/csv", true),
+    MIME("md", "text/markdown", true),
+    MIME("svg", "image/svg+xml", true),
+    MIME("png", "image/png", false),
+    MIME("jpg", "image/jpeg", false),
+    MIME("jpeg", "image/jpeg", false),
+    MIME("gif", "image/gif", false),
+    MIME("webp", "image/webp", false),
+    MIME("avif", "image/avif", false),
+    MIME("ico", "image/x-icon", true),
+    MIME("bmp", "image/bmp", true),
+    MIME("woff", "font/woff", false),
+    MIME("woff2", "font/woff2", false),
+    MIME("ttf", "font/ttf", true),
+    MIME("otf", "font/otf", true),
+    MIME("eot", "application/vnd.ms-fontobject", true),
+    MIME("wasm", "application/wasm", true),
+    MIME("pdf", "application/pdf", false),
+    MIME("zip", "application/zip", false),
+    MIME("gz", "application/gzip", false),
+    MIME("tar", "application/x-tar", true),
+    MIME("mp4", "video/mp4", false),
+    MIME("webm", "video/webm", false),
+    MIME("mp3", "audio/mpeg", false),
+    MIME("ogg", "audio/ogg", false),
+    MIME("wav", "audio/wav", false),
+};
+
+static constexpr mime_types::entry DEFAULT_ENTRY = MIME("", "application/octet-stream", false);
+
+#undef MIME
+
+static constexpr int ENTRY_NUMBER = sizeof(ENTRIES) / sizeof(ENTRIES[0]);
+//哈希表大小是2的HASH_BITS次幂，不小于表项数的两倍，种子容易找到
+static constexpr int HASH_BITS = 7;
+static constexpr int HASH_SIZE = 1 << HASH_BITS;
+//比这更长的扩展名不可能在表中
+static constexpr size_t MAX_EXT_LEN = 16;
+static_assert(ENTRY_NUMBER * 2 <= HASH_SIZE && ENTRY_NUMBER < 255, "enlarge HASH_SIZE");
+
+//按小写计算FNV-1a哈希，种子参与初值；取高位作为槽号，低位只取决于种子的低位
+static constexpr uint32_t ext_hash(uint32_t seed, const char *ext, size_t len)
+{
+    uint32_t h = 2166136261u ^ seed;
+    for (size_t i = 0; i < len; ++i)
+    {
+        char c = ext[i];
+        if (c >= 'A' && c <= 'Z')
+        {
+            c += 'a' - 'A';
+        }
+        h = (h ^ (unsigned char)c) * 16777619u;
+    }
+    return h >> (32 - HASH_BITS);
+}
+
+static constexpr size_t ext_len(const char *ext)
+{
+    size_t n = 0;
+    while (ext[n])
+    {
+        ++n;
+    }
+    return n;
+}
+
+static constexpr bool collision_free(uint32_t seed)
+{
+    bool used[HASH_SIZE] = {};
+    for (int i = 0; i < ENTRY_NUMBER; ++i)
+    {
+        uint32_t h = ext_hash(seed, ENTRIES[i].ext, ext_len(ENTRIES[i].ext));
+        if (used[h])
+        {
+            return false;
+        }
+        used[h] = true;
+    }
+    return true;
+}
+
+//编译期从1开始找第一个不冲突的种子
+static constexpr uint32_t find_seed()
+{
+    for (uint32_t seed = 1; seed < 100000; ++seed)
+    {
+        if (collision_free(seed))
+        {
+            return seed;
+        }
+    }
+    return 0;
+}
+
+static constexpr uint32_t SEED = find_seed();
+static_assert(SEED != 0, "no collision-free seed for the MIME table");
+
+struct slot_table
+{
+    //表项下标加1，0表示空槽
+    unsigned char slot[HASH_SIZE];
+};
+
+static constexpr slot_table build_table()
+{
+    slot_table t = {};
+    for (int i = 0; i < ENTRY_NUMBER; ++i)
+    {
+        t.slot[ext_hash(SEED, ENTRIES[i].ext, ext_len(ENTRIES[i].ext))] = i + 1;
+    }
+    return t;
+}
+
+static constexpr slot_table TABLE = build_table();
+
+const mime_types::entry &mime_types::lookup(const char *path)
+{
+    const char *dot = strrchr(path, '.');
+    if (!dot || strchr(dot, '/'))
+    {
+        return DEFAULT_ENTRY;
+    }
+    const char *ext = dot + 1;
+    size_t len = strlen(ext);
+    if (len == 0 || len > MAX_EXT_LEN)
+    {
+        return DEFAULT_ENTRY;
+    }
+    int idx = TABLE.slot[ext_hash(SEED, ext, len)];
+    if (idx == 0)
+    {
+        return DEFAULT_ENTRY;
+    }
+    const entry &e = ENTRIES[idx - 1];
+    if (strlen(e.ext) != len || strncasecmp(e.ext, ext, len) != 0)
+    {
+        return DEFAULT_ENTRY;
+    }
+    return e;
+}
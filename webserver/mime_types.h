@@ -0,0 +1,22 @@
+#ifndef MIME_TYPES_H
+#define MIME_TYPES_H
+
+//按文件扩展名查找MIME类型
+//扩展名表在编译时建成完美哈希表：编译期搜索一个使所有扩展名都不冲突的哈希种子，
+//查找时只需计算一次哈希并比较一个表项；每个类型的Content-Type头部也预先写成字面量
+class mime_types
+{
+public:
+    struct entry
+    {
+        const char *ext;     //小写的扩展名，不含'.'
+        const char *type;    //MIME类型
+        const char *header;  //"Content-Type:类型\r\n"
+        bool compressible;   //内容是否值得压缩(文本、未压缩的图片和字体等)
+    };
+
+    //path的扩展名对应的类型，没有扩展名或者扩展名未知时返回application/octet-stream
+    static const entry &lookup(const char *path);
+};
+
+#endif
@@ -0,0 +1,528 @@
+#include "reactor.h"
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/timerfd.h>
+#include <linux/filter.h>
+#include <cassert>
+#include "log.h"
+#include "metrics.h"
+
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+
+//添加文件描述符到epoll中
+extern void addfd( int epollfd, int fd, bool one_shot );
+//从epoll中移除监听的文件描述符
+extern void removefd( int epollfd, int fd );
+
+extern int setnonblocking(int fd);
+
+//所有reactor共享的连接数组，定时器回调通过它归还连接占用的缓冲区
+static http_conn *s_users = NULL;
+
+//运行在本线程中的循环，定时器回调通过它重新添加定时器
+static thread_local reactor *t_loop = NULL;
+
+//定时器回调函数，删除非活动连接在socket上的注册事件，并关闭
+void cb_func(client_data *user_data)
+{
+    assert(user_data);
+    epoll_ctl(user_data->epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
+    close(user_data->sockfd);
+    s_users[user_data->sockfd].release_buffers();
+    //定时器结点随后由时间轮归还，连接不再引用它
+    user_data->timer = NULL;
+    http_conn::m_user_count--;
+    LOG_INFO("close fd %d", user_data->sockfd);
+}
+
+void reactor::show_error(int connfd,const char* info){
+    printf("%s",info);
+    send(connfd,info,strlen(info),0);
+    close(connfd);
+}
+
+reactor::reactor(int listenfd, int sigfd, http_conn *users, client_data *users_timer)
+    : m_listenfd(listenfd), m_sigfd(sigfd), m_epollfd(-1), m_timeout_cb(expire_cb), m_evict_miss(0), m_pool(NULL),
+      m_users(users), m_users_timer(users_timer)
+{
+    m_idlefd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    m_closepipe[0] = m_closepipe[1] = -1;
+
+    s_users = users;
+
+    // 每隔TICK_INTERVAL秒触发一次，由事件循环驱动时间轮，不再依赖alarm和SIGALRM
+    m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    assert(m_timerfd != -1);
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = TICK_INTERVAL;
+    its.it_interval.tv_sec = TICK_INTERVAL;
+    int ret = timerfd_settime(m_timerfd, 0, &its, NULL);
+    assert(ret == 0);
+}
+
+reactor::reactor(int listenfd, int sigfd, task_pool<http_conn> *pool,
+                 http_conn *users, client_data *users_timer, bool exclusive)
+    : reactor(listenfd, sigfd, users, users_timer)
+{
+    m_pool = pool;
+
+    // 每个reactor创建自己的epoll对象
+    m_epollfd = epoll_create(5);
+    assert(m_epollfd != -1);
+
+    // 监听socket(共享时除外)、信号管道读端和timerfd都只注册在本循环的epoll中
+    epoll_event event;
+    event.data.fd = m_listenfd;
+    event.events = EPOLLIN;
+#ifdef listenfdET
+    event.events |= EPOLLET;
+#endif
+    if (exclusive)
+    {
+        event.events |= EPOLLEXCLUSIVE;
+    }
+    int ret = epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_listenfd, &event);
+    assert(ret == 0);
+    addfd(m_epollfd, m_sigfd, false);
+    addfd(m_epollfd, m_timerfd, false);
+
+    // 读端非阻塞，写端保持阻塞，管道满时工作线程等待本循环读走
+    ret = pipe2(m_closepipe, O_CLOEXEC);
+    assert(ret == 0);
+    addfd(m_epollfd, m_closepipe[0], false);
+}
+
+reactor::~reactor()
+{
+    close(m_timerfd);
+    if (m_epollfd >= 0)
+    {
+        close(m_closepipe[0]);
+        close(m_closepipe[1]);
+        close(m_epollfd);
+    }
+    if (m_idlefd >= 0)
+    {
+        close(m_idlefd);
+    }
+}
+
+int reactor::open_listenfd(int port, bool reuseport, int backlog)
+{
+    int listenfd = socket( PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );//监听文件描述符
+    assert(listenfd>=0);
+
+    //关闭SO_LINGER，close后由内核在后台把剩余数据发完再断开
+    //{1,0}会使close直接发送RST，丢弃socket缓冲区中尚未发出的应答数据
+    struct linger tmp={0,1};
+    setsockopt(listenfd,SOL_SOCKET,SO_LINGER,&tmp,sizeof(tmp));
+
+    struct sockaddr_in address;
+    bzero(&address,sizeof(address));
+    address.sin_addr.s_addr =htonl(INADDR_ANY) ;
+    address.sin_family = AF_INET;
+    address.sin_port = htons( port );
+
+    // 端口复用
+    int reuse = 1;
+    setsockopt( listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof( reuse ) );
+    //多reactor模式下每个循环绑定同一端口，由内核在这些监听socket之间分配新连接
+    if (reuseport)
+    {
+        setsockopt( listenfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof( reuse ) );
+    }
+    int ret = bind( listenfd, ( struct sockaddr* )&address, sizeof( address ) );
+    assert(ret >= 0);
+    ret = listen( listenfd, backlog );
+    assert(ret >= 0);
+    return listenfd;
+}
+
+bool reactor::attach_cpu_steering(int listenfd, int group_size)
+{
+    struct sock_filter code[] = {
+        //A = 处理SYN的CPU编号
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU) },
+        //A = A % group_size
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t)group_size },
+        //返回值是组内socket的下标，按bind的先后顺序编号
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog prog;
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+    return setsockopt(listenfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == 0;
+}
+
+void *reactor::worker(void *arg)
+{
+    reactor *r = (reactor *)arg;
+    r->loop();
+    return r;
+}
+
+//timerfd到期，读出到期次数并处理时间轮上到期的定时器
+void reactor::timer_handler()
+{
+    uint64_t expirations;
+    if (::read(m_timerfd, &expirations, sizeof(expirations)) != sizeof(expirations))
+    {
+        return;
+    }
+    m_timer_lst.tick();
+    metrics::set(metrics::TIMERS, m_timer_lst.size());
+}
+
+//初始化该连接对应的连接资源(client_data数据)
+//创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到链表中
+void reactor::add_conn_timer(int connfd, const sockaddr_in &client_address, time_t expire)
+{
+    m_users_timer[connfd].address = client_address;
+    m_users_timer[connfd].sockfd = connfd;
+    m_users_timer[connfd].epollfd = m_epollfd;
+    m_users_timer[connfd].owner = this;
+    //从定时器容器的对象池取一个定时器结点
+    util_timer *timer = m_timer_lst.alloc_timer();
+    //设置定时器对应的连接资源
+    timer->user_data = &m_users_timer[connfd];
+    //设置回调函数
+    timer->cb_func = m_timeout_cb;
+
+    //设置绝对超时时间
+    timer->expire = expire;
+    //创建该连接对应的定时器，初始化为前述临时变量
+    m_users_timer[connfd].timer = timer;
+    //将该定时器添加到链表中
+    m_timer_lst.add_timer(timer);
+}
+
+//处理新到的客户连接：一次唤醒取出队列中的多个连接，减少epoll_wait的次数
+void reactor::deal_accept()
+{
+    int accepted = 0;
+#ifdef listenfdET
+    //边缘触发只在队列由空变为非空时通知一次，必须取到队列为空
+    while (true)
+#else
+    for (int n = 0; n < ACCEPT_BATCH; ++n)
+#endif
+    {
+        //初始化客户端连接地址
+        struct sockaddr_in client_address;
+        socklen_t client_addrlength = sizeof( client_address );
+        //accept4直接得到非阻塞、exec时关闭的连接，不需要再调用两次fcntl
+        int connfd = accept4(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (connfd < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            //连接在等待accept时被客户端重置，或者被信号打断，继续取下一个
+            if (errno == ECONNABORTED || errno == EPROTO || errno == EINTR)
+            {
+                continue;
+            }
+            metrics::add(metrics::ACCEPT_ERRORS);
+            if ((errno == EMFILE || errno == ENFILE) && evict_idle() > 0)
+            {
+                //文件描述符耗尽，关闭空闲的长连接后重试
+                continue;
+            }
+            if ((errno == EMFILE || errno == ENFILE) && m_idlefd >= 0)
+            {
+                //腾出预留的描述符接受并关闭一个连接，客户端立即收到FIN，而不是一直留在队列中
+                LOG_ERROR("%s:errno is:%d", "accept error", errno);
+                close(m_idlefd);
+                int fd = accept(m_listenfd, NULL, NULL);
+                if (fd >= 0)
+                {
+                    close(fd);
+                }
+                m_idlefd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                continue;
+            }
+            printf("errno is:%d\n", errno);
+            LOG_ERROR("%s:errno is:%d", "accept error", errno);
+            break;
+        }
+        if (connfd < MAX_FD && http_conn::m_user_count >= http_conn::m_max_connections && evict_idle() > 0)
+        {
+            //腾出了空闲连接的位置，接受新连接
+        }
+        else if (connfd >= MAX_FD || http_conn::m_user_count >= http_conn::m_max_connections)
+        {
+            show_error(connfd, "Internal server busy");
+            LOG_ERROR("%s", "Internal server busy");
+            metrics::add(metrics::ACCEPT_ERRORS);
+            continue;
+        }
+        ++accepted;
+        m_users[connfd].init(connfd, client_address, m_epollfd, m_closepipe[1]);
+        add_conn_timer(connfd, client_address, m_users[connfd].deadline());
+    }
+    if (accepted)
+    {
+        metrics::add(metrics::ACCEPTED, accepted);
+    }
+}
+
+//服务器端关闭连接，移除对应的定时器
+void reactor::close_timer(int sockfd)
+{
+    util_timer *timer = m_users_timer[sockfd].timer;
+    if (timer)
+    {
+        cb_func(&m_users_timer[sockfd]);
+        m_timer_lst.del_timer(timer);
+    }
+}
+
+void reactor::expire_cb(client_data *user_data)
+{
+    int fd = user_data->sockfd;
+    time_t now = time(NULL);
+    time_t deadline = s_users[fd].deadline();
+    if (s_users[fd].busy() && deadline <= now)
+    {
+        //工作线程还在使用连接的缓冲区，由它处理完后按新的超时时刻决定，这里只推迟检查
+        deadline = now + 1;
+    }
+    if (deadline > now)
+    {
+        //定时器结点随后由时间轮归还，换一个新的
+        t_loop->add_conn_timer(fd, user_data->address, deadline);
+        return;
+    }
+    metrics::add(metrics::TIMEOUTS);
+    cb_func(user_data);
+}
+
+time_t reactor::check_time(int fd) const
+{
+    time_t deadline = m_users[fd].deadline();
+    time_t idle = time(NULL) + http_conn::m_keepalive_timeout;
+    return deadline < idle ? deadline : idle;
+}
+
+void reactor::evict(int fd)
+{
+    close_timer(fd);
+}
+
+int reactor::evict_idle()
+{
+    time_t now = time(NULL);
+    if (m_evict_miss == now)
+    {
+        //刚扫描过，没有空闲连接
+        return 0;
+    }
+    //按开始空闲的时刻保留最早的batch个连接，数组按时刻升序；连接数上限很小时一次只淘汰它的1/16
+    int batch = http_conn::m_max_connections / 16;
+    batch = batch < 1 ? 1 : (batch > EVICT_BATCH ? EVICT_BATCH : batch);
+    int fds[EVICT_BATCH];
+    time_t since[EVICT_BATCH];
+    int n = 0;
+    for (int fd = 0; fd < MAX_FD; ++fd)
+    {
+        if (!m_users_timer[fd].timer || m_users_timer[fd].owner != this)
+        {
+            continue;
+        }
+        time_t idle = m_users[fd].idle_since();
+        if (idle == 0 || (n == batch && idle >= since[n - 1]))
+        {
+            continue;
+        }
+        int i = n < batch ? n++ : n - 1;
+        for (; i > 0 && since[i - 1] > idle; --i)
+        {
+            fds[i] = fds[i - 1];
+            since[i] = since[i - 1];
+        }
+        fds[i] = fd;
+        since[i] = idle;
+    }
+    if (n == 0)
+    {
+        m_evict_miss = now;
+        return 0;
+    }
+    for (int i = 0; i < n; ++i)
+    {
+        evict(fds[i]);
+    }
+    metrics::add(metrics::EVICTIONS, n);
+    LOG_INFO("evicted %d idle connections", n);
+    return n;
+}
+
+//管道读端对应文件描述符发生读事件，处理信号对应逻辑
+void reactor::deal_signal(bool &stop_server)
+{
+    char signals[1024];
+    //从管道读端读出信号值，成功返回字节数，失败返回-1
+    //正常情况下，这里的ret返回值总是1，只有15这个ASCII码对应的字符
+    int ret = recv(m_sigfd, signals, sizeof(signals), 0);
+    if (ret <= 0)
+    {
+        return;
+    }
+    for (int i = 0; i < ret; ++i)
+    {
+        switch (signals[i])
+        {
+        case SIGTERM:
+        {
+            stop_server = true;
+        }
+        }
+    }
+}
+
+//处理客户连接上接收到的数据
+void reactor::deal_read(int sockfd)
+{
+    util_timer *timer = m_users_timer[sockfd].timer;
+    if (m_users[sockfd].read())
+    {
+        LOG_INFO("deal with the client()");
+    
+        //放入请求队列之后连接由工作线程处理，先取出读取数据后的超时时刻
+        time_t deadline = check_time(sockfd);
+
+        //若监测到读事件，将该事件放入请求队列
+        m_users[sockfd].on_dispatch();
+        if (!m_pool->append(m_users + sockfd))
+        {
+            //请求队列已满，连接不会再被重新注册，只能关闭
+            LOG_ERROR("%s", "request queue full");
+            close_timer(sockfd);
+            return;
+        }
+
+        //按新的超时时刻调整定时器在时间轮上的位置
+        if (timer)
+        {
+            timer->expire = deadline;
+            LOG_INFO("%s", "adjust timer once");
+            m_timer_lst.adjust_timer(timer);
+        }
+    }
+    else
+    {
+        close_timer(sockfd);
+    }
+}
+
+void reactor::deal_write(int sockfd)
+{
+    util_timer *timer = m_users_timer[sockfd].timer;
+    if (m_users[sockfd].write())
+    {
+        LOG_INFO("send data to the client()");
+    
+        //按新的超时时刻调整定时器在时间轮上的位置
+        if (timer)
+        {
+            timer->expire = check_time(sockfd);
+            LOG_INFO("%s", "adjust timer once");
+            m_timer_lst.adjust_timer(timer);
+        }
+    }
+    else
+    {
+        close_timer(sockfd);
+    }
+}
+
+void reactor::deal_event(int sockfd)
+{
+    if (!m_users[sockfd].on_event())
+    {
+        return;
+    }
+    if (!m_pool->append(m_users + sockfd))
+    {
+        //请求队列已满，事件不会再次报告，只能关闭连接
+        LOG_ERROR("%s", "request queue full");
+        close_timer(sockfd);
+        return;
+    }
+    //数据由工作线程读取，到期时expire_cb按工作线程更新的超时时刻决定是否推迟
+    util_timer *timer = m_users_timer[sockfd].timer;
+    if (timer)
+    {
+        timer->expire = check_time(sockfd);
+        m_timer_lst.adjust_timer(timer);
+    }
+}
+
+void reactor::deal_close()
+{
+    http_conn::close_msg msgs[256];
+    ssize_t n;
+    //每条消息都是原子写入的，读到的总是完整的消息
+    while ((n = ::read(m_closepipe[0], msgs, sizeof(msgs))) > 0)
+    {
+        for (size_t i = 0; i < n / sizeof(msgs[0]); ++i)
+        {
+            //定时器为空说明连接已经被超时关闭；id不同说明关闭后文件描述符已经被新连接复用
+            int fd = msgs[i].fd;
+            if (m_users_timer[fd].timer && m_users_timer[fd].owner == this && m_users[fd].conn_id() == msgs[i].id)
+            {
+                close_timer(fd);
+            }
+        }
+    }
+}
+
+void reactor::loop()
+{
+    t_loop = this;
+    //循环条件
+    bool stop_server = false;
+    while(!stop_server) {
+        //监测发生事件的文件描述符
+        int number = epoll_wait( m_epollfd, m_events, MAX_EVENT_NUMBER, -1 );
+
+        if ( ( number < 0 ) && ( errno != EINTR ) ) {
+            printf( "epoll failure\n" );
+            break;
+        }
+        //轮询文件描述符
+        for ( int i = 0; i < number; i++ ) {
+
+            int sockfd = m_events[i].data.fd;
+
+            if( sockfd == m_listenfd ) {
+                deal_accept();
+            } else if( sockfd == m_closepipe[0] ) {
+                deal_close();
+            } else if( http_conn::m_edge_triggered && sockfd != m_sigfd && sockfd != m_timerfd ) {
+                deal_event(sockfd);
+            } else if( m_events[i].events & ( EPOLLRDHUP | EPOLLHUP | EPOLLERR ) ) {
+                close_timer(sockfd);
+            } else if((sockfd == m_sigfd) && (m_events[i].events & EPOLLIN)) {
+                deal_signal(stop_server);
+            } else if((sockfd == m_timerfd) && (m_events[i].events & EPOLLIN)) {
+                timer_handler();
+            } else if (m_events[i].events & EPOLLIN) {
+                deal_read(sockfd);
+            } else if( m_events[i].events & EPOLLOUT ) {
+                deal_write(sockfd);
+            }
+        }
+    }
+}
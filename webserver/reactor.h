@@ -0,0 +1,112 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include "http_conn.h"
+#include "threadpool.h"
+#include "ls_time.h"
+#include "time_wheel.h"
+
+#define MAX_FD 65536   // 最大的文件描述符个数
+#define MAX_EVENT_NUMBER 10000  // 监听的最大的事件数量
+#define TICK_INTERVAL 1 //时间轮的tick间隔(秒)，由timerfd驱动
+#define ACCEPT_BATCH 256 //水平触发时每次唤醒最多accept的连接数，剩下的在下一轮epoll_wait后处理
+#define EVICT_BATCH 16   //连接数达到上限时一次最多淘汰的空闲长连接数，之后的新连接不必每个都扫描一遍
+
+//#define listenfdET //边缘触发，每次唤醒accept到队列为空
+#define listenfdLT //水平触发，每次唤醒最多accept ACCEPT_BATCH个连接
+
+//事件循环类，每个reactor拥有自己的监听socket、epoll内核事件表、定时器容器和timerfd
+//连接由哪个reactor accept，就始终由该reactor的epoll监听，不会在循环之间迁移
+//其它I/O后端(uring_reactor)继承它，复用定时器、信号和连接数组，只替换事件循环
+class reactor
+{
+public:
+    /*listenfd是本循环的监听socket，sigfd是传递信号值的管道读端；
+      exclusive为true时listenfd由多个reactor共享，用EPOLLEXCLUSIVE注册，一个新连接只唤醒其中一个循环*/
+    reactor(int listenfd, int sigfd, task_pool<http_conn> *pool,
+            http_conn *users, client_data *users_timer, bool exclusive = false);
+    virtual ~reactor();
+
+    //运行事件循环，直到收到SIGTERM
+    virtual void loop();
+
+    //创建非阻塞的监听socket，reuseport为true时设置SO_REUSEPORT，使多个reactor可以绑定同一端口；
+    //backlog是已完成握手、等待accept的连接队列长度，内核会把它截断到net.core.somaxconn
+    static int open_listenfd(int port, bool reuseport, int backlog);
+
+    //给SO_REUSEPORT组挂上CBPF程序，按处理SYN的CPU编号选择组内第cpu % group_size个socket，
+    //listenfd是组内任意一个已绑定的socket；配合把第i个reactor绑定到第i个CPU，连接就在收到它的CPU上处理
+    static bool attach_cpu_steering(int listenfd, int group_size);
+
+    //reactor线程的入口函数
+    static void *worker(void *arg);
+
+protected:
+    //只创建timerfd和预留的空闲描述符，不创建epoll，供不使用epoll的后端调用
+    reactor(int listenfd, int sigfd, http_conn *users, client_data *users_timer);
+
+    //连接数已满时发送错误信息并关闭新连接
+    static void show_error(int connfd, const char *info);
+
+    void deal_signal(bool &stop_server);
+    //给连接创建在expire时刻到期的定时器
+    void add_conn_timer(int connfd, const sockaddr_in &client_address, time_t expire);
+    void timer_handler();
+
+    //连接数达到上限时关闭本循环中空闲最久的至多EVICT_BATCH个长连接，返回关闭的个数
+    int evict_idle();
+    //关闭一个被淘汰的连接，后端按自己关闭连接的方式实现
+    virtual void evict(int fd);
+
+    //定时器到期时连接的超时时刻可能已经被推迟，推迟了或者连接正在被工作线程处理就换一个新的定时器，否则关闭连接
+    static void expire_cb(client_data *user_data);
+    //连接交给工作线程时定时器的到期时刻：工作线程处理完后连接可能变为空闲，超时时刻提前到
+    //m_keepalive_timeout之后，所以最晚在那时检查一次
+    time_t check_time(int fd) const;
+
+private:
+    void deal_accept();
+    void deal_read(int sockfd);
+    void deal_write(int sockfd);
+    //边缘触发模式下连接上的所有事件都交给工作线程处理
+    void deal_event(int sockfd);
+    //关闭工作线程请求关闭的连接
+    void deal_close();
+    void close_timer(int sockfd);
+
+protected:
+    int m_listenfd;
+    int m_sigfd;
+
+    //预留的空闲文件描述符，文件描述符耗尽时关闭它来accept并立即关闭新连接，
+    //否则连接一直留在队列中，水平触发的监听socket会让事件循环空转
+    int m_idlefd;
+
+    //周期性触发时间轮tick的timerfd
+    int m_timerfd;
+
+    //关闭请求管道：工作线程写入要关闭的连接(http_conn::close_msg)，由本循环关闭连接并删除定时器
+    int m_closepipe[2];
+
+    //本循环的epoll文件描述符
+    int m_epollfd;
+
+    //本循环的定时器容器
+    time_wheel m_timer_lst;
+    //连接超时时定时器调用的回调函数，后端按自己关闭连接的方式设置
+    void (*m_timeout_cb)(client_data *);
+    //上次扫描没有找到空闲连接的时刻，1秒内不再扫描
+    time_t m_evict_miss;
+
+    task_pool<http_conn> *m_pool;
+
+    //所有reactor共享的连接数组，按文件描述符下标访问，不同循环的连接互不重叠
+    http_conn *m_users;
+    client_data *m_users_timer;
+
+    epoll_event m_events[MAX_EVENT_NUMBER];
+};
+
+#endif
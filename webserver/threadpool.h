@@ -7,14 +7,25 @@
 #include <pthread.h>
 #include "locker.h"
 
+// 任务池接口，reactor通过它把请求交给工作线程，具体实现可以在启动时选择
+template<typename T>
+class task_pool {
+public:
+    virtual ~task_pool() {}
+    virtual bool append(T* request) = 0;
+    // 等待处理的请求数，只用于统计，可以不精确
+    virtual size_t queued() = 0;
+};
+
 // 线程池类，将它定义为模板类是为了代码复用，模板参数T是任务类
 template<typename T>
-class threadpool {
+class threadpool : public task_pool<T> {
 public:
     /*thread_number是线程池中线程的数量，max_requests是请求队列中最多允许的、等待处理的请求的数量*/
     threadpool(int thread_number = 8, int max_requests = 10000);
     ~threadpool();
     bool append(T* request);
+    size_t queued();
 
 private:
     /*工作线程运行的函数，它不断从工作队列中取出任务并执行之*/
@@ -46,8 +57,8 @@ private:
 
 template< typename T >
 threadpool< T >::threadpool(int thread_number, int max_requests) : 
-        m_thread_number(thread_number), m_max_requests(max_requests), 
-        m_stop(false), m_threads(NULL) {
+        m_thread_number(thread_number), m_threads(NULL), 
+        m_max_requests(max_requests), m_stop(false) {
 
     if((thread_number <= 0) || (max_requests <= 0) ) {
         throw std::exception();
@@ -84,7 +95,7 @@ bool threadpool< T >::append( T* request )
 {
     // 操作工作队列时一定要加锁，因为它被所有线程共享。
     m_queuelocker.lock();
-    if ( m_workqueue.size() > m_max_requests ) {
+    if ( m_workqueue.size() > (size_t)m_max_requests ) {
         m_queuelocker.unlock();
         return false;
     }
@@ -94,6 +105,15 @@ bool threadpool< T >::append( T* request )
     return true;
 }
 
+template< typename T >
+size_t threadpool< T >::queued()
+{
+    m_queuelocker.lock();
+    size_t n = m_workqueue.size();
+    m_queuelocker.unlock();
+    return n;
+}
+
 template< typename T >
 void* threadpool< T >::worker( void* arg )
 {
@@ -0,0 +1,254 @@
+#ifndef TIME_WHEEL_H
+#define TIME_WHEEL_H
+
+#include <time.h>
+#include <stddef.h>
+#include "ls_time.h"
+#include "mem_pool.h"
+
+//分层时间轮定时器容器，与sort_timer_lst使用同样的util_timer和回调约定
+//第一层256个槽，每槽1秒；后四层各64个槽，每槽覆盖上一层一整圈
+//添加、调整、删除定时器都是O(1)，tick时到达某一层的起点才把上一层的槽重新分散(cascade)
+//定时器结点由alloc_timer从本容器的对象池取得，删除或到期后归还对象池，不再逐个new/delete
+class time_wheel
+{
+public:
+    time_wheel() : m_timer_sec(time(NULL)), m_count(0)
+    {
+        for (int i = 0; i < TVR_SIZE; ++i)
+        {
+            init_slot(&m_tv1[i]);
+        }
+        for (int level = 0; level < TVN_LEVELS; ++level)
+        {
+            for (int i = 0; i < TVN_SIZE; ++i)
+            {
+                init_slot(&m_tvn[level][i]);
+            }
+        }
+    }
+
+    //销毁所有槽中剩余的定时器
+    ~time_wheel()
+    {
+        for (int i = 0; i < TVR_SIZE; ++i)
+        {
+            destroy_slot(&m_tv1[i]);
+        }
+        for (int level = 0; level < TVN_LEVELS; ++level)
+        {
+            for (int i = 0; i < TVN_SIZE; ++i)
+            {
+                destroy_slot(&m_tvn[level][i]);
+            }
+        }
+    }
+
+    //从对象池取一个定时器结点，只能交给本容器管理
+    util_timer *alloc_timer()
+    {
+        return m_pool.allocate();
+    }
+
+    //添加定时器，按超时时间放入对应层的槽
+    void add_timer(util_timer *timer)
+    {
+        if (!timer)
+        {
+            return;
+        }
+        internal_add(timer);
+        ++m_count;
+    }
+
+    //调整定时器，超时时间改变后从原来的槽取出放入新槽
+    void adjust_timer(util_timer *timer)
+    {
+        if (!timer || !timer->next)
+        {
+            return;
+        }
+        unlink(timer);
+        internal_add(timer);
+    }
+
+    //删除定时器
+    void del_timer(util_timer *timer)
+    {
+        if (!timer)
+        {
+            return;
+        }
+        if (timer->next)
+        {
+            unlink(timer);
+            --m_count;
+        }
+        m_pool.deallocate(timer);
+    }
+
+    //定时任务处理函数，处理从上次tick到当前时间之间每一秒到期的定时器
+    void tick()
+    {
+        time_t cur = time(NULL);
+        while (m_timer_sec <= cur)
+        {
+            int index = m_timer_sec & TVR_MASK;
+            //第一层转完一圈，把上一层当前槽中的定时器重新分散到下一层
+            if (!index)
+            {
+                for (int level = 0; level < TVN_LEVELS; ++level)
+                {
+                    if (cascade(level, tvn_index(level)))
+                    {
+                        break;
+                    }
+                }
+            }
+            ++m_timer_sec;
+
+            //先把到期槽整体摘下，再逐个执行回调
+            util_timer expired;
+            init_slot(&expired);
+            splice(&m_tv1[index], &expired);
+            while (expired.next != &expired)
+            {
+                util_timer *tmp = expired.next;
+                unlink(tmp);
+                --m_count;
+                tmp->cb_func(tmp->user_data);
+                m_pool.deallocate(tmp);
+            }
+        }
+    }
+
+    //当前容器中的定时器数量
+    size_t size() const
+    {
+        return m_count;
+    }
+
+private:
+    static const int TVR_BITS = 8;
+    static const int TVN_BITS = 6;
+    static const int TVR_SIZE = 1 << TVR_BITS;
+    static const int TVN_SIZE = 1 << TVN_BITS;
+    static const int TVR_MASK = TVR_SIZE - 1;
+    static const int TVN_MASK = TVN_SIZE - 1;
+    static const int TVN_LEVELS = 4;
+
+    //槽是带哨兵结点的循环双向链表，定时器不在任何槽中时next为NULL
+    static void init_slot(util_timer *slot)
+    {
+        slot->prev = slot;
+        slot->next = slot;
+    }
+
+    static void link(util_timer *slot, util_timer *timer)
+    {
+        timer->prev = slot->prev;
+        timer->next = slot;
+        slot->prev->next = timer;
+        slot->prev = timer;
+    }
+
+    static void unlink(util_timer *timer)
+    {
+        timer->prev->next = timer->next;
+        timer->next->prev = timer->prev;
+        timer->prev = NULL;
+        timer->next = NULL;
+    }
+
+    //把from槽中的全部定时器移到to槽，from变为空
+    static void splice(util_timer *from, util_timer *to)
+    {
+        if (from->next == from)
+        {
+            return;
+        }
+        to->next = from->next;
+        to->prev = from->prev;
+        to->next->prev = to;
+        to->prev->next = to;
+        init_slot(from);
+    }
+
+    void destroy_slot(util_timer *slot)
+    {
+        util_timer *tmp = slot->next;
+        while (tmp != slot)
+        {
+            util_timer *next = tmp->next;
+            m_pool.deallocate(tmp);
+            tmp = next;
+        }
+        init_slot(slot);
+    }
+
+    //第level层(从0开始)当前对应的槽下标
+    int tvn_index(int level) const
+    {
+        return (m_timer_sec >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK;
+    }
+
+    void internal_add(util_timer *timer)
+    {
+        time_t expires = timer->expire;
+        time_t idx = expires - m_timer_sec;
+        util_timer *slot;
+        if (idx < 0)
+        {
+            //已经过期的定时器放到下一次tick处理的槽
+            slot = &m_tv1[m_timer_sec & TVR_MASK];
+        }
+        else if (idx < TVR_SIZE)
+        {
+            slot = &m_tv1[expires & TVR_MASK];
+        }
+        else
+        {
+            //超出时间轮范围的定时器放在最高层的最远处
+            const time_t max_idx = ((time_t)1 << (TVR_BITS + TVN_LEVELS * TVN_BITS)) - 1;
+            if (idx > max_idx)
+            {
+                expires = m_timer_sec + max_idx;
+            }
+            int level = 0;
+            while (level < TVN_LEVELS - 1 && idx >= ((time_t)1 << (TVR_BITS + (level + 1) * TVN_BITS)))
+            {
+                ++level;
+            }
+            slot = &m_tvn[level][(expires >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK];
+        }
+        link(slot, timer);
+    }
+
+    //把第level层index槽中的定时器重新放入更低的层，返回index，为0时需要继续cascade更高一层
+    int cascade(int level, int index)
+    {
+        util_timer pending;
+        init_slot(&pending);
+        splice(&m_tvn[level][index], &pending);
+        while (pending.next != &pending)
+        {
+            util_timer *tmp = pending.next;
+            unlink(tmp);
+            internal_add(tmp);
+        }
+        return index;
+    }
+
+private:
+    object_pool<util_timer> m_pool;
+
+    util_timer m_tv1[TVR_SIZE];
+    util_timer m_tvn[TVN_LEVELS][TVN_SIZE];
+
+    //下一个要处理的秒
+    time_t m_timer_sec;
+
+    size_t m_count;
+};
+
+#endif
@@ -0,0 +1,124 @@
+// 把二进制日志(Log::MODE_BINARY写的.blog文件)还原成与文本模式相同的日志行
+// 用法: log_decode 文件... ，不给文件时读标准输入，压缩过的.gz文件直接读
+// 编译: g++ -O2 -o log_decode tools/log_decode.cpp log_record.cpp -lz
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <zlib.h>
+#include <string>
+#include <vector>
+#include "../log_record.h"
+
+static const char *const LEVEL_TITLE[] = {"[debug]: ", "[info] : ", "[warn] : ", "[error]: "};
+
+static bool read_full(gzFile fp, void *buf, size_t len)
+{
+    return len == 0 || gzread(fp, buf, len) == (int)len;
+}
+
+static void print_record(int level, int64_t usec, const char *format, const char *args, size_t len)
+{
+    time_t sec = usec / 1000000;
+    struct tm t;
+    localtime_r(&sec, &t);
+    char line[4096];
+    LogFormat(line, sizeof(line), format, args, len);
+    printf("%d-%02d-%02d %02d:%02d:%02d.%06ld %s%s\n", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
+           t.tm_hour, t.tm_min, t.tm_sec, (long)(usec % 1000000),
+           LEVEL_TITLE[level >= 0 && level <= 3 ? level : 1], line);
+}
+
+static int decode(gzFile fp, const char *name)
+{
+    char magic[LOG_BINARY_MAGIC_LEN];
+    if (!read_full(fp, magic, LOG_BINARY_MAGIC_LEN) || memcmp(magic, LOG_BINARY_MAGIC, LOG_BINARY_MAGIC_LEN) != 0)
+    {
+        fprintf(stderr, "%s: not a binary log\n", name);
+        return 1;
+    }
+    //格式编号只在一个文件内有效，同一文件中后出现的定义覆盖前面的(进程重启后追加写入)
+    std::vector<std::string> formats;
+    char buf[65536];
+    int type;
+    bool truncated = false;
+    while ((type = gzgetc(fp)) != -1)
+    {
+        uint16_t id, len;
+        if (type == 'F')
+        {
+            if (!read_full(fp, &id, 2) || !read_full(fp, &len, 2) || !read_full(fp, buf, len))
+            {
+                truncated = true;
+                break;
+            }
+            if (formats.size() <= id)
+            {
+                formats.resize(id + 1);
+            }
+            formats[id].assign(buf, len);
+        }
+        else if (type == 'R')
+        {
+            int level = gzgetc(fp);
+            int64_t usec;
+            if (level == -1 || !read_full(fp, &id, 2) || !read_full(fp, &usec, 8) ||
+                !read_full(fp, &len, 2) || !read_full(fp, buf, len))
+            {
+                truncated = true;
+                break;
+            }
+            if (id >= formats.size() || formats[id].empty())
+            {
+                fprintf(stderr, "%s: record uses undefined format %d\n", name, id);
+                continue;
+            }
+            print_record(level, usec, formats[id].c_str(), buf, len);
+        }
+        else if (type == 'T')
+        {
+            if (!read_full(fp, &len, 2) || !read_full(fp, buf, len))
+            {
+                truncated = true;
+                break;
+            }
+            fwrite(buf, 1, len, stdout);
+        }
+        else
+        {
+            fprintf(stderr, "%s: corrupt entry type 0x%02x\n", name, type);
+            return 1;
+        }
+    }
+    if (truncated)
+    {
+        fprintf(stderr, "%s: truncated entry\n", name);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        gzFile fp = gzdopen(0, "rb");
+        int ret = decode(fp, "stdin");
+        gzclose(fp);
+        return ret;
+    }
+    int ret = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        gzFile fp = gzopen(argv[i], "rb");
+        if (!fp)
+        {
+            perror(argv[i]);
+            ret = 1;
+            continue;
+        }
+        ret |= decode(fp, argv[i]);
+        gzclose(fp);
+    }
+    return ret;
+}
@@ -0,0 +1,619 @@
+#include "uring_reactor.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+#include <linux/tcp.h>
+#include "log.h"
+#include "metrics.h"
+
+//接收缓冲区环的组编号，每个循环有自己的io_uring，编号可以相同
+static const int BUFFER_GROUP = 0;
+
+//运行在本线程中的循环，定时器回调通过它关闭连接
+static thread_local uring_reactor *t_reactor = NULL;
+
+static inline uint64_t pack(int op, int fd)
+{
+    return ((uint64_t)op << 32) | (uint32_t)fd;
+}
+
+uring_reactor::uring_reactor(int listenfd, int sigfd, http_conn *users, client_data *users_timer)
+    : reactor(listenfd, sigfd, users, users_timer), m_accept_armed(false), m_timer_armed(false),
+      m_signal_armed(false), m_stop(false)
+{
+    m_timeout_cb = timeout_cb;
+    m_conns = new uring_conn[MAX_FD];
+    for (int i = 0; i < MAX_FD; ++i)
+    {
+        uring_conn &uc = m_conns[i];
+        uc.inflight = 0;
+        uc.recv_armed = uc.cancelling = uc.sending = uc.closing = uc.send_failed = false;
+        uc.splice_left = 0;
+        uc.splice_sent = 0;
+        uc.pipe[0] = uc.pipe[1] = -1;
+        uc.pipe_cap = uc.pipe_len = 0;
+        uc.acked = 0;
+    }
+}
+
+uring_reactor::~uring_reactor()
+{
+    for (int i = 0; i < MAX_FD; ++i)
+    {
+        if (m_conns[i].pipe[0] >= 0)
+        {
+            close(m_conns[i].pipe[0]);
+            close(m_conns[i].pipe[1]);
+        }
+    }
+    delete[] m_conns;
+}
+
+bool uring_reactor::supported()
+{
+    //多次触发的recv需要5.19以后的内核，PROBE只能查到操作码，按版本号判断
+    struct utsname u;
+    int major = 0, minor = 0;
+    if (uname(&u) != 0 || sscanf(u.release, "%d.%d", &major, &minor) != 2 ||
+        major < 5 || (major == 5 && minor < 19))
+    {
+        return false;
+    }
+    static const int ops[] = {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_SPLICE,
+                              IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL};
+    if (!io_ring::probe(ops, sizeof(ops) / sizeof(ops[0])))
+    {
+        return false;
+    }
+    //提供缓冲区环也在5.19加入，注册一个试试
+    io_ring ring;
+    return ring.init(4, 2, 0) && ring.setup_buffers(BUFFER_GROUP, 8, 64);
+}
+
+struct io_uring_sqe *uring_reactor::get_sqe()
+{
+    struct io_uring_sqe *sqe = m_ring.get_sqe();
+    if (!sqe)
+    {
+        //提交队列满，先把已有的提交给内核
+        m_ring.submit_and_wait(0);
+        sqe = m_ring.get_sqe();
+    }
+    return sqe;
+}
+
+void uring_reactor::arm_accept()
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = m_listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    //连接保持阻塞：io_uring对socket总是先非阻塞尝试再等待就绪，阻塞的socket让io-wq中的splice等待发送缓冲区
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = pack(OP_ACCEPT, m_listenfd);
+    m_accept_armed = true;
+}
+
+void uring_reactor::arm_recv(int fd)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = pack(OP_RECV, fd);
+    m_conns[fd].recv_armed = true;
+    ++m_conns[fd].inflight;
+}
+
+void uring_reactor::arm_poll(int fd, int op)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = pack(op, fd);
+    if (op == OP_TIMER)
+    {
+        m_timer_armed = true;
+    }
+    else
+    {
+        m_signal_armed = true;
+    }
+}
+
+//多次触发的accept每个新连接产生一个完成项
+void uring_reactor::on_accept(struct io_uring_cqe *cqe)
+{
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        m_accept_armed = false;
+    }
+    int connfd = cqe->res;
+    if (connfd < 0)
+    {
+        if (connfd != -ECONNABORTED && connfd != -EINTR && connfd != -EAGAIN)
+        {
+            metrics::add(metrics::ACCEPT_ERRORS);
+            LOG_ERROR("%s:errno is:%d", "accept error", -connfd);
+        }
+        if ((connfd == -EMFILE || connfd == -ENFILE) && evict_idle() > 0)
+        {
+            //关闭了空闲的长连接，它们的文件描述符在内核中的请求完成后释放
+        }
+        else if ((connfd == -EMFILE || connfd == -ENFILE) && m_idlefd >= 0)
+        {
+            //和epoll后端一样，腾出预留的描述符接受并关闭一个连接
+            close(m_idlefd);
+            int fd = accept(m_listenfd, NULL, NULL);
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            m_idlefd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        }
+    }
+    else if (connfd >= MAX_FD ||
+             (http_conn::m_user_count >= http_conn::m_max_connections && evict_idle() == 0))
+    {
+        show_error(connfd, "Internal server busy");
+        LOG_ERROR("%s", "Internal server busy");
+        metrics::add(metrics::ACCEPT_ERRORS);
+    }
+    else
+    {
+        //多次触发的accept不返回对端地址
+        struct sockaddr_in client_address;
+        memset(&client_address, 0, sizeof(client_address));
+        m_users[connfd].init(connfd, client_address, -1, -1);
+        m_conns[connfd].acked = 0;
+        add_conn_timer(connfd, client_address, m_users[connfd].deadline());
+        arm_recv(connfd);
+        metrics::add(metrics::ACCEPTED);
+    }
+    if (!m_accept_armed && !m_stop)
+    {
+        arm_accept();
+    }
+}
+
+void uring_reactor::on_recv(int fd, struct io_uring_cqe *cqe)
+{
+    uring_conn &uc = m_conns[fd];
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        uc.recv_armed = false;
+        uc.cancelling = false;
+        --uc.inflight;
+    }
+    int res = cqe->res;
+    if (res > 0)
+    {
+        unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (uc.closing)
+        {
+            m_ring.recycle_buffer(bid);
+            return;
+        }
+        pending_buf buf = {bid, 0, (unsigned)res};
+        uc.pending.push_back(buf);
+        drive(fd);
+        extend_timer(fd);
+    }
+    else if (res == -ENOBUFS || res == -ECANCELED)
+    {
+        //接收缓冲区暂时用完，或者因为读缓冲区已满被取消，条件满足时重新提交
+        if (!uc.closing)
+        {
+            update_recv(fd);
+        }
+    }
+    else
+    {
+        //对方关闭连接或者出错
+        close_conn(fd);
+    }
+}
+
+void uring_reactor::update_recv(int fd)
+{
+    uring_conn &uc = m_conns[fd];
+    if (uc.pending.empty())
+    {
+        if (!uc.recv_armed)
+        {
+            arm_recv(fd);
+        }
+    }
+    else if (uc.recv_armed && !uc.cancelling)
+    {
+        //读缓冲区已满，停止接收，数据留在socket中形成背压
+        struct io_uring_sqe *sqe = get_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = pack(OP_RECV, fd);
+        sqe->user_data = pack(OP_CANCEL, fd);
+        uc.cancelling = true;
+    }
+}
+
+bool uring_reactor::feed_pending(int fd)
+{
+    uring_conn &uc = m_conns[fd];
+    size_t i = 0;
+    for (; i < uc.pending.size(); ++i)
+    {
+        pending_buf &buf = uc.pending[i];
+        size_t n = m_users[fd].receive(m_ring.buffer(buf.bid) + buf.offset, buf.len);
+        buf.offset += n;
+        buf.len -= n;
+        if (buf.len > 0)
+        {
+            break;
+        }
+        m_ring.recycle_buffer(buf.bid);
+    }
+    uc.pending.erase(uc.pending.begin(), uc.pending.begin() + i);
+    return uc.pending.empty();
+}
+
+void uring_reactor::drive(int fd)
+{
+    uring_conn &uc = m_conns[fd];
+    if (uc.closing)
+    {
+        return;
+    }
+    //发送期间收到的数据先追加到读缓冲区，这一批应答发完后再解析
+    feed_pending(fd);
+    if (!uc.sending)
+    {
+        if (!m_users[fd].build_batch())
+        {
+            close_conn(fd);
+            return;
+        }
+        if (m_users[fd].has_batch())
+        {
+            start_send(fd);
+        }
+    }
+    if (!uc.closing)
+    {
+        update_recv(fd);
+    }
+}
+
+void uring_reactor::start_send(int fd)
+{
+    uring_conn &uc = m_conns[fd];
+    int flags, file_fd;
+    off_t offset;
+    size_t len;
+    uc.sending = true;
+    if (m_users[fd].prepare_send(uc.msg, flags, file_fd, offset, len) == 0)
+    {
+        struct io_uring_sqe *sqe = get_sqe();
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)&uc.msg;
+        sqe->len = 1;
+        sqe->msg_flags = flags | MSG_NOSIGNAL;
+        sqe->user_data = pack(OP_SEND, fd);
+        ++uc.inflight;
+        metrics::add(metrics::WRITES);
+        return;
+    }
+
+    //大文件的内容经过管道在内核中搬运，不复制到用户空间
+    if (uc.pipe[0] < 0)
+    {
+        if (pipe2(uc.pipe, O_CLOEXEC) < 0)
+        {
+            uc.sending = false;
+            close_conn(fd);
+            return;
+        }
+        fcntl(uc.pipe[1], F_SETPIPE_SZ, URING_PIPE_SIZE);
+        int cap = fcntl(uc.pipe[1], F_GETPIPE_SZ);
+        uc.pipe_cap = cap > 0 ? cap : 65536;
+        uc.pipe_len = 0;
+    }
+    uc.splice_sent = 0;
+    if (uc.pipe_len > 0)
+    {
+        //上一次从文件读入管道的数据还没有全部发出
+        struct io_uring_sqe *sqe = get_sqe();
+        sqe->opcode = IORING_OP_SPLICE;
+        sqe->splice_fd_in = uc.pipe[0];
+        sqe->splice_off_in = (uint64_t)-1;
+        sqe->fd = fd;
+        sqe->off = (uint64_t)-1;
+        sqe->len = uc.pipe_len;
+        sqe->user_data = pack(OP_SPLICE_OUT, fd);
+        uc.splice_left = 1;
+        ++uc.inflight;
+        metrics::add(metrics::WRITES);
+        return;
+    }
+    size_t n = len < uc.pipe_cap ? len : uc.pipe_cap;
+    //链接的两个请求必须在同一次提交中
+    if (m_ring.sq_space() < 2)
+    {
+        m_ring.submit_and_wait(0);
+    }
+    //文件->管道，读入的字节数不足n时链接断开，第二个请求以-ECANCELED完成，下一轮只发送管道中的部分
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->splice_fd_in = file_fd;
+    sqe->splice_off_in = offset;
+    sqe->fd = uc.pipe[1];
+    sqe->off = (uint64_t)-1;
+    sqe->len = n;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = pack(OP_SPLICE_IN, fd);
+    //管道->socket
+    sqe = get_sqe();
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->splice_fd_in = uc.pipe[0];
+    sqe->splice_off_in = (uint64_t)-1;
+    sqe->fd = fd;
+    sqe->off = (uint64_t)-1;
+    sqe->len = n;
+    sqe->user_data = pack(OP_SPLICE_OUT, fd);
+    uc.splice_left = 2;
+    uc.inflight += 2;
+    metrics::add(metrics::WRITES);
+}
+
+void uring_reactor::on_send(int fd, int res)
+{
+    uring_conn &uc = m_conns[fd];
+    --uc.inflight;
+    if (res <= 0)
+    {
+        uc.sending = false;
+        close_conn(fd);
+        return;
+    }
+    send_done(fd, res);
+}
+
+void uring_reactor::on_splice(int fd, int op, int res)
+{
+    uring_conn &uc = m_conns[fd];
+    --uc.inflight;
+    --uc.splice_left;
+    if (op == OP_SPLICE_IN)
+    {
+        if (res > 0)
+        {
+            uc.pipe_len += res;
+        }
+        else
+        {
+            //0表示文件在发送过程中被截断
+            uc.send_failed = true;
+        }
+    }
+    else if (res > 0)
+    {
+        uc.pipe_len -= res;
+        uc.splice_sent += res;
+    }
+    else if (res != -ECANCELED)
+    {
+        uc.send_failed = true;
+    }
+    if (uc.splice_left > 0)
+    {
+        return;
+    }
+    if (uc.send_failed)
+    {
+        uc.send_failed = false;
+        uc.sending = false;
+        close_conn(fd);
+        return;
+    }
+    send_done(fd, uc.splice_sent);
+}
+
+void uring_reactor::send_done(int fd, ssize_t n)
+{
+    uring_conn &uc = m_conns[fd];
+    uc.sending = false;
+    if (uc.closing)
+    {
+        return;
+    }
+    bool done = n > 0 && m_users[fd].sent(n);
+    extend_timer(fd);
+    if (done)
+    {
+        if (!m_users[fd].finish_batch())
+        {
+            close_conn(fd);
+            return;
+        }
+        //处理流水线中剩下的请求，或者等待新的数据
+        drive(fd);
+        return;
+    }
+    start_send(fd);
+}
+
+void uring_reactor::extend_timer(int fd)
+{
+    util_timer *timer = m_users_timer[fd].timer;
+    if (timer)
+    {
+        timer->expire = m_users[fd].deadline();
+        m_timer_lst.adjust_timer(timer);
+    }
+}
+
+void uring_reactor::close_conn(int fd)
+{
+    uring_conn &uc = m_conns[fd];
+    if (uc.closing)
+    {
+        return;
+    }
+    uc.closing = true;
+    //内核中的recv以0完成，等待发送缓冲区的请求以-EPIPE完成
+    shutdown(fd, SHUT_RDWR);
+    for (size_t i = 0; i < uc.pending.size(); ++i)
+    {
+        m_ring.recycle_buffer(uc.pending[i].bid);
+    }
+    uc.pending.clear();
+    if (uc.inflight == 0)
+    {
+        finish_close(fd);
+    }
+}
+
+//连接上的请求都已完成，这时才能关闭文件描述符，否则它的编号可能被新连接复用，迟到的完成项会找错连接
+void uring_reactor::finish_close(int fd)
+{
+    uring_conn &uc = m_conns[fd];
+    util_timer *timer = m_users_timer[fd].timer;
+    if (timer)
+    {
+        m_users_timer[fd].timer = NULL;
+        m_timer_lst.del_timer(timer);
+    }
+    if (uc.pipe[0] >= 0)
+    {
+        close(uc.pipe[0]);
+        close(uc.pipe[1]);
+        uc.pipe[0] = uc.pipe[1] = -1;
+    }
+    uc.pipe_len = 0;
+    uc.closing = false;
+    uc.sending = false;
+    uc.cancelling = false;
+    close(fd);
+    m_users[fd].release_buffers();
+    http_conn::m_user_count--;
+    LOG_INFO("close fd %d", fd);
+}
+
+void uring_reactor::evict(int fd)
+{
+    close_conn(fd);
+}
+
+void uring_reactor::timeout_cb(client_data *user_data)
+{
+    //定时器结点随后由时间轮归还
+    user_data->timer = NULL;
+    int fd = user_data->sockfd;
+    uring_conn &uc = t_reactor->m_conns[fd];
+    time_t now = time(NULL);
+    time_t deadline = t_reactor->m_users[fd].deadline();
+    if (deadline > now && !uc.closing)
+    {
+        t_reactor->add_conn_timer(fd, user_data->address, deadline);
+        return;
+    }
+    if (uc.sending && !uc.closing)
+    {
+        struct tcp_info info;
+        socklen_t len = sizeof(info);
+        //上一个超时周期内对方确认的字节数要满足最低速率
+        uint64_t need = (uint64_t)http_conn::m_min_rate * http_conn::m_keepalive_timeout;
+        if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0 &&
+            info.tcpi_bytes_acked - uc.acked >= (need ? need : 1))
+        {
+            //对方仍在接收，换一个新的定时器
+            uc.acked = info.tcpi_bytes_acked;
+            t_reactor->add_conn_timer(fd, user_data->address, now + http_conn::m_keepalive_timeout);
+            return;
+        }
+    }
+    metrics::add(metrics::TIMEOUTS);
+    t_reactor->close_conn(fd);
+}
+
+void uring_reactor::loop()
+{
+    t_reactor = this;
+    //只有本线程提交请求，完成项的任务推迟到io_uring_enter时处理，减少打断；内核不支持时去掉这些标志
+    unsigned flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER |
+                     IORING_SETUP_DEFER_TASKRUN;
+    if (!m_ring.init(URING_ENTRIES, 4, flags) ||
+        !m_ring.setup_buffers(BUFFER_GROUP, URING_BUF_COUNT, URING_BUF_SIZE))
+    {
+        printf("io_uring setup failure: %s\n", strerror(errno));
+        LOG_ERROR("io_uring setup failure: %s", strerror(errno));
+        return;
+    }
+    arm_accept();
+    arm_poll(m_timerfd, OP_TIMER);
+    arm_poll(m_sigfd, OP_SIGNAL);
+
+    while (!m_stop)
+    {
+        //上一轮归还的接收缓冲区和新的请求一起交给内核
+        m_ring.publish_buffers();
+        int ret = m_ring.submit_and_wait(1);
+        if (ret < 0 && ret != -EINTR && ret != -EAGAIN && ret != -EBUSY)
+        {
+            printf("io_uring_enter failure\n");
+            break;
+        }
+        struct io_uring_cqe *cqe;
+        while ((cqe = m_ring.peek_cqe()) != NULL)
+        {
+            int op = (int)(cqe->user_data >> 32);
+            int fd = (int)(uint32_t)cqe->user_data;
+            switch (op)
+            {
+            case OP_ACCEPT:
+                on_accept(cqe);
+                break;
+            case OP_RECV:
+                on_recv(fd, cqe);
+                break;
+            case OP_SEND:
+                on_send(fd, cqe->res);
+                break;
+            case OP_SPLICE_IN:
+            case OP_SPLICE_OUT:
+                on_splice(fd, op, cqe->res);
+                break;
+            case OP_TIMER:
+                m_timer_armed = cqe->flags & IORING_CQE_F_MORE;
+                timer_handler();
+                break;
+            case OP_SIGNAL:
+                m_signal_armed = cqe->flags & IORING_CQE_F_MORE;
+                deal_signal(m_stop);
+                break;
+            default:
+                break;
+            }
+            m_ring.cqe_seen();
+            if (op >= OP_RECV && op <= OP_SPLICE_OUT && m_conns[fd].closing && m_conns[fd].inflight == 0)
+            {
+                finish_close(fd);
+            }
+        }
+        if (!m_timer_armed)
+        {
+            arm_poll(m_timerfd, OP_TIMER);
+        }
+        if (!m_signal_armed)
+        {
+            arm_poll(m_sigfd, OP_SIGNAL);
+        }
+    }
+}
@@ -0,0 +1,104 @@
+#ifndef URING_REACTOR_H
+#define URING_REACTOR_H
+
+#include <sys/socket.h>
+#include <vector>
+#include "reactor.h"
+#include "io_ring.h"
+
+#define URING_ENTRIES 4096     //提交队列的大小，完成队列是它的4倍
+#define URING_BUF_COUNT 4096   //提供给多次触发recv的缓冲区个数(2的幂)
+#define URING_BUF_SIZE 4096    //每个接收缓冲区的大小
+#define URING_PIPE_SIZE (1024 * 1024) //splice发送大文件使用的管道容量，设置失败时用系统默认值
+
+//io_uring后端的事件循环：监听socket上一个多次触发的accept，每个连接一个多次触发的recv，
+//接收缓冲区从注册的缓冲区环中选取；内存中的应答用sendmsg发送，大文件的内容用
+//文件->管道、管道->socket两个链接在一起的splice发送。每轮循环一次io_uring_enter提交所有请求并等待完成。
+//请求的解析和应答的填充直接在本循环线程中完成，不经过线程池。
+//定时器、信号和连接数组沿用reactor的实现，timerfd和信号管道用多次触发的poll监听
+class uring_reactor : public reactor
+{
+public:
+    uring_reactor(int listenfd, int sigfd, http_conn *users, client_data *users_timer);
+    ~uring_reactor();
+
+    //运行事件循环，直到收到SIGTERM；io_uring初始化失败时立即返回
+    void loop();
+
+    //检查内核是否支持本后端用到的全部io_uring功能
+    static bool supported();
+
+private:
+    //完成项的user_data高32位是操作类型，低32位是文件描述符
+    enum OP { OP_ACCEPT = 1, OP_RECV, OP_SEND, OP_SPLICE_IN, OP_SPLICE_OUT, OP_CANCEL, OP_TIMER, OP_SIGNAL };
+
+    //一个已经收到、但读缓冲区已满而暂时没有交给连接的接收缓冲区
+    struct pending_buf
+    {
+        unsigned bid;
+        unsigned offset;
+        unsigned len;
+    };
+
+    //连接在io_uring后端中的状态，按文件描述符下标访问
+    struct uring_conn
+    {
+        int inflight;       //已提交尚未完成的请求个数，连接关闭后等它们都完成才关闭文件描述符
+        bool recv_armed;    //多次触发的recv还在内核中
+        bool cancelling;    //已经请求取消recv
+        bool sending;       //有一个发送请求(或一对splice)尚未完成
+        bool closing;
+        bool send_failed;
+        int splice_left;    //正在进行的splice中还没有完成的个数
+        ssize_t splice_sent; //正在进行的splice已经发到socket的字节数
+        int pipe[2];        //splice使用的管道，第一次发送大文件时创建
+        size_t pipe_cap;
+        size_t pipe_len;    //管道中已经从文件读入、还没有发到socket的字节数
+        struct msghdr msg;  //正在进行的sendmsg引用的消息
+        uint64_t acked;     //上次超时检查时对方确认的字节数
+        std::vector<pending_buf> pending;
+    };
+
+    struct io_uring_sqe *get_sqe();
+    void arm_accept();
+    void arm_recv(int fd);
+    void arm_poll(int fd, int op);
+
+    void on_accept(struct io_uring_cqe *cqe);
+    //淘汰空闲连接时关闭它，文件描述符等内核中的请求完成后再关闭
+    void evict(int fd);
+    void on_recv(int fd, struct io_uring_cqe *cqe);
+    void on_send(int fd, int res);
+    void on_splice(int fd, int op, int res);
+    //没有暂存数据时保证recv在内核中，有暂存数据时取消它
+    void update_recv(int fd);
+
+    //把暂存的接收缓冲区交给连接，返回true表示全部交出
+    bool feed_pending(int fd);
+    //解析收到的请求，有应答时开始发送，空闲时重新提交recv
+    void drive(int fd);
+    //提交正在发送的应答的下一段
+    void start_send(int fd);
+    //一次发送请求完成，n是发出的字节数
+    void send_done(int fd, ssize_t n);
+    //按连接的超时时刻调整定时器
+    void extend_timer(int fd);
+
+    //关闭连接：shutdown唤醒内核中的请求，它们都完成后再关闭文件描述符
+    void close_conn(int fd);
+    void finish_close(int fd);
+    //定时器回调：splice在发完整块之前不会完成，慢速的客户端在这期间没有完成项来推迟定时器，
+    //所以有发送在进行时按对方确认的字节数判断连接的接收速率是否还满足要求
+    static void timeout_cb(client_data *user_data);
+
+private:
+    io_ring m_ring;
+    uring_conn *m_conns;
+    bool m_accept_armed;
+    //timerfd和信号管道的poll是否还在内核中
+    bool m_timer_armed;
+    bool m_signal_armed;
+    bool m_stop;
+};
+
+#endif
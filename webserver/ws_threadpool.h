@@ -0,0 +1,296 @@
+#ifndef WS_THREADPOOL_H
+#define WS_THREADPOOL_H
+
+#include <atomic>
+#include <cstdio>
+#include <exception>
+#include <pthread.h>
+#include <sched.h>
+#include "locker.h"
+#include "threadpool.h"
+
+// 工作窃取线程池，可以在启动时替换threadpool<T>
+// 每个工作线程有一个有界的无锁环形队列，reactor线程轮流投递到各个队列，
+// 工作线程优先处理自己的队列，空闲时从其他线程的队列窃取任务，
+// 只有存在睡眠的工作线程时才post信号量，避免每个请求都经过互斥锁和futex
+template<typename T>
+class ws_threadpool : public task_pool<T> {
+public:
+    /*thread_number是线程池中线程的数量，max_requests是所有队列中最多允许的、等待处理的请求的数量*/
+    ws_threadpool(int thread_number = 8, int max_requests = 10000);
+    ~ws_threadpool();
+    bool append(T* request);
+    size_t queued();
+
+private:
+    // 环形队列的槽位，seq用于区分槽位当前可写还是可读（Vyukov有界MPMC队列）
+    struct slot {
+        std::atomic<size_t> seq;
+        T* data;
+    };
+
+    // 每个工作线程的队列，头尾指针分别放在不同的缓存行，减少伪共享
+    struct work_queue {
+        alignas(64) std::atomic<size_t> head;
+        alignas(64) std::atomic<size_t> tail;
+        alignas(64) slot* slots;
+        size_t mask;
+    };
+
+    // 工作线程的启动参数
+    struct worker_arg {
+        ws_threadpool* pool;
+        int index;
+    };
+
+    static void* worker(void* arg);
+    void run(int index);
+
+    bool push(work_queue& q, T* request);
+    bool pop(work_queue& q, T*& request);
+    bool pop_or_steal(int index, T*& request);
+
+    // 存在睡眠的工作线程时唤醒其中一个
+    void wake_one();
+
+private:
+    // 线程的数量
+    int m_thread_number;
+
+    // 描述线程池的数组，大小为m_thread_number
+    pthread_t* m_threads;
+
+    worker_arg* m_args;
+
+    // 每个工作线程一个请求队列
+    work_queue* m_queues;
+
+    // 投递请求时的起始队列，轮流使用
+    std::atomic<unsigned> m_next;
+
+    // 正在睡眠(或准备睡眠)且尚未被唤醒的工作线程数量
+    std::atomic<int> m_sleepers;
+
+    // 睡眠的工作线程在此等待
+    sem m_idle;
+
+    // 是否结束线程
+    std::atomic<bool> m_stop;
+
+    // 进入睡眠前自旋查找任务的次数
+    static const int SPIN_COUNT = 64;
+};
+
+template< typename T >
+ws_threadpool< T >::ws_threadpool(int thread_number, int max_requests) :
+        m_thread_number(thread_number), m_threads(NULL), m_args(NULL), m_queues(NULL),
+        m_next(0), m_sleepers(0), m_stop(false) {
+
+    if((thread_number <= 0) || (max_requests <= 0) ) {
+        throw std::exception();
+    }
+
+    // 每个队列的容量取2的幂，以便用掩码代替取模
+    size_t capacity = 2;
+    while (capacity * thread_number < (size_t)max_requests) {
+        capacity <<= 1;
+    }
+
+    m_queues = new work_queue[m_thread_number];
+    for (int i = 0; i < m_thread_number; ++i) {
+        m_queues[i].head.store(0, std::memory_order_relaxed);
+        m_queues[i].tail.store(0, std::memory_order_relaxed);
+        m_queues[i].slots = new slot[capacity];
+        m_queues[i].mask = capacity - 1;
+        for (size_t j = 0; j < capacity; ++j) {
+            m_queues[i].slots[j].seq.store(j, std::memory_order_relaxed);
+            m_queues[i].slots[j].data = NULL;
+        }
+    }
+
+    m_threads = new pthread_t[m_thread_number];
+    m_args = new worker_arg[m_thread_number];
+
+    // 创建thread_number 个线程，每个线程绑定自己的队列下标
+    for ( int i = 0; i < thread_number; ++i ) {
+        printf( "create the %dth thread\n", i);
+        m_args[i].pool = this;
+        m_args[i].index = i;
+        if(pthread_create(m_threads + i, NULL, worker, m_args + i ) != 0) {
+            throw std::exception();
+        }
+    }
+}
+
+template< typename T >
+ws_threadpool< T >::~ws_threadpool() {
+    m_stop = true;
+    for (int i = 0; i < m_thread_number; ++i) {
+        m_idle.post();
+    }
+    for (int i = 0; i < m_thread_number; ++i) {
+        pthread_join(m_threads[i], NULL);
+    }
+    for (int i = 0; i < m_thread_number; ++i) {
+        delete [] m_queues[i].slots;
+    }
+    delete [] m_queues;
+    delete [] m_args;
+    delete [] m_threads;
+}
+
+template< typename T >
+bool ws_threadpool< T >::push(work_queue& q, T* request) {
+    size_t pos = q.tail.load(std::memory_order_relaxed);
+    for (;;) {
+        slot& s = q.slots[pos & q.mask];
+        size_t seq = s.seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (q.tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                s.data = request;
+                s.seq.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            // 队列已满
+            return false;
+        } else {
+            pos = q.tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+template< typename T >
+bool ws_threadpool< T >::pop(work_queue& q, T*& request) {
+    size_t pos = q.head.load(std::memory_order_relaxed);
+    for (;;) {
+        slot& s = q.slots[pos & q.mask];
+        size_t seq = s.seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (q.head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                request = s.data;
+                s.seq.store(pos + q.mask + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            // 队列为空
+            return false;
+        } else {
+            pos = q.head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+template< typename T >
+bool ws_threadpool< T >::pop_or_steal(int index, T*& request) {
+    if (pop(m_queues[index], request)) {
+        return true;
+    }
+    // 自己的队列为空，依次从其他工作线程的队列窃取
+    for (int i = 1; i < m_thread_number; ++i) {
+        if (pop(m_queues[(index + i) % m_thread_number], request)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+template< typename T >
+void ws_threadpool< T >::wake_one() {
+    // 入队的写操作必须先于读取m_sleepers对其他线程可见，否则可能与工作线程的登记交错而丢失唤醒
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // 认领一个睡眠者再post，多个生产者不会为同一个睡眠线程重复post
+    int sleepers = m_sleepers.load();
+    while (sleepers > 0) {
+        if (m_sleepers.compare_exchange_weak(sleepers, sleepers - 1)) {
+            m_idle.post();
+            return;
+        }
+    }
+}
+
+// 各队列尾指针与头指针之差的和，读取时不加锁，只是近似值
+template< typename T >
+size_t ws_threadpool< T >::queued()
+{
+    size_t n = 0;
+    for (int i = 0; i < m_thread_number; ++i) {
+        size_t head = m_queues[i].head.load(std::memory_order_relaxed);
+        size_t tail = m_queues[i].tail.load(std::memory_order_relaxed);
+        if (tail > head) {
+            n += tail - head;
+        }
+    }
+    return n;
+}
+
+template< typename T >
+bool ws_threadpool< T >::append( T* request )
+{
+    unsigned start = m_next.fetch_add(1, std::memory_order_relaxed);
+    for (int i = 0; i < m_thread_number; ++i) {
+        if (push(m_queues[(start + i) % m_thread_number], request)) {
+            wake_one();
+            return true;
+        }
+    }
+    // 所有队列都已满
+    return false;
+}
+
+template< typename T >
+void* ws_threadpool< T >::worker( void* arg )
+{
+    worker_arg* warg = ( worker_arg* )arg;
+    warg->pool->run(warg->index);
+    return warg->pool;
+}
+
+template< typename T >
+void ws_threadpool< T >::run(int index) {
+
+    while (!m_stop) {
+        T* request = NULL;
+        bool found = false;
+        for (int spin = 0; spin < SPIN_COUNT && !m_stop; ++spin) {
+            if (pop_or_steal(index, request)) {
+                found = true;
+                break;
+            }
+            sched_yield();
+        }
+
+        if (!found) {
+            // 先登记为睡眠者再检查一次队列，保证与append之间不会丢失唤醒
+            m_sleepers.fetch_add(1);
+            if (pop_or_steal(index, request)) {
+                // 撤销登记；若已被生产者认领，则消费掉那一次post
+                int sleepers = m_sleepers.load();
+                while (sleepers > 0 && !m_sleepers.compare_exchange_weak(sleepers, sleepers - 1)) {
+                }
+                if (sleepers == 0) {
+                    m_idle.wait();
+                }
+            } else {
+                m_idle.wait();
+                continue;
+            }
+        }
+
+        // 批量唤醒：取到任务后队列中仍有积压，则把其他睡眠线程接力唤醒
+        if (m_queues[index].head.load(std::memory_order_relaxed) !=
+            m_queues[index].tail.load(std::memory_order_relaxed)) {
+            wake_one();
+        }
+
+        if ( !request ) {
+            continue;
+        }
+        request->process();
+    }
+
+}
+
+#endif